@@ -7,21 +7,25 @@
 #include <string>
 #include <iostream>
 #include <cmath>
+#include <cstdlib>
 #include <sstream>
 #include <iomanip>
+#include <fstream>
+#include <chrono>
 #include "shader/shader.h"
 #include "utils/mesh/mesh.h"
 #include "utils/texture/texture.h"
 #include "utils/skybox/skybox.h"
 #include "utils/scene/scene.h"
+#include "utils/impact/impact.h"
 using namespace std;
 
 // ---------- settings ----------
 const unsigned int SCR_WIDTH = 1380;
 const unsigned int SCR_HEIGHT = 720;
 
-// camera
-glm::vec3 camPos   = glm::vec3(0.0f, 60.0f, 80.0f);
+// camera (world position in double; rendering is relative to it)
+glm::dvec3 camPos  = glm::dvec3(0.0, 60.0, 80.0);
 glm::vec3 camFront = glm::vec3(0.0f, -0.3f, -1.0f);
 glm::vec3 camUp    = glm::vec3(0.0f, 1.0f, 0.0f);
 
@@ -35,6 +39,7 @@ bool keys[1024];
 float deltaTime = 0.0f, lastFrame = 0.0f;
 
 // Time control
+const float MAX_TIME_SCALE = 1.0e7f;
 float timeScale = 1.0f;
 bool showUI = true;
 
@@ -42,7 +47,7 @@ bool showUI = true;
 int focusedPlanet = -1;
 float focusDistance = 15.0f;
 bool smoothCamera = false;
-glm::vec3 targetCamPos = camPos;
+glm::dvec3 targetCamPos = camPos;
 
 // forward scene pointer for key toggles
 static class Scene* g_scene = nullptr;
@@ -63,13 +68,25 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
       if(key == GLFW_KEY_V) { g_scene->showDust = !g_scene->showDust; std::cout<<"Dust: "<<(g_scene->showDust?"ON":"OFF")<<"\n"; }
       if(key == GLFW_KEY_R) { g_scene->showRings = !g_scene->showRings; std::cout<<"Rings: "<<(g_scene->showRings?"ON":"OFF")<<"\n"; }
       if(key == GLFW_KEY_G) { g_scene->showAtmospheres = !g_scene->showAtmospheres; std::cout<<"Atmospheres: "<<(g_scene->showAtmospheres?"ON":"OFF")<<"\n"; }
+      if(key == GLFW_KEY_O) { g_scene->occlusionCulling = !g_scene->occlusionCulling; std::cout<<"Occlusion culling: "<<(g_scene->occlusionCulling?"ON":"OFF")<<"\n"; }
+      if(key == GLFW_KEY_F) { g_scene->farFieldBelt = !g_scene->farFieldBelt; std::cout<<"Far-field belt: "<<(g_scene->farFieldBelt?"ON":"OFF")<<"\n"; }
       if(key == GLFW_KEY_L) { g_scene->showLensFlare = !g_scene->showLensFlare; std::cout<<"Lens Flare: "<<(g_scene->showLensFlare?"ON":"OFF")<<"\n"; }
       if(key == GLFW_KEY_H) { showUI = !showUI; }
+      if(key == GLFW_KEY_M) { g_scene->setBeltSelfGravity(!g_scene->isBeltSelfGravity()); std::cout<<"Belt self-gravity: "<<(g_scene->isBeltSelfGravity()?"ON":"OFF")<<"\n"; }
+      if(key == GLFW_KEY_C) { g_scene->setCollisions(!g_scene->isCollisions()); std::cout<<"Collisions: "<<(g_scene->isCollisions()?"ON":"OFF")<<"\n"; }
+      if(key == GLFW_KEY_T) { g_scene->setBlockTimesteps(!g_scene->isBlockTimesteps()); std::cout<<"Block timesteps: "<<(g_scene->isBlockTimesteps()?"ON":"OFF")<<"\n"; }
+      if(key == GLFW_KEY_J) {
+        g_scene->setUseEphemeris(!g_scene->isUsingEphemeris());
+        if(!g_scene->hasEphemeris()) std::cout<<"Ephemeris: no table loaded (utils/ephemeris/de.bin)\n";
+        else std::cout<<"Ephemeris: "<<(g_scene->isUsingEphemeris()?"ON":"OFF")<<"\n";
+      }
+      if(key == GLFW_KEY_N) { g_scene->setNBodyMode(!g_scene->isNBodyMode()); std::cout<<"N-body: "<<(g_scene->isNBodyMode()?"ON":"OFF")<<"\n"; }
 
       // Time control
       if(key == GLFW_KEY_SPACE) { timeScale = (timeScale == 0.0f) ? 1.0f : 0.0f; std::cout<<"Time: "<<(timeScale==0.0f?"PAUSED":"RUNNING")<<"\n"; }
-      if(key == GLFW_KEY_COMMA) { timeScale = max(0.0f, timeScale - 0.5f); std::cout<<"Time scale: "<<timeScale<<"x\n"; }
-      if(key == GLFW_KEY_PERIOD) { timeScale = min(10.0f, timeScale + 0.5f); std::cout<<"Time scale: "<<timeScale<<"x\n"; }
+      // half steps up to 10x, then decades up to MAX_TIME_SCALE
+      if(key == GLFW_KEY_COMMA) { timeScale = timeScale > 10.0f ? timeScale / 10.0f : max(0.0f, timeScale - 0.5f); std::cout<<"Time scale: "<<timeScale<<"x\n"; }
+      if(key == GLFW_KEY_PERIOD) { timeScale = timeScale >= 10.0f ? min(MAX_TIME_SCALE, timeScale * 10.0f) : timeScale + 0.5f; std::cout<<"Time scale: "<<timeScale<<"x\n"; }
 
       // Planet focus (1-9 keys)
       if(key >= GLFW_KEY_1 && key <= GLFW_KEY_9) {
@@ -129,36 +146,36 @@ void doMovement(float dt){
   if(focusedPlanet >= 0) return; // Disable manual movement when focused
 
   float cameraSpeed = 20.0f * dt;
-  if(keys[GLFW_KEY_W]) camPos += cameraSpeed * camFront;
-  if(keys[GLFW_KEY_S]) camPos -= cameraSpeed * camFront;
-  if(keys[GLFW_KEY_A]) camPos -= glm::normalize(glm::cross(camFront, camUp)) * cameraSpeed;
-  if(keys[GLFW_KEY_D]) camPos += glm::normalize(glm::cross(camFront, camUp)) * cameraSpeed;
-  if(keys[GLFW_KEY_Q]) camPos += cameraSpeed * camUp;
-  if(keys[GLFW_KEY_E]) camPos -= cameraSpeed * camUp;
+  if(keys[GLFW_KEY_W]) camPos += glm::dvec3(cameraSpeed * camFront);
+  if(keys[GLFW_KEY_S]) camPos -= glm::dvec3(cameraSpeed * camFront);
+  if(keys[GLFW_KEY_A]) camPos -= glm::dvec3(glm::normalize(glm::cross(camFront, camUp)) * cameraSpeed);
+  if(keys[GLFW_KEY_D]) camPos += glm::dvec3(glm::normalize(glm::cross(camFront, camUp)) * cameraSpeed);
+  if(keys[GLFW_KEY_Q]) camPos += glm::dvec3(cameraSpeed * camUp);
+  if(keys[GLFW_KEY_E]) camPos -= glm::dvec3(cameraSpeed * camUp);
 }
 
-void updateFocusCamera(Scene& scene, float simulationTime, float dt) {
+void updateFocusCamera(Scene& scene, float dt) {
   if(focusedPlanet < 0 || focusedPlanet >= 9) return;
 
   // Get planet position
-  glm::vec3 planetPos = scene.getPlanetPosition(focusedPlanet, simulationTime);
+  glm::dvec3 planetPos = scene.getPlanetPosition(focusedPlanet);
 
   // Calculate target camera position
-  targetCamPos = planetPos + glm::vec3(focusDistance * 0.5f, focusDistance * 0.3f, focusDistance);
+  targetCamPos = planetPos + glm::dvec3(focusDistance * 0.5, focusDistance * 0.3, focusDistance);
 
   // Smooth interpolation
   if(smoothCamera) {
     float smoothSpeed = 2.0f * dt;
-    camPos = glm::mix(camPos, targetCamPos, smoothSpeed);
+    camPos = glm::mix(camPos, targetCamPos, (double)smoothSpeed);
   } else {
     camPos = targetCamPos;
   }
 
   // Look at planet
-  camFront = glm::normalize(planetPos - camPos);
+  camFront = glm::normalize(glm::vec3(planetPos - camPos));
 }
 
-void displayUI(GLFWwindow* window, Scene& scene, float simulationTime, float fps) {
+void displayUI(GLFWwindow* window, Scene& scene, double simulationTime, float fps) {
   if(!showUI) return;
 
   std::stringstream ss;
@@ -166,14 +183,78 @@ void displayUI(GLFWwindow* window, Scene& scene, float simulationTime, float fps
      << " | Time: " << std::fixed << std::setprecision(1) << timeScale << "x";
 
   if(timeScale == 0.0f) ss << " [PAUSED]";
+  // N-body substeps are budgeted, so at high warp the simulation may trail the request
+  double achieved = scene.getEffectiveTimeScale();
+  if(timeScale > 0.0f && achieved < 0.9 * timeScale) ss << " (achieved " << std::scientific << std::setprecision(1) << achieved << "x)" << std::fixed;
   if(focusedPlanet >= 0) ss << " | Focus: " << planetNames[focusedPlanet];
+  if(scene.isUsingEphemeris()) ss << " | Ephemeris";
+  if(scene.isNBodyMode()) ss << " | N-body dE/E: " << std::scientific << std::setprecision(1) << scene.getEnergyDrift() << std::fixed
+                            << " | Forces/step: " << scene.getForceEvaluations() << (scene.isBlockTimesteps() ? " [block]" : "");
+  if(scene.occlusionCulling && scene.showAsteroids) ss << " | Occluded: " << scene.getOccludedAsteroids();
+  if(scene.showAsteroids && std::isfinite(scene.getFarFieldDistance())) ss << " | Belt volume beyond " << scene.getFarFieldDistance();
+  // passes that fall behind skip ahead, so show how much of the time they covered
+  if(scene.isCollisions()) ss << " | Collisions: " << scene.getCollisionTotal() << " (" << std::setprecision(2) << scene.getCollisionMilliseconds() << " ms/pass, "
+                              << std::setprecision(0) << 100.0 * scene.getCollisionCoverage() << "% swept)" << std::setprecision(1);
 
-  ss << " | [H]elp [Space]Pause [,.]Speed [1-9]Focus [B]elts [V]Dust [R]ings [G]low [L]Flare";
+  ss << " | [H]elp [Space]Pause [,.]Speed [1-9]Focus [B]elts [V]Dust [R]ings [G]low [L]Flare [O]cclusion [F]ar-field [N]-body";
 
   glfwSetWindowTitle(window, ss.str().c_str());
 }
 
-int main(){
+// Headless close-approach run against the scene's planets; no window is opened.
+//   ./app --impact case.txt [--clones N] [--seed S] [--target planet] [--radius r]
+//         [--duration t] [--step dt] [--out clones.csv]
+int runImpact(int argc, char** argv){
+    Scene scene;
+    ImpactSettings settings;
+    settings.seed = scene.seed;
+    std::string casePath, outPath;
+    double radius = -1.0;
+    for(int i=1;i+1<argc;++i) {
+      std::string arg = argv[i];
+      if(arg == "--impact") casePath = argv[++i];
+      else if(arg == "--clones") settings.clones = strtoull(argv[++i], nullptr, 10);
+      else if(arg == "--seed") settings.seed = strtoull(argv[++i], nullptr, 10);
+      else if(arg == "--target") settings.target = atoi(argv[++i]);
+      else if(arg == "--radius") radius = atof(argv[++i]);
+      else if(arg == "--duration") settings.duration = atof(argv[++i]);
+      else if(arg == "--step") settings.step = atof(argv[++i]);
+      else if(arg == "--out") outPath = argv[++i];
+    }
+    ImpactCase nominal;
+    if(!loadImpactCase(casePath, nominal)) return 1;
+    if(settings.target < 0 || settings.target >= (int)scene.getPlanetCount()) {
+      cerr<<"--target must be a planet index from 0 to "<<scene.getPlanetCount()-1<<endl;
+      return 1;
+    }
+    settings.targetRadius = radius >= 0.0 ? radius : scene.getBodyRadii()[settings.target];
+    std::ofstream out;
+    if(!outPath.empty()) {
+      out.open(outPath);
+      if(!out) {
+        cerr<<"Cannot write "<<outPath<<endl;
+        return 1;
+      }
+    }
+
+    ImpactEngine engine(scene.getOrbitTable(), scene.getBodyGM());
+    ImpactSummary summary;
+    auto start = std::chrono::steady_clock::now();
+    if(!engine.run(nominal, settings, outPath.empty() ? nullptr : &out, summary)) return 1;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout<<"Clones: "<<summary.clones<<" propagated, "<<summary.unbound<<" unbound (seed "<<settings.seed<<")\n";
+    std::cout<<"Target: "<<scene.getPlanetName(settings.target)<<", radius "<<settings.targetRadius<<"\n";
+    std::cout<<"Hits: "<<summary.hits<<"  P = "<<summary.probability<<" +/- "<<summary.standardError<<"\n";
+    std::cout<<"Closest approach: "<<summary.closest<<" at t = "<<summary.closestTime<<"\n";
+    std::cout<<"Time: "<<seconds<<" s"<<std::endl;
+    return 0;
+}
+
+int main(int argc, char** argv){
+    for(int i=1;i+1<argc;++i) {
+      if(std::string(argv[i]) == "--impact") return runImpact(argc, argv);
+    }
     if(!glfwInit()){
       cerr<<"GLFW init failed"<<endl;
       return -1;
@@ -213,6 +294,12 @@ int main(){
 
     // create and initialize scene
     Scene scene;
+    for(int i=1;i+1<argc;++i) {
+      if(std::string(argv[i]) == "--asteroids") scene.asteroidCount = max(0, atoi(argv[++i]));
+      else if(std::string(argv[i]) == "--dust") scene.dustCount = max(0, atoi(argv[++i]));
+      else if(std::string(argv[i]) == "--seed") scene.seed = strtoull(argv[++i], nullptr, 10);
+      else if(std::string(argv[i]) == "--catalog") scene.catalogPath = argv[++i];
+    }
     scene.init();
     g_scene = &scene;
 
@@ -227,7 +314,6 @@ int main(){
     };
     Skybox skybox(faces);
 
-    float simulationTime = 0.0f;
     int frameCount = 0;
     float fpsTimer = 0.0f;
     float currentFPS = 0.0f;
@@ -240,10 +326,17 @@ int main(){
     std::cout << "Space: Pause/Resume\n";
     std::cout << ", / . : Decrease/Increase time speed\n";
     std::cout << "B: Toggle asteroids\n";
+    std::cout << "O: Toggle occlusion culling\n";
+    std::cout << "F: Toggle far-field belt volume\n";
     std::cout << "V: Toggle dust\n";
     std::cout << "R: Toggle Saturn rings\n";
     std::cout << "G: Toggle atmospheric glow\n";
     std::cout << "L: Toggle lens flare\n";
+    std::cout << "N: Toggle N-body gravity\n";
+    std::cout << "M: Toggle belt self-gravity (N-body)\n";
+    std::cout << "T: Toggle block timesteps (N-body)\n";
+    std::cout << "C: Toggle collision detection\n";
+    std::cout << "J: Toggle ephemeris planet positions\n";
     std::cout << "H: Toggle UI\n";
     std::cout << "ESC: Exit\n";
     std::cout << "============================\n\n";
@@ -252,7 +345,6 @@ int main(){
         float currentFrame = (float)glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
-        simulationTime += deltaTime * timeScale;
 
         // FPS calculation
         frameCount++;
@@ -265,19 +357,27 @@ int main(){
 
         glfwPollEvents();
         doMovement(deltaTime);
-        updateFocusCamera(scene, simulationTime, deltaTime);
+        scene.setTimeScale(timeScale);
+        scene.update();
+        double simulationTime = scene.getSimulationTime();
+        updateFocusCamera(scene, deltaTime);
 
         if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) glfwSetWindowShouldClose(window, true);
 
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glm::mat4 proj = glm::perspective(glm::radians(fov), (float)SCR_WIDTH/(float)SCR_HEIGHT, 0.1f, 1000.0f);
-        glm::mat4 view = glm::lookAt(camPos, camPos + camFront, camUp);
+        // the framebuffer, not the window: they differ after a resize and on HiDPI screens
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        if(framebufferWidth <= 0 || framebufferHeight <= 0) { glfwSwapBuffers(window); continue; }     // minimized
+        glm::mat4 proj = glm::perspective(glm::radians(fov), (float)framebufferWidth/(float)framebufferHeight, 0.1f, 1000.0f);
+        // camera-relative: the eye sits at the origin and the scene is shifted instead
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), camFront, camUp);
 
         // Render scene with screen dimensions for lens flare
         scene.render(planetShader, view, proj, camPos, camFront, camUp, sphere,
-                    simulationTime, deltaTime, SCR_WIDTH, SCR_HEIGHT);
+                    simulationTime, deltaTime, framebufferWidth, framebufferHeight);
 
         skybox.render(view, proj);
 
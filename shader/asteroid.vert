@@ -0,0 +1,69 @@
+#version 330 core
+// Mesh tier of the belt: one instance per rock, placed and spun from its
+// record (see AsteroidInstance). The shared base mesh is pushed in and out
+// along each vertex by value noise seeded with the rock's id, so no two
+// rocks have the same outline.
+layout(location = 0) in vec3 aPos;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTex;
+layout(location = 3) in vec4 aCentreRadius;     // camera-relative centre, radius
+layout(location = 4) in vec4 aAxisAngle;        // spin axis, angle in radians
+layout(location = 5) in uint aRockId;
+out vec3 FragPos; out vec3 Normal; out vec2 TexCoords;
+uniform mat4 view; uniform mat4 projection;
+
+// base meshes reach 0.87 of the radius, so this keeps rocks inside their bounds
+const float DISPLACEMENT = 0.15;
+
+mat3 axisAngle(vec3 axis, float angle){
+    float s = sin(angle), c = cos(angle), t = 1.0 - c;
+    return mat3(t*axis.x*axis.x + c,        t*axis.x*axis.y + s*axis.z, t*axis.x*axis.z - s*axis.y,
+                t*axis.x*axis.y - s*axis.z, t*axis.y*axis.y + c,        t*axis.y*axis.z + s*axis.x,
+                t*axis.x*axis.z + s*axis.y, t*axis.y*axis.z - s*axis.x, t*axis.z*axis.z + c);
+}
+
+uint hash(uint x){
+    x ^= x >> 16u; x *= 0x7feb352du;
+    x ^= x >> 15u; x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+float lattice(ivec3 c, uint seed){
+    uint h = hash(uint(c.x) ^ hash(uint(c.y) ^ hash(uint(c.z) ^ seed)));
+    return float(h) * (2.0 / 4294967295.0) - 1.0;
+}
+
+// trilinear value noise in [-1, 1]
+float valueNoise(vec3 p, uint seed){
+    ivec3 c = ivec3(floor(p));
+    vec3 f = fract(p);
+    vec3 u = f * f * (3.0 - 2.0 * f);
+    float x00 = mix(lattice(c,               seed), lattice(c + ivec3(1,0,0), seed), u.x);
+    float x10 = mix(lattice(c + ivec3(0,1,0), seed), lattice(c + ivec3(1,1,0), seed), u.x);
+    float x01 = mix(lattice(c + ivec3(0,0,1), seed), lattice(c + ivec3(1,0,1), seed), u.x);
+    float x11 = mix(lattice(c + ivec3(0,1,1), seed), lattice(c + ivec3(1,1,1), seed), u.x);
+    return mix(mix(x00, x10, u.y), mix(x01, x11, u.y), u.z);
+}
+
+float rockNoise(vec3 p, uint seed){
+    return (valueNoise(p * 1.7, seed) + 0.5 * valueNoise(p * 3.9, seed ^ 0x9e3779b9u)) * (1.0 / 1.5);
+}
+
+void main(){
+    uint seed = hash(aRockId);
+    float n = rockNoise(aPos, seed);
+    vec3 pos = aPos * (1.0 + DISPLACEMENT * n);
+    // tilt the base normal against the noise gradient on the surface
+    const float e = 0.02;
+    vec3 g = vec3(rockNoise(aPos + vec3(e,0,0), seed) - n,
+                  rockNoise(aPos + vec3(0,e,0), seed) - n,
+                  rockNoise(aPos + vec3(0,0,e), seed) - n) / e;
+    vec3 normal = normalize(aNormal - DISPLACEMENT * length(aPos) * (g - dot(g, aNormal) * aNormal));
+
+    mat3 rotation = axisAngle(aAxisAngle.xyz, aAxisAngle.w);
+    FragPos = aCentreRadius.xyz + rotation * (pos * aCentreRadius.w);
+    Normal = rotation * normal;
+    TexCoords = aTex;
+    gl_Position = projection * view * vec4(FragPos,1.0);
+}
@@ -0,0 +1,23 @@
+#version 330 core
+out vec4 FragColor;
+in vec2 Corner; in vec3 Centre; in float Radius;
+uniform mat4 view; uniform sampler2D texture1; uniform vec3 lightPos;
+void main(){
+    float r2 = dot(Corner, Corner);
+    if(r2 > 1.0) discard;
+    vec3 right = vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 up = vec3(view[0][1], view[1][1], view[2][1]);
+    vec3 toCamera = normalize(-Centre);
+    vec3 norm = normalize(right * Corner.x + up * Corner.y + toCamera * sqrt(1.0 - r2));
+    vec3 fragPos = Centre + norm * Radius;
+    // same terms as planet.frag
+    vec3 color = texture(texture1, Corner * 0.5 + 0.5).rgb;
+    vec3 ambient = 0.15 * color;
+    vec3 lightDir = normalize(lightPos - fragPos);
+    vec3 diffuse = max(dot(norm, lightDir), 0.0) * color;
+    vec3 reflectDir = reflect(-lightDir, norm);
+    vec3 specular = vec3(0.4) * pow(max(dot(toCamera, reflectDir), 0.0), 32.0);
+    float distance = length(lightPos - fragPos);
+    float attenuation = 1.0 / (1.0 + 0.002 * distance + 0.000001 * distance * distance);
+    FragColor = vec4(ambient + attenuation * (diffuse + specular), 1.0);
+}
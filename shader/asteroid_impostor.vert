@@ -0,0 +1,16 @@
+#version 330 core
+// Impostor tier: a camera-facing quad per rock, shaded as a sphere in the
+// fragment shader.
+layout(location = 0) in vec2 aCorner;           // [-1, 1]^2
+layout(location = 3) in vec4 aCentreRadius;     // camera-relative centre, radius
+out vec2 Corner; out vec3 Centre; out float Radius;
+uniform mat4 view; uniform mat4 projection;
+void main(){
+    vec3 right = vec3(view[0][0], view[1][0], view[2][0]);
+    vec3 up = vec3(view[0][1], view[1][1], view[2][1]);
+    Corner = aCorner;
+    Centre = aCentreRadius.xyz;
+    Radius = aCentreRadius.w;
+    vec3 pos = Centre + (right * aCorner.x + up * aCorner.y) * Radius;
+    gl_Position = projection * view * vec4(pos,1.0);
+}
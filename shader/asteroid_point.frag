@@ -0,0 +1,7 @@
+#version 330 core
+out vec4 FragColor;
+in float Brightness; in float Coverage;
+uniform sampler2D texture1;
+void main(){
+    FragColor = vec4(texture(texture1, vec2(0.5)).rgb * Brightness, Coverage);
+}
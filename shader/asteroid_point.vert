@@ -0,0 +1,18 @@
+#version 330 core
+// Point tier: sub-pixel rocks as single pixels, dimmed by the fraction of the
+// pixel they cover and by how much of their lit side faces the camera.
+layout(location = 3) in vec4 aCentreRadius;     // camera-relative centre, radius
+out float Brightness; out float Coverage;
+uniform mat4 view; uniform mat4 projection; uniform vec3 lightPos;
+uniform float pixelScale;                       // pixels per unit radius at unit depth
+void main(){
+    vec4 viewPos = view * vec4(aCentreRadius.xyz, 1.0);
+    gl_Position = projection * viewPos;
+    float pixels = aCentreRadius.w / max(-viewPos.z, 1e-3) * pixelScale;
+    Coverage = clamp(3.14159265 * pixels * pixels, 0.05, 1.0);
+    vec3 toLight = lightPos - aCentreRadius.xyz;
+    float phase = 0.5 + 0.5 * dot(normalize(toLight), normalize(-aCentreRadius.xyz));
+    float distance = length(toLight);
+    float attenuation = 1.0 / (1.0 + 0.002 * distance + 0.000001 * distance * distance);
+    Brightness = 0.15 + attenuation * phase;
+}
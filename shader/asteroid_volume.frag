@@ -0,0 +1,66 @@
+#version 330 core
+// Far-field belt: marches the view ray through the annular density texture
+// from nearDistance on, where the instanced rocks stop. Density is rock
+// cross-section per unit volume, so the opacity is the share of the pixel
+// the rocks would cover; lighting follows the point tier.
+in vec2 Ndc;
+out vec4 FragColor;
+uniform mat4 inverseViewProjection;     // camera at the origin
+uniform mat4 viewProjection;
+uniform sampler3D density;              // radius, azimuth, height
+uniform sampler2D texture1;
+uniform vec3 centre;                    // belt centre, camera-relative
+uniform vec4 shell;                     // inner and outer radius, lowest and highest y
+uniform float azimuthOffset;            // mean rotation since the texture was built
+uniform float nearDistance;
+uniform vec3 lightPos;
+const int STEPS = 48;
+const float TWO_PI = 6.28318531;
+
+void main(){
+    vec4 nearPoint = inverseViewProjection * vec4(Ndc, -1.0, 1.0);
+    vec3 dir = normalize(nearPoint.xyz / nearPoint.w);
+    vec3 from = -centre;                // camera relative to the belt centre
+
+    // ray against the slab of heights and the outer cylinder
+    float tNear = nearDistance, tFar = 1e30;
+    if (abs(dir.y) > 1e-6) {
+        float t0 = (shell.z - from.y) / dir.y, t1 = (shell.w - from.y) / dir.y;
+        tNear = max(tNear, min(t0, t1));
+        tFar = min(tFar, max(t0, t1));
+    } else if (from.y < shell.z || from.y > shell.w) discard;
+    float a = dot(dir.xz, dir.xz), b = dot(from.xz, dir.xz), c = dot(from.xz, from.xz) - shell.y * shell.y;
+    if (a > 1e-12) {
+        float disc = b * b - a * c;
+        if (disc < 0.0) discard;
+        float root = sqrt(disc);
+        tNear = max(tNear, (-b - root) / a);
+        tFar = min(tFar, (-b + root) / a);
+    } else if (c > 0.0) discard;
+    if (tFar <= tNear) discard;
+
+    // interleaved gradient noise staggers the samples between pixels
+    float jitter = fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+    float dt = (tFar - tNear) / float(STEPS);
+    float transmittance = 1.0, light = 0.0, tHit = -1.0;
+    for (int i = 0; i < STEPS; ++i) {
+        float t = tNear + (float(i) + jitter) * dt;
+        vec3 p = from + dir * t;
+        float theta = atan(p.z, p.x) - azimuthOffset;
+        vec3 uvw = vec3((length(p.xz) - shell.x) / (shell.y - shell.x), theta / TWO_PI, (p.y - shell.z) / (shell.w - shell.z));
+        float alpha = 1.0 - exp(-texture(density, uvw).r * dt);
+        if (alpha <= 0.0) continue;
+        if (tHit < 0.0) tHit = t;
+        vec3 toLight = lightPos - dir * t;
+        float phase = 0.5 + 0.5 * dot(normalize(toLight), -dir);
+        float distance = length(toLight);
+        float attenuation = 1.0 / (1.0 + 0.002 * distance + 0.000001 * distance * distance);
+        light += transmittance * alpha * (0.15 + attenuation * phase);
+        transmittance *= 1.0 - alpha;
+    }
+    float coverage = 1.0 - transmittance;
+    if (coverage < 1.0 / 512.0) discard;
+    vec4 clip = viewProjection * vec4(dir * tHit, 1.0);
+    gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;
+    FragColor = vec4(texture(texture1, vec2(0.5)).rgb * light / coverage, coverage);
+}
@@ -0,0 +1,8 @@
+#version 330 core
+// Full-screen triangle for the far-field belt; passes the NDC position on.
+out vec2 Ndc;
+void main(){
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    Ndc = corner * 2.0 - 1.0;
+    gl_Position = vec4(Ndc, 0.0, 1.0);
+}
@@ -0,0 +1,16 @@
+#version 330 core
+// Farthest depth in each reduction x reduction block of the depth buffer, so
+// anything behind a texel of the result is behind every pixel it covers.
+out float Depth;
+uniform sampler2D source;
+uniform int reduction;
+void main(){
+    ivec2 size = textureSize(source, 0);
+    ivec2 first = ivec2(gl_FragCoord.xy) * reduction;
+    ivec2 last = min(first + reduction, size) - 1;
+    float depth = 0.0;
+    for (int y = first.y; y <= last.y; ++y)
+        for (int x = first.x; x <= last.x; ++x)
+            depth = max(depth, texelFetch(source, ivec2(x, y), 0).r);
+    Depth = depth;
+}
@@ -1,13 +1,18 @@
 #version 330 core
 out vec4 FragColor;
-in vec2 TexCoords;
 in float alpha;
+in vec2 spin;
 
 uniform sampler2D texture1;
 uniform vec3 lightColor;
 
 void main()
 {
+    // sprite coordinates turned back into the particle's square
+    vec2 corner = (gl_PointCoord - 0.5) * 1.41421356;
+    vec2 TexCoords = mat2(spin.x, -spin.y, spin.y, spin.x) * corner + 0.5;
+    if(any(lessThan(TexCoords, vec2(0.0))) || any(greaterThan(TexCoords, vec2(1.0))))
+        discard;
     vec4 texColor = texture(texture1, TexCoords);
 
     // Discard fragments with low alpha for better performance
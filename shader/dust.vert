@@ -1,30 +1,33 @@
 #version 330 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec2 aTex;
-out vec2 TexCoords;
+// One point sprite per particle, straight from the simulation's state buffer.
+layout(location = 0) in vec3 aPosition;         // world space
+layout(location = 2) in vec3 aSizeRotation;     // diameter, rotation in degrees, spin
 out float alpha;
+out vec2 spin;                                  // cos and sin of the rotation
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
-uniform vec3 cameraRight;
-uniform vec3 cameraUp;
-uniform float size;
+uniform vec3 origin;            // camera world position
+uniform float pixelScale;       // pixels per unit at unit depth
+uniform float twinklePhase;
+uniform int perLevel;           // particles per nested cube
+uniform float innerExtent;      // side of the innermost cube; each level doubles it
 
 void main()
 {
-    vec3 pos = aPos;
-    vec3 worldPos = (model * vec4(pos, 1.0)).xyz;
+    float life = 0.8 + 0.2 * sin(twinklePhase + aPosition.x);
+    vec3 relative = aPosition - origin;
+    vec4 viewPos = view * vec4(relative, 1.0);
+    gl_Position = projection * viewPos;
 
-    // Billboard effect
-    vec3 posWorld = worldPos +
-        cameraRight * aPos.x * size +
-        cameraUp * aPos.y * size;
+    // the sprite holds the turned square, so it is sqrt(2) wider; below a
+    // pixel the square's share of the pixel dims it instead
+    float pixels = aSizeRotation.x * life / max(-viewPos.z, 1e-3) * pixelScale;
+    gl_PointSize = max(pixels * 1.41421356, 1.0);
+    float angle = radians(aSizeRotation.y);
+    spin = vec2(cos(angle), sin(angle));
 
-    gl_Position = projection * view * vec4(posWorld, 1.0);
-    TexCoords = aTex;
-
-    // Distance-based alpha (fade with distance)
-    float dist = distance(worldPos, vec3(0.0));
-    alpha = 1.0 - smoothstep(50.0, 300.0, dist);
+    // each level fades out inside its cube, so the wrap at the faces never shows
+    float reach = 0.5 * innerExtent * exp2(float(gl_VertexID / perLevel));
+    alpha = (1.0 - smoothstep(0.5 * reach, reach, length(relative))) * min(pixels * pixels, 1.0);
 }
@@ -0,0 +1,27 @@
+#version 330 core
+// Advances one dust particle per vertex. The outputs are captured by
+// transform feedback, in the layout of the inputs, into the other buffer.
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aVelocity;
+layout(location = 2) in vec3 aSizeRotation;     // size, rotation in degrees, spin in degrees per second
+out vec3 Position;
+out vec3 Velocity;
+out vec3 SizeRotation;
+
+uniform float deltaTime;
+uniform vec3 centre;            // camera world position
+uniform int perLevel;           // particles per nested cube
+uniform float innerExtent;      // side of the innermost cube; each level doubles it
+
+void main()
+{
+    // back into this particle's cube around the camera, as DustField::advance
+    float extent = innerExtent * exp2(float(gl_VertexID / perLevel));
+    vec3 offset = aPosition + aVelocity * deltaTime - centre;
+    Position = centre + (offset - extent * floor(offset * (1.0 / extent) + 0.5));
+    Velocity = aVelocity;
+    // whole turns dropped the same way as DustField::advance
+    float rotation = aSizeRotation.y + aSizeRotation.z * deltaTime;
+    rotation -= 360.0 * trunc(rotation * (1.0 / 360.0));
+    SizeRotation = vec3(aSizeRotation.x, rotation, aSizeRotation.z);
+}
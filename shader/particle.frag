@@ -0,0 +1,11 @@
+#version 330 core
+in vec2 corner;
+in vec4 color;
+out vec4 FragColor;
+
+void main()
+{
+    // soft round blob; blended as premultiplied colour
+    float shape = 1.0 - smoothstep(0.3, 1.0, length(corner));
+    FragColor = color * shape;
+}
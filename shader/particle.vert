@@ -0,0 +1,23 @@
+#version 330 core
+// One camera-facing quad per instance; the corners come from gl_VertexID
+// as a four-vertex triangle strip.
+layout(location = 0) in vec4 aPositionSize;     // camera-relative position, world diameter
+layout(location = 1) in vec4 aColor;            // premultiplied
+out vec2 corner;
+out vec4 color;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float pixelScale;       // pixels per unit at unit depth
+
+void main()
+{
+    corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    vec4 viewPos = view * vec4(aPositionSize.xyz, 1.0);
+    // kept at least two pixels across; a smaller particle dims instead
+    float pixels = aPositionSize.w / max(-viewPos.z, 1e-3) * pixelScale;
+    float size = aPositionSize.w * max(2.0 / max(pixels, 1e-6), 1.0);
+    color = aColor * min(pixels * pixels * 0.25, 1.0);
+    viewPos.xy += corner * (0.5 * size);
+    gl_Position = projection * viewPos;
+}
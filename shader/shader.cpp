@@ -69,6 +69,33 @@ Shader::Shader(const std::string &vertexPath, const std::string &fragmentPath) {
     glDeleteShader(fs);
 }
 
+Shader::Shader(const std::string &vertexPath, const std::vector<std::string> &feedbackVaryings) {
+    std::ifstream vfile(vertexPath);
+    if(!vfile.is_open()) {
+        std::cerr << "Failed to open shader file: " << vertexPath << std::endl;
+        ID = 0;
+        return;
+    }
+    std::stringstream vss;
+    vss << vfile.rdbuf();
+    std::string vstr = vss.str();
+    GLuint vs = compileShaderInternal(GL_VERTEX_SHADER, vstr.c_str());
+    ID = glCreateProgram();
+    glAttachShader(ID, vs);
+    std::vector<const char*> names;
+    for(const std::string &name : feedbackVaryings) names.push_back(name.c_str());
+    glTransformFeedbackVaryings(ID, (GLsizei)names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+    glLinkProgram(ID);
+    int success = 0; glGetProgramiv(ID, GL_LINK_STATUS, &success);
+    if(!success) {
+        char info[1024]; glGetProgramInfoLog(ID, 1024, nullptr, info);
+        std::cerr << "Link error: " << info << std::endl;
+        glDeleteProgram(ID);
+        ID = 0;
+    }
+    glDeleteShader(vs);
+}
+
 Shader::~Shader() {
     if(ID) glDeleteProgram(ID);
 }
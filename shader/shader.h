@@ -3,6 +3,7 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <string>
+#include <vector>
 
 class Shader {
 public:
@@ -11,6 +12,9 @@ public:
     Shader(const char* vertexSrc, const char* fragmentSrc);
     // Create shader from vertex/fragment file paths
     Shader(const std::string &vertexPath, const std::string &fragmentPath);
+    // Vertex-only program for transform feedback: the named outputs are
+    // captured interleaved, in the order given
+    Shader(const std::string &vertexPath, const std::vector<std::string> &feedbackVaryings);
     ~Shader();
     void use() const { glUseProgram(ID); }
     void setMat4(const std::string &name, const glm::mat4 &mat) const;
@@ -0,0 +1,234 @@
+// Accuracy of the batched math kernels against libm.
+//
+//   make check
+//
+// Every instruction-set variant the CPU can run is swept over random
+// arguments, then the dispatched entry points are checked for the libm
+// fallback on arguments too large for the vector reduction. Exits non-zero
+// when any bound is exceeded. The variants are built without FMA contraction,
+// so every one must also produce bit-for-bit the same outputs.
+#include "../utils/simd/simd.h"
+#include "../utils/simd/kernels.h"
+#include "../utils/random/random.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const size_t SAMPLES = 1 << 20;
+static const uint64_t SEED = 20240609;
+
+// bounds, in the units each check reports
+static const double SINCOS_DOUBLE_ULP = 2.0;
+static const double SINCOS_FLOAT_ABSOLUTE = 1.2e-7;
+static const double ATAN2_DOUBLE_ULP = 3.0;
+static const double ATAN2_FLOAT_ULP = 3.0;
+// Kepler: residual E - e sin E - M in ulps of max(|E|, |M|), the backward error
+static const double KEPLER_DOUBLE_ULP = 2.0;
+static const double KEPLER_FLOAT_ULP = 2.0;
+
+struct Variant {
+    const char *name;
+    void (*sinCosFloat)(const float *, float *, float *, size_t);
+    void (*sinCosDouble)(const double *, double *, double *, size_t);
+    void (*atan2Float)(const float *, const float *, float *, size_t);
+    void (*atan2Double)(const double *, const double *, double *, size_t);
+    void (*keplerFloat)(const float *, const float *, float *, size_t);
+    void (*keplerDouble)(const double *, const double *, double *, size_t);
+};
+
+#define SIMD_VARIANT(NAME, ISA) { NAME, simd::ISA::sinCosFloat, simd::ISA::sinCosDouble, simd::ISA::atan2Float, \
+                                  simd::ISA::atan2Double, simd::ISA::keplerFloat, simd::ISA::keplerDouble }
+
+// Distance in representable values; both must be finite.
+static double ulps(double a, double b) {
+    int64_t ia, ib;
+    std::memcpy(&ia, &a, sizeof(a));
+    std::memcpy(&ib, &b, sizeof(b));
+    // sign-magnitude to two's complement, so the order is monotonic
+    if (ia < 0) ia = INT64_MIN - ia;
+    if (ib < 0) ib = INT64_MIN - ib;
+    // difference before the conversion: a double holds only 53 of the 64 bits
+    return (double)(ia > ib ? (uint64_t)ia - (uint64_t)ib : (uint64_t)ib - (uint64_t)ia);
+}
+
+static double ulps(float a, float b) {
+    int32_t ia, ib;
+    std::memcpy(&ia, &a, sizeof(a));
+    std::memcpy(&ib, &b, sizeof(b));
+    if (ia < 0) ia = INT32_MIN - ia;
+    if (ib < 0) ib = INT32_MIN - ib;
+    return std::fabs((double)ia - (double)ib);
+}
+
+static int failures = 0;
+
+static void report(const char *variant, const char *what, double worst, double bound, const char *unit) {
+    bool pass = worst <= bound;
+    if (!pass) ++failures;
+    std::printf("%-8s %-24s %10.3g %-5s (bound %g)  %s\n", variant, what, worst, unit, bound, pass ? "ok" : "FAIL");
+}
+
+struct Inputs {
+    std::vector<double> angle, y, x, meanAnomaly, eccentricity;
+    std::vector<float> angleF, yF, xF, meanAnomalyF, eccentricityF;
+};
+
+static Inputs makeInputs() {
+    Inputs in;
+    for (std::vector<double> *column : {&in.angle, &in.y, &in.x, &in.meanAnomaly, &in.eccentricity}) column->resize(SAMPLES);
+    for (std::vector<float> *column : {&in.angleF, &in.yF, &in.xF, &in.meanAnomalyF, &in.eccentricityF}) column->resize(SAMPLES);
+    const double TWO_PI = 6.283185307179586;
+    for (size_t i = 0; i < SAMPLES; ++i) {
+        CounterRng rng(SEED, i);
+        // a quarter of the angles near zero, where relative error shows most
+        double u = rng.uniformDouble();
+        in.angle[i] = i % 4 == 0 ? (u - 0.5) * 2.0 : (u - 0.5) * 2.0 * simd::SINCOS_MAX_DOUBLE;
+        in.angleF[i] = i % 4 == 0 ? (float)((u - 0.5) * 2.0) : (float)((u - 0.5) * 2.0 * simd::SINCOS_MAX_FLOAT);
+        // y and x over several decades, every quadrant
+        double scale = std::pow(10.0, rng.uniformDouble() * 8.0 - 4.0);
+        in.y[i] = (rng.uniformDouble() - 0.5) * scale;
+        in.x[i] = (rng.uniformDouble() - 0.5) * (i % 2 ? scale : 1.0);
+        in.yF[i] = (float)in.y[i];
+        in.xF[i] = (float)in.x[i];
+        in.meanAnomaly[i] = (rng.uniformDouble() - 0.5) * 2.0 * TWO_PI;
+        in.eccentricity[i] = rng.uniformDouble() * 0.99;
+        in.meanAnomalyF[i] = (float)in.meanAnomaly[i];
+        in.eccentricityF[i] = (float)in.eccentricity[i];
+    }
+    return in;
+}
+
+struct Outputs {
+    std::vector<double> s, c, atan2, kepler;
+    std::vector<float> sF, cF, atan2F, keplerF;
+};
+
+static Outputs checkVariant(const Variant &v, const Inputs &in) {
+    const size_t n = SAMPLES;
+    std::vector<double> s(n), c(n), out(n);
+    std::vector<float> sF(n), cF(n), outF(n);
+    Outputs result;
+
+    v.sinCosDouble(in.angle.data(), s.data(), c.data(), n);
+    double worst = 0.0;
+    for (size_t i = 0; i < n; ++i)
+        worst = std::max({worst, ulps(s[i], std::sin(in.angle[i])), ulps(c[i], std::cos(in.angle[i]))});
+    report(v.name, "sincos double", worst, SINCOS_DOUBLE_ULP, "ulp");
+
+    v.sinCosFloat(in.angleF.data(), sF.data(), cF.data(), n);
+    worst = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        double a = in.angleF[i];
+        worst = std::max({worst, std::fabs(sF[i] - std::sin(a)), std::fabs(cF[i] - std::cos(a))});
+    }
+    report(v.name, "sincos float", worst, SINCOS_FLOAT_ABSOLUTE, "abs");
+
+    v.atan2Double(in.y.data(), in.x.data(), out.data(), n);
+    worst = 0.0;
+    for (size_t i = 0; i < n; ++i) worst = std::max(worst, ulps(out[i], std::atan2(in.y[i], in.x[i])));
+    report(v.name, "atan2 double", worst, ATAN2_DOUBLE_ULP, "ulp");
+    result.atan2 = out;
+
+    v.atan2Float(in.yF.data(), in.xF.data(), outF.data(), n);
+    worst = 0.0;
+    for (size_t i = 0; i < n; ++i) worst = std::max(worst, ulps(outF[i], (float)std::atan2((double)in.yF[i], (double)in.xF[i])));
+    report(v.name, "atan2 float", worst, ATAN2_FLOAT_ULP, "ulp");
+    result.atan2F = outF;
+
+    // residual of Kepler's equation, evaluated in long double
+    v.keplerDouble(in.meanAnomaly.data(), in.eccentricity.data(), out.data(), n);
+    worst = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        long double E = out[i], e = in.eccentricity[i], M = in.meanAnomaly[i];
+        double scale = std::max(std::fabs(out[i]), std::fabs(in.meanAnomaly[i]));
+        double ulp = std::nextafter(scale, INFINITY) - scale;
+        worst = std::max(worst, (double)(std::fabs(E - e * std::sin(E) - M) / ulp));
+    }
+    report(v.name, "kepler double", worst, KEPLER_DOUBLE_ULP, "ulp");
+    result.kepler = out;
+
+    v.keplerFloat(in.meanAnomalyF.data(), in.eccentricityF.data(), outF.data(), n);
+    worst = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        double E = outF[i], e = in.eccentricityF[i], M = in.meanAnomalyF[i];
+        float scale = std::max(std::fabs(outF[i]), std::fabs(in.meanAnomalyF[i]));
+        double ulp = std::nextafter(scale, INFINITY) - scale;
+        worst = std::max(worst, std::fabs(E - e * std::sin(E) - M) / ulp);
+    }
+    report(v.name, "kepler float", worst, KEPLER_FLOAT_ULP, "ulp");
+    result.keplerF = outF;
+    result.s = std::move(s);
+    result.c = std::move(c);
+    result.sF = std::move(sF);
+    result.cF = std::move(cF);
+    return result;
+}
+
+template <typename T> static size_t mismatches(const std::vector<T> &a, const std::vector<T> &b) {
+    size_t count = 0;
+    for (size_t i = 0; i < a.size(); ++i) count += std::memcmp(&a[i], &b[i], sizeof(T)) != 0;
+    return count;
+}
+
+// Every output of v against the reference variant, counting lanes that differ in any bit.
+static void checkIdentical(const char *variant, const Outputs &v, const Outputs &reference) {
+    report(variant, "same as first (double)", (double)(mismatches(v.s, reference.s) + mismatches(v.c, reference.c) +
+           mismatches(v.atan2, reference.atan2) + mismatches(v.kepler, reference.kepler)), 0.0, "lanes");
+    report(variant, "same as first (float)", (double)(mismatches(v.sF, reference.sF) + mismatches(v.cF, reference.cF) +
+           mismatches(v.atan2F, reference.atan2F) + mismatches(v.keplerF, reference.keplerF)), 0.0, "lanes");
+}
+
+// Beyond the vector reduction the dispatched sincos must hand the lane to
+// libm, so the results are libm's exactly.
+static void checkFallback() {
+    const size_t n = 4096;
+    std::vector<double> x(n), s(n), c(n);
+    std::vector<float> xF(n), sF(n), cF(n);
+    for (size_t i = 0; i < n; ++i) {
+        CounterRng rng(SEED, i, 1);
+        // alternate lanes inside and far outside the limit, so both paths share vectors
+        double magnitude = i % 2 ? std::pow(10.0, 5.0 + rng.uniformDouble() * 15.0) : rng.uniformDouble() * 10.0;
+        x[i] = rng.uniform() < 0.5f ? -magnitude : magnitude;
+        xF[i] = i % 2 ? (float)(x[i] < 0 ? -1.0 : 1.0) * (simd::SINCOS_MAX_FLOAT * 2.0f + (float)(rng.uniformDouble() * 1e7)) : (float)x[i];
+    }
+    simd::sincos(x.data(), s.data(), c.data(), n);
+    simd::sincos(xF.data(), sF.data(), cF.data(), n);
+    double worst = 0.0, worstF = 0.0;
+    for (size_t i = 1; i < n; i += 2) {
+        worst = std::max({worst, ulps(s[i], std::sin(x[i])), ulps(c[i], std::cos(x[i]))});
+        worstF = std::max({worstF, ulps(sF[i], std::sin(xF[i])), ulps(cF[i], std::cos(xF[i]))});
+    }
+    report(simd::isa(), "large-argument double", worst, 0.0, "ulp");
+    report(simd::isa(), "large-argument float", worstF, 0.0, "ulp");
+}
+
+int main() {
+    const Inputs in = makeInputs();
+    std::vector<Variant> variants;
+    size_t isaVariants = 0;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) variants.push_back(SIMD_VARIANT("sse4.2", sse42));
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) variants.push_back(SIMD_VARIANT("avx2", avx2));
+    if (__builtin_cpu_supports("avx512f")) variants.push_back(SIMD_VARIANT("avx512", avx512));
+    isaVariants = variants.size();
+#endif
+    // the public entry points, whichever variant (or libm) they picked
+    variants.push_back({"dispatch", static_cast<void (*)(const float *, float *, float *, size_t)>(simd::sincos),
+                        static_cast<void (*)(const double *, double *, double *, size_t)>(simd::sincos),
+                        static_cast<void (*)(const float *, const float *, float *, size_t)>(simd::atan2),
+                        static_cast<void (*)(const double *, const double *, double *, size_t)>(simd::atan2),
+                        static_cast<void (*)(const float *, const float *, float *, size_t)>(simd::solveKepler),
+                        static_cast<void (*)(const double *, const double *, double *, size_t)>(simd::solveKepler)});
+    std::printf("%zu samples per check; dispatcher uses %s\n", SAMPLES, simd::isa());
+    std::vector<Outputs> outputs;
+    for (const Variant &v : variants) outputs.push_back(checkVariant(v, in));
+    // the dispatcher may be libm, which is not expected to match
+    for (size_t i = 1; i < isaVariants; ++i) checkIdentical(variants[i].name, outputs[i], outputs[0]);
+    checkFallback();
+    std::printf(failures ? "%d check(s) failed\n" : "all checks passed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,228 @@
+// Converts JPL DE ASCII ephemeris files (header.4xx plus one or more
+// ascp*.4xx data files) into the binary Chebyshev table read by Ephemeris.
+//
+//   make ephemeris_ingest
+//   tools/ephemeris_ingest -o utils/ephemeris/de.bin header.440 ascp01950.440 ascp02050.440
+//
+// Only positions are kept (bodies 1-11: planets, Pluto, Moon, Sun), converted
+// from km to AU. Data files may be given in any order; blocks repeated at file
+// boundaries are dropped, and a gap in coverage is an error.
+#include "../utils/ephemeris/ephemerisformat.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+static const int POSITION_BODIES = 11;
+
+struct Header {
+    double startDate = 0.0, endDate = 0.0, blockDays = 0.0;
+    std::map<std::string, double> constants;
+    // per body: first coefficient (1-based within a block), coefficients per component, subintervals
+    int first[POSITION_BODIES] = {}, count[POSITION_BODIES] = {}, subintervals[POSITION_BODIES] = {};
+};
+
+struct Block {
+    double start, end;
+    std::vector<double> coefficients;
+};
+
+// JPL files write exponents with D (0.1234D+05)
+static double parseNumber(std::string token) {
+    std::replace(token.begin(), token.end(), 'D', 'E');
+    std::replace(token.begin(), token.end(), 'd', 'e');
+    return strtod(token.c_str(), nullptr);
+}
+
+static bool readHeader(const std::string &path, Header &header) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open header " << path << std::endl;
+        return false;
+    }
+    // collect the tokens of each GROUP section
+    std::map<int, std::vector<std::string>> groups;
+    std::string token;
+    int group = 0;
+    while (in >> token) {
+        if (token == "GROUP") {
+            in >> group;
+            continue;
+        }
+        if (group) groups[group].push_back(token);
+    }
+
+    const std::vector<std::string> &range = groups[1030];
+    if (range.size() < 3) {
+        std::cerr << "Header has no GROUP 1030" << std::endl;
+        return false;
+    }
+    header.startDate = parseNumber(range[0]);
+    header.endDate = parseNumber(range[1]);
+    header.blockDays = parseNumber(range[2]);
+
+    const std::vector<std::string> &names = groups[1040], &values = groups[1041];
+    if (!names.empty() && !values.empty()) {
+        size_t n = std::min<size_t>(atoi(names[0].c_str()), std::min(names.size(), values.size()) - 1);
+        for (size_t i = 0; i < n; ++i) header.constants[names[i + 1]] = parseNumber(values[i + 1]);
+    }
+
+    // three rows of equal length; newer files append extra columns (TT-TDB)
+    const std::vector<std::string> &pointers = groups[1050];
+    size_t columns = pointers.size() / 3;
+    if (pointers.size() % 3 != 0 || columns < (size_t)POSITION_BODIES) {
+        std::cerr << "Header has a malformed GROUP 1050" << std::endl;
+        return false;
+    }
+    for (int b = 0; b < POSITION_BODIES; ++b) {
+        header.first[b] = atoi(pointers[b].c_str());
+        header.count[b] = atoi(pointers[columns + b].c_str());
+        header.subintervals[b] = atoi(pointers[2 * columns + b].c_str());
+        if (header.first[b] < 3 || header.count[b] < 1 || header.subintervals[b] < 1) {
+            std::cerr << "Header has an invalid entry for body " << b + 1 << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Each block is "<number> <ncoeff>" followed by ncoeff values; the first two
+// are the Julian dates the block covers.
+static bool readData(const std::string &path, std::vector<Block> &blocks) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open data file " << path << std::endl;
+        return false;
+    }
+    int number, count;
+    while (in >> number >> count) {
+        Block block;
+        block.coefficients.resize(count);
+        std::string token;
+        for (int i = 0; i < count; ++i) {
+            if (!(in >> token)) {
+                std::cerr << path << ": block " << number << " is truncated" << std::endl;
+                return false;
+            }
+            block.coefficients[i] = parseNumber(token);
+        }
+        // the last line is padded with zeros to three values
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+        if (count < 2) continue;
+        block.start = block.coefficients[0];
+        block.end = block.coefficients[1];
+        blocks.push_back(std::move(block));
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::string output, headerPath;
+    std::vector<std::string> dataPaths;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) output = argv[++i];
+        else if (headerPath.empty()) headerPath = argv[i];
+        else dataPaths.push_back(argv[i]);
+    }
+    if (output.empty() || headerPath.empty() || dataPaths.empty()) {
+        std::cerr << "usage: " << argv[0] << " -o <table.bin> <header.4xx> <ascp*.4xx>..." << std::endl;
+        return 1;
+    }
+
+    Header header;
+    if (!readHeader(headerPath, header)) return 1;
+    double au = header.constants.count("AU") ? header.constants["AU"] : 149597870.7;
+    double earthMoonRatio = header.constants.count("EMRAT") ? header.constants["EMRAT"] : 81.30056907419062;
+    uint32_t sourceNumber = header.constants.count("DENUM") ? (uint32_t)header.constants["DENUM"] : 0;
+
+    std::vector<Block> blocks;
+    for (const std::string &path : dataPaths) {
+        if (!readData(path, blocks)) return 1;
+    }
+    std::sort(blocks.begin(), blocks.end(), [](const Block &a, const Block &b) { return a.start < b.start; });
+
+    int needed = 0;
+    for (int b = 0; b < POSITION_BODIES; ++b) needed = std::max(needed, header.first[b] - 1 + 3 * header.count[b] * header.subintervals[b]);
+
+    // keep a contiguous run of blocks
+    std::vector<const Block *> run;
+    for (const Block &block : blocks) {
+        if (std::abs(block.end - block.start - header.blockDays) > 1e-6) {
+            std::cerr << "Block at JD " << block.start << " does not span " << header.blockDays << " days" << std::endl;
+            return 1;
+        }
+        if ((int)block.coefficients.size() < needed) {
+            std::cerr << "Block at JD " << block.start << " has too few coefficients" << std::endl;
+            return 1;
+        }
+        if (!run.empty()) {
+            double end = run.back()->end;
+            if (block.start < end - 1e-6) continue;
+            if (block.start > end + 1e-6) {
+                std::cerr << "Gap in coverage between JD " << end << " and " << block.start << std::endl;
+                return 1;
+            }
+        }
+        run.push_back(&block);
+    }
+    if (run.empty()) {
+        std::cerr << "No data blocks found" << std::endl;
+        return 1;
+    }
+
+    EphemerisFileHeader fileHeader = {};
+    memcpy(fileHeader.magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC));
+    fileHeader.version = EPHEMERIS_VERSION;
+    fileHeader.seriesCount = POSITION_BODIES;
+    fileHeader.startDate = run.front()->start;
+    fileHeader.endDate = run.back()->end;
+    fileHeader.earthMoonRatio = earthMoonRatio;
+    fileHeader.sourceNumber = sourceNumber;
+
+    std::vector<EphemerisSeries> table(POSITION_BODIES);
+    uint64_t offset = sizeof(EphemerisFileHeader) + POSITION_BODIES * sizeof(EphemerisSeries);
+    for (int b = 0; b < POSITION_BODIES; ++b) {
+        table[b].body = b;
+        table[b].coefficientCount = header.count[b];
+        table[b].segmentDays = header.blockDays / header.subintervals[b];
+        table[b].segmentCount = (uint64_t)run.size() * header.subintervals[b];
+        table[b].offset = offset;
+        offset += table[b].segmentCount * 3 * header.count[b] * sizeof(double);
+    }
+
+    FILE *out = fopen(output.c_str(), "wb");
+    if (!out) {
+        std::cerr << "Cannot write " << output << std::endl;
+        return 1;
+    }
+    bool ok = fwrite(&fileHeader, sizeof(fileHeader), 1, out) == 1 &&
+              fwrite(table.data(), sizeof(EphemerisSeries), table.size(), out) == table.size();
+    std::vector<double> segment;
+    for (int b = 0; b < POSITION_BODIES && ok; ++b) {
+        const size_t n = header.count[b];
+        segment.resize(3 * n);
+        for (const Block *block : run) {
+            // the block stores subintervals in time order, each as x, y, z runs
+            const double *c = block->coefficients.data() + header.first[b] - 1;
+            for (int s = 0; s < header.subintervals[b] && ok; ++s) {
+                for (size_t k = 0; k < 3 * n; ++k) segment[k] = c[s * 3 * n + k] / au;
+                ok = fwrite(segment.data(), sizeof(double), segment.size(), out) == segment.size();
+            }
+        }
+    }
+    if (fclose(out) != 0 || !ok) {
+        std::cerr << "Failed writing " << output << std::endl;
+        return 1;
+    }
+    std::cout << std::fixed << std::setprecision(1) << "Wrote " << output << ": JD " << fileHeader.startDate << " - " << fileHeader.endDate
+              << ", " << run.size() << " blocks" << std::endl;
+    return 0;
+}
@@ -1,29 +1,322 @@
 #include "asteroids.h"
 #include "../texture/texture.h"
-#include <cstdlib>
-#include <ctime>
+#include "../simd/simd.h"
+#include "../random/random.h"
+#include "../threadpool/threadpool.h"
+#include "../morton/morton.h"
 #include <iostream>
-#include <glm/gtc/matrix_transform.hpp>
+#include <cmath>
+#include <algorithm>
+#include <cstddef>
+#include <glm/gtc/type_ptr.hpp>
 
-AsteroidSystem::AsteroidSystem() : asteroidTexture(0) {}
+static const uint32_t ASTEROID_STREAM = 1;
+static const uint32_t SHAPE_STREAM = 4;
+
+static const size_t TRANSFORM_CHUNK = 4096;
+static const size_t CLASSIFY_BLOCK = 4096;
+static const size_t TRIG_BATCH = 256;
+static const uint8_t TIER_CULLED = 0xff;
+// Classification slots: one per base shape in the mesh tier, then the
+// impostor and point tiers. Slots of a tier are consecutive, so each shape
+// is a contiguous range of the mesh tier's buffer.
+static const int SLOT_COUNT = AsteroidSystem::SHAPE_COUNT + AsteroidSystem::TIER_COUNT - 1;
+static int slotTier(int slot) { return slot < AsteroidSystem::SHAPE_COUNT ? AsteroidSystem::TIER_MESH : slot - AsteroidSystem::SHAPE_COUNT + 1; }
+// base meshes stay within this share of the radius, leaving the rest to the shader's noise
+static const float SHAPE_EXTENT = 0.87f;
+// projected radius, in pixels, below which a rock drops to the next tier
+static const float MESH_MIN_PIXELS = 3.0f;
+static const float IMPOSTOR_MIN_PIXELS = 0.75f;
+// far-field density texels: radius, azimuth, height
+static const int VOLUME_RADIAL = 32, VOLUME_AZIMUTH = 128, VOLUME_HEIGHT = 16;
+static_assert(CLASSIFY_BLOCK % AsteroidSystem::CULL_CHUNK == 0 && AsteroidSystem::CULL_CHUNK == TRIG_BATCH,
+              "chunks must line up with the classification batches");
+
+void AsteroidBelt::resize(size_t n) {
+    for (std::vector<float> *column : {&radius, &distance, &eccentricity, &inclination, &ascendingNode, &argPeriapsis,
+                                       &orbitalPhase, &period, &rotationSpeed, &axisX, &axisY, &axisZ,
+                                       &majorX, &majorY, &majorZ, &minorX, &minorY, &minorZ}) {
+        column->resize(n);
+    }
+    size_t old = id.size();
+    id.resize(n);
+    for (size_t i = old; i < n; ++i) id[i] = (uint32_t)i;
+}
+
+AsteroidBelt AsteroidBelt::permuted(const std::vector<uint32_t> &order) const {
+    AsteroidBelt out;
+    out.resize(order.size());
+    std::vector<float> AsteroidBelt::*const columns[] = {
+        &AsteroidBelt::radius, &AsteroidBelt::distance, &AsteroidBelt::eccentricity, &AsteroidBelt::inclination,
+        &AsteroidBelt::ascendingNode, &AsteroidBelt::argPeriapsis, &AsteroidBelt::orbitalPhase, &AsteroidBelt::period,
+        &AsteroidBelt::rotationSpeed, &AsteroidBelt::axisX, &AsteroidBelt::axisY, &AsteroidBelt::axisZ,
+        &AsteroidBelt::majorX, &AsteroidBelt::majorY, &AsteroidBelt::majorZ,
+        &AsteroidBelt::minorX, &AsteroidBelt::minorY, &AsteroidBelt::minorZ};
+    for (auto column : columns) {
+        const std::vector<float> &from = this->*column;
+        std::vector<float> &to = out.*column;
+        for (size_t k = 0; k < order.size(); ++k) to[k] = from[order[k]];
+    }
+    for (size_t k = 0; k < order.size(); ++k) out.id[k] = id[order[k]];
+    return out;
+}
+
+// Same frame as OrbitPropagator: ecliptic (x, y, z) maps to world (x, z, y).
+void AsteroidBelt::updateOrbitFrames(size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        double ci = cos((double)inclination[i]), si = sin((double)inclination[i]);
+        double cn = cos((double)ascendingNode[i]), sn = sin((double)ascendingNode[i]);
+        double cw = cos((double)argPeriapsis[i]), sw = sin((double)argPeriapsis[i]);
+        double a = distance[i], b = a * sqrt(1.0 - (double)eccentricity[i] * eccentricity[i]);
+        majorX[i] = (float)(a * (cn * cw - sn * sw * ci));
+        majorZ[i] = (float)(a * (sn * cw + cn * sw * ci));
+        majorY[i] = (float)(a * (sw * si));
+        minorX[i] = (float)(b * (-cn * sw - sn * cw * ci));
+        minorZ[i] = (float)(b * (-sn * sw + cn * cw * ci));
+        minorY[i] = (float)(b * (cw * si));
+    }
+}
+
+static double meanAnomaly(const AsteroidBelt &belt, size_t i, double simulationTime) {
+    double orbits = belt.period[i] != 0.0f ? fmod(simulationTime / belt.period[i], 1.0) : 0.0;
+    return fmod(belt.orbitalPhase[i] + orbits * 2.0 * 3.14159265358979323846, 2.0 * 3.14159265358979323846);
+}
+
+glm::dvec3 asteroidPosition(const AsteroidBelt &belt, size_t i, double simulationTime) {
+    double M = meanAnomaly(belt, i, simulationTime), e = belt.eccentricity[i], E;
+    simd::solveKepler(&M, &e, &E, 1);
+    double c = cos(E) - e, s = sin(E);
+    return glm::dvec3(belt.majorX[i] * c + belt.minorX[i] * s, belt.majorY[i] * c + belt.minorY[i] * s, belt.majorZ[i] * c + belt.minorZ[i] * s);
+}
+
+// dE/dt = n / (1 - e cos E), along the derivative of the position's axis terms.
+glm::dvec3 asteroidVelocity(const AsteroidBelt &belt, size_t i, double simulationTime) {
+    double M = meanAnomaly(belt, i, simulationTime), e = belt.eccentricity[i], E;
+    simd::solveKepler(&M, &e, &E, 1);
+    double c = cos(E), s = sin(E);
+    double n = belt.period[i] != 0.0f ? 2.0 * 3.14159265358979323846 / belt.period[i] : 0.0;
+    double rate = n / (1.0 - e * c);
+    return glm::dvec3(belt.minorX[i] * c - belt.majorX[i] * s, belt.minorY[i] * c - belt.majorY[i] * s, belt.minorZ[i] * c - belt.majorZ[i] * s) * rate;
+}
+
+void asteroidPositions(const AsteroidBelt &belt, double simulationTime, size_t begin, size_t end, glm::dvec3 *out) {
+    double M[TRIG_BATCH], e[TRIG_BATCH], E[TRIG_BATCH], sinE[TRIG_BATCH], cosE[TRIG_BATCH];
+    for (size_t first = begin; first < end; first += TRIG_BATCH) {
+        const size_t count = std::min(TRIG_BATCH, end - first);
+        for (size_t k = 0; k < count; ++k) {
+            M[k] = meanAnomaly(belt, first + k, simulationTime);
+            e[k] = belt.eccentricity[first + k];
+        }
+        simd::solveKepler(M, e, E, count);
+        simd::sincos(E, sinE, cosE, count);
+        for (size_t k = 0; k < count; ++k) {
+            const size_t i = first + k;
+            double c = cosE[k] - e[k], s = sinE[k];
+            out[i - begin] = glm::dvec3(belt.majorX[i] * c + belt.minorX[i] * s, belt.majorY[i] * c + belt.minorY[i] * s,
+                                        belt.majorZ[i] * c + belt.minorZ[i] * s);
+        }
+    }
+}
+
+// Camera-relative centres of up to TRIG_BATCH rocks starting at first.
+static void asteroidCentres(const AsteroidBelt &belt, double simulationTime, const glm::dvec3 &origin,
+                            const std::vector<glm::dvec3> *positions, size_t first, size_t count, glm::vec3 *out) {
+    if (positions) {
+        for (size_t k = 0; k < count; ++k) out[k] = glm::vec3((*positions)[belt.id[first + k]] - origin);
+        return;
+    }
+    float M[TRIG_BATCH] = {}, E[TRIG_BATCH], sinE[TRIG_BATCH], cosE[TRIG_BATCH];
+    for (size_t k = 0; k < count; ++k) M[k] = (float)meanAnomaly(belt, first + k, simulationTime);
+    simd::solveKepler(M, &belt.eccentricity[first], E, count);
+    simd::sincos(E, sinE, cosE, count);
+    for (size_t k = 0; k < count; ++k) {
+        const size_t i = first + k;
+        float c = cosE[k] - belt.eccentricity[i], s = sinE[k];
+        glm::dvec3 position(belt.majorX[i] * c + belt.minorX[i] * s, belt.majorY[i] * c + belt.minorY[i] * s,
+                            belt.majorZ[i] * c + belt.minorZ[i] * s);
+        out[k] = glm::vec3(position - origin);
+    }
+}
+
+static float spinAngle(const AsteroidBelt &belt, size_t i, double simulationTime) {
+    return (float)(fmod(simulationTime * belt.rotationSpeed[i], 360.0) * (3.14159265358979323846 / 180.0));
+}
+
+void buildAsteroidTransforms(const AsteroidBelt &belt, double simulationTime, const glm::dvec3 &origin,
+                             const std::vector<glm::dvec3> *positions, size_t begin, size_t end, glm::mat4 *out) {
+    float angles[TRIG_BATCH], spinSin[TRIG_BATCH], spinCos[TRIG_BATCH];
+    glm::vec3 centres[TRIG_BATCH];
+    for (size_t first = begin; first < end; first += TRIG_BATCH) {
+        const size_t count = std::min(TRIG_BATCH, end - first);
+        for (size_t k = 0; k < count; ++k) angles[k] = spinAngle(belt, first + k, simulationTime);
+        simd::sincos(angles, spinSin, spinCos, count);
+        asteroidCentres(belt, simulationTime, origin, positions, first, count, centres);
+        for (size_t k = 0; k < count; ++k) {
+            const size_t i = first + k;
+            // axis-angle rotation scaled by the radius
+            float x = belt.axisX[i], y = belt.axisY[i], z = belt.axisZ[i];
+            float s = spinSin[k], c = spinCos[k], t = 1.0f - c, r = belt.radius[i];
+            glm::mat4 &m = out[i - begin];
+            m[0] = glm::vec4(r * (t * x * x + c), r * (t * x * y + s * z), r * (t * x * z - s * y), 0.0f);
+            m[1] = glm::vec4(r * (t * x * y - s * z), r * (t * y * y + c), r * (t * y * z + s * x), 0.0f);
+            m[2] = glm::vec4(r * (t * x * z + s * y), r * (t * y * z - s * x), r * (t * z * z + c), 0.0f);
+            m[3] = glm::vec4(centres[k], 1.0f);
+        }
+    }
+}
+
+AsteroidSystem::AsteroidSystem(int count)
+    : layoutTime(0.0), layoutReach(0.0f), layoutSpeed(0.0f), layoutDone(false), volume{{}, glm::vec4(0.0f), 0.0f, 0.0f},
+      volumeTexture(0), volumeVao(0), volumeInverseViewProjection(-1), volumeViewProjection(-1), volumeDensity(-1),
+      volumeTexture1(-1), volumeCentre(-1), volumeShell(-1), volumeAzimuthOffset(-1), volumeNearDistance(-1),
+      volumeLightPos(-1), farDistance(INFINITY), rocks{}, impostorQuad{0, 0, 0, 0}, pointVao(0),
+      tierBuffers{0, 0, 0}, asteroidTexture(0), drawCounts{0, 0, 0}, shapeCounts{}, occludedRocks(0), chunkCulledRocks(0),
+      asteroidCount(count) {}
 AsteroidSystem::~AsteroidSystem() { cleanup(); }
 
-void AsteroidSystem::init() {
-    asteroids.clear(); asteroids.reserve(ASTEROID_COUNT);
-    srand(static_cast<unsigned>(time(nullptr)));
-    for (int i = 0; i < ASTEROID_COUNT; ++i) {
-        Asteroid ast;
-        ast.radius = 0.04f + static_cast<float>(rand()) / RAND_MAX * 0.15f;
-        ast.distance = 30.0f + static_cast<float>(rand()) / RAND_MAX * (33.0f - 30.0f);
-        ast.inclination = -0.05f + static_cast<float>(rand()) / RAND_MAX * 0.1f;
-        ast.orbitalPhase = static_cast<float>(rand()) / RAND_MAX * 2.0f * 3.14159265358979323846f;
-        ast.rotationSpeed = 15.0f + static_cast<float>(rand()) / RAND_MAX * 30.0f;
-        float theta = static_cast<float>(rand()) / RAND_MAX * 2.0f * 3.14159265358979323846f;
-        float phi = static_cast<float>(rand()) / RAND_MAX * 3.14159265358979323846f;
-        ast.rotationAxis = glm::vec3(sin(phi) * cos(theta), sin(phi) * sin(theta), cos(phi));
-        asteroids.push_back(ast);
+// Positions at simulationTime give the Morton order; each chunk of the
+// sorted belt then records its box and the fastest perihelion speed in it,
+// n a sqrt((1 + e) / (1 - e)), which bounds how far its rocks can move.
+void AsteroidSystem::buildLayout(const AsteroidBelt &belt, double simulationTime, Layout &out) {
+    const size_t n = belt.size();
+    std::vector<glm::dvec3> positions(n);
+    asteroidPositions(belt, simulationTime, 0, n, positions.data());
+    std::vector<glm::vec3> points(positions.begin(), positions.end());
+    std::vector<uint32_t> order;
+    mortonOrder(points.data(), n, order);
+    out.belt = belt.permuted(order);
+    out.time = simulationTime;
+    out.chunks.resize((n + CULL_CHUNK - 1) / CULL_CHUNK);
+    for (size_t c = 0; c < out.chunks.size(); ++c) {
+        BeltChunk &chunk = out.chunks[c];
+        chunk.low = glm::vec3(INFINITY);
+        chunk.high = glm::vec3(-INFINITY);
+        chunk.speed = 0.0f;
+        for (size_t k = c * CULL_CHUNK; k < std::min(n, (c + 1) * CULL_CHUNK); ++k) {
+            const glm::vec3 p = points[order[k]], r(out.belt.radius[k]);
+            chunk.low = glm::min(chunk.low, p - r);
+            chunk.high = glm::max(chunk.high, p + r);
+            const double e = out.belt.eccentricity[k], period = out.belt.period[k];
+            if (period != 0.0) {
+                double speed = 2.0 * 3.14159265358979323846 * out.belt.distance[k] / std::fabs(period) * std::sqrt((1.0 + e) / (1.0 - e));
+                chunk.speed = std::max(chunk.speed, (float)speed);
+            }
+        }
     }
 
+    // Far field: each rock adds its cross-section to the cell it is in. The
+    // annulus is padded by a cell radially and vertically, so the edges fade
+    // under filtering; azimuth wraps.
+    BeltVolume &volume = out.volume;
+    float rLow = INFINITY, rHigh = 0.0f, yLow = INFINITY, yHigh = -INFINITY;
+    double motion = 0.0, radiusSum = 0.0;
+    for (size_t i = 0; i < n; ++i) {
+        const glm::vec3 &p = points[i];
+        const float r = std::sqrt(p.x * p.x + p.z * p.z);
+        rLow = std::min(rLow, r);
+        rHigh = std::max(rHigh, r);
+        yLow = std::min(yLow, p.y);
+        yHigh = std::max(yHigh, p.y);
+        if (belt.period[i] != 0.0f) motion += 2.0 * 3.14159265358979323846 / belt.period[i];
+        radiusSum += belt.radius[i];
+    }
+    const float dr = std::max(rHigh - rLow, 1e-3f) / (VOLUME_RADIAL - 2), dy = std::max(yHigh - yLow, 1e-3f) / (VOLUME_HEIGHT - 2);
+    const float dTheta = 2.0f * 3.14159265f / VOLUME_AZIMUTH;
+    rLow = std::max(0.0f, rLow - dr);
+    yLow -= dy;
+    volume.shell = glm::vec4(rLow, rLow + dr * VOLUME_RADIAL, yLow, yLow + dy * VOLUME_HEIGHT);
+    volume.meanMotion = (float)(motion / n);
+    volume.meanRadius = (float)(radiusSum / n);
+    volume.density.assign((size_t)VOLUME_RADIAL * VOLUME_AZIMUTH * VOLUME_HEIGHT, 0.0f);
+    for (size_t i = 0; i < n; ++i) {
+        const glm::vec3 &p = points[i];
+        float theta = std::atan2(p.z, p.x);
+        if (theta < 0.0f) theta += 2.0f * 3.14159265f;
+        const int ir = std::min((int)((std::sqrt(p.x * p.x + p.z * p.z) - rLow) / dr), VOLUME_RADIAL - 1);
+        const int ia = std::min((int)(theta / dTheta), VOLUME_AZIMUTH - 1);
+        const int iy = std::min((int)((p.y - yLow) / dy), VOLUME_HEIGHT - 1);
+        volume.density[((size_t)iy * VOLUME_AZIMUTH + ia) * VOLUME_RADIAL + ir] += 3.14159265f * belt.radius[i] * belt.radius[i];
+    }
+    for (int ir = 0; ir < VOLUME_RADIAL; ++ir) {
+        const float inner = rLow + ir * dr, outer = inner + dr;
+        const float cell = 0.5f * (outer * outer - inner * inner) * dTheta * dy;
+        for (size_t column = 0; column < (size_t)VOLUME_AZIMUTH * VOLUME_HEIGHT; ++column) volume.density[column * VOLUME_RADIAL + ir] /= cell;
+    }
+}
+
+void AsteroidSystem::refreshLayout(double simulationTime) {
+    if (layoutWorker.joinable()) {
+        if (!layoutDone.load(std::memory_order_acquire)) return;
+        layoutWorker.join();
+        belt = std::move(pendingLayout->belt);
+        chunks = std::move(pendingLayout->chunks);
+        layoutTime = pendingLayout->time;
+        volume = std::move(pendingLayout->volume);
+        pendingLayout.reset();
+        if (volumeTexture && belt.size() >= FAR_FIELD_MIN_ROCKS) {
+            glBindTexture(GL_TEXTURE_3D, volumeTexture);
+            glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, VOLUME_RADIAL, VOLUME_AZIMUTH, VOLUME_HEIGHT, 0, GL_RED, GL_FLOAT, volume.density.data());
+            glBindTexture(GL_TEXTURE_3D, 0);
+        }
+        layoutReach = layoutSpeed = 0.0f;
+        for (const BeltChunk &chunk : chunks) {
+            layoutReach += 0.5f * glm::length(chunk.high - chunk.low);
+            layoutSpeed += chunk.speed;
+        }
+        layoutReach /= chunks.size();
+        layoutSpeed /= chunks.size();
+        return;
+    }
+    // stale once the chunks have grown by about their own size
+    if (!chunks.empty() && layoutSpeed * std::fabs(simulationTime - layoutTime) < layoutReach) return;
+    pendingLayout = std::make_unique<Layout>();
+    layoutDone.store(false, std::memory_order_relaxed);
+    // the worker only reads the belt, which is replaced on this thread after the join
+    layoutWorker = std::thread([this, simulationTime] {
+        buildLayout(belt, simulationTime, *pendingLayout);
+        layoutDone.store(true, std::memory_order_release);
+    });
+}
+
+void AsteroidSystem::stopLayout() {
+    if (layoutWorker.joinable()) layoutWorker.join();
+    pendingLayout.reset();
+}
+
+void AsteroidSystem::init(uint64_t seed) {
+    // every asteroid draws from its own counter-based stream, so the belt is
+    // the same for a given seed however the work is split
+    belt.resize(asteroidCount);
+    ThreadPool::shared().parallelFor(belt.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            CounterRng rng(seed, i, ASTEROID_STREAM);
+            belt.radius[i] = rng.uniform(0.04f, 0.19f);
+            belt.distance[i] = rng.uniform(30.0f, 33.0f);
+            belt.eccentricity[i] = 0.0f;
+            // at most 0.075 above or below the plane, the belt's thickness before orbits were inclined
+            belt.inclination[i] = asin(rng.uniform(0.0f, 0.075f) / belt.distance[i]);
+            belt.ascendingNode[i] = rng.uniform() * 2.0f * 3.14159265358979323846f;
+            belt.argPeriapsis[i] = 0.0f;
+            belt.orbitalPhase[i] = rng.uniform() * 2.0f * 3.14159265358979323846f;
+            belt.period[i] = ASTEROID_ORBIT_PERIOD;
+            belt.rotationSpeed[i] = rng.uniform(15.0f, 45.0f);
+            float theta = rng.uniform() * 2.0f * 3.14159265358979323846f;
+            float phi = rng.uniform() * 3.14159265358979323846f;
+            belt.axisX[i] = sin(phi) * cos(theta);
+            belt.axisY[i] = sin(phi) * sin(theta);
+            belt.axisZ[i] = cos(phi);
+        }
+        belt.updateOrbitFrames(begin, end);
+    });
+    createResources();
+}
+
+void AsteroidSystem::init(AsteroidBelt &&elements) {
+    belt = std::move(elements);
+    createResources();
+}
+
+void AsteroidSystem::createResources() {
     asteroidTexture = loadTexture("utils/textures/asteroid.jpg");
     if (asteroidTexture == 0) {
         const int TEX_SIZE = 128;
@@ -39,36 +332,406 @@ void AsteroidSystem::init() {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     }
+
+    createTierBuffers();
+    createVolume();
 }
 
-void AsteroidSystem::render(float simulationTime, Mesh &sphere, Shader &planetShader) {
-    // use the provided planet shader for consistent lighting
-    planetShader.use();
+void AsteroidSystem::createVolume() {
+    glGenTextures(1, &volumeTexture);
+    glBindTexture(GL_TEXTURE_3D, volumeTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_3D, 0);
+    glGenVertexArrays(1, &volumeVao);
+
+    volumeShader = std::make_unique<Shader>(std::string("shader/asteroid_volume.vert"), std::string("shader/asteroid_volume.frag"));
+    GLuint id = volumeShader->ID;
+    volumeInverseViewProjection = glGetUniformLocation(id, "inverseViewProjection");
+    volumeViewProjection = glGetUniformLocation(id, "viewProjection");
+    volumeDensity = glGetUniformLocation(id, "density");
+    volumeTexture1 = glGetUniformLocation(id, "texture1");
+    volumeCentre = glGetUniformLocation(id, "centre");
+    volumeShell = glGetUniformLocation(id, "shell");
+    volumeAzimuthOffset = glGetUniformLocation(id, "azimuthOffset");
+    volumeNearDistance = glGetUniformLocation(id, "nearDistance");
+    volumeLightPos = glGetUniformLocation(id, "lightPos");
+}
+
+// Base rock: a low-poly sphere stretched into an ellipsoid with a few broad
+// lobes, all fixed by the shape index. Positions and normals are functions
+// of the direction alone, so the UV seam stays closed.
+static Mesh createRockShape(int shape, int segments, int rings) {
+    CounterRng rng(0, (uint64_t)shape, SHAPE_STREAM);
+    const glm::vec3 axes(1.0f, rng.uniform(0.65f, 0.95f), rng.uniform(0.55f, 0.85f));
+    glm::vec3 lobes[3];
+    float lobeSizes[3];
+    for (int j = 0; j < 3; ++j) {
+        float z = rng.uniform(-1.0f, 1.0f), phi = rng.uniform(0.0f, 6.2831853f), r = std::sqrt(1.0f - z * z);
+        lobes[j] = glm::vec3(r * std::cos(phi), r * std::sin(phi), z);
+        lobeSizes[j] = rng.uniform(-0.15f, 0.2f);
+    }
+    auto surface = [&](glm::vec3 dir) {
+        float bulge = 1.0f;
+        for (int j = 0; j < 3; ++j) {
+            float d = std::max(0.0f, glm::dot(dir, lobes[j]));
+            bulge += lobeSizes[j] * d * d * d;
+        }
+        return dir * axes * bulge;
+    };
+
+    std::vector<glm::vec3> positions, normals;
+    std::vector<glm::vec2> uvs;
+    float extent = 0.0f;
+    for (int y = 0; y <= rings; ++y) {
+        for (int x = 0; x <= segments; ++x) {
+            float u = (float)x / segments, v = (float)y / rings;
+            float theta = u * 6.2831853f, phi = v * 3.14159265f;
+            glm::vec3 dir(std::cos(theta) * std::sin(phi), std::cos(phi), std::sin(theta) * std::sin(phi));
+            // normal from two nearby points on the surface, along the parameter directions
+            glm::vec3 east(-std::sin(theta), 0.0f, std::cos(theta));
+            glm::vec3 south = glm::cross(east, dir);
+            const float eps = 1e-3f;
+            glm::vec3 p = surface(dir);
+            glm::vec3 normal = glm::cross(surface(glm::normalize(dir + eps * south)) - p, surface(glm::normalize(dir + eps * east)) - p);
+            normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : dir;
+            if (glm::dot(normal, dir) < 0.0f) normal = -normal;
+            positions.push_back(p);
+            normals.push_back(normal);
+            uvs.push_back(glm::vec2(u, v));
+            extent = std::max(extent, glm::length(p));
+        }
+    }
+    std::vector<float> data;
+    for (size_t k = 0; k < positions.size(); ++k) {
+        glm::vec3 p = positions[k] * (SHAPE_EXTENT / extent);
+        data.insert(data.end(), {p.x, p.y, p.z, normals[k].x, normals[k].y, normals[k].z, uvs[k].x, uvs[k].y});
+    }
+    std::vector<unsigned int> indices;
+    for (int y = 0; y < rings; ++y) {
+        for (int x = 0; x < segments; ++x) {
+            unsigned int a = y * (segments + 1) + x, b = a + segments + 1;
+            indices.insert(indices.end(), {b, a, a + 1, b, a + 1, b + 1});
+        }
+    }
+
+    Mesh mesh;
+    glGenVertexArrays(1, &mesh.vao);
+    glGenBuffers(1, &mesh.vbo);
+    glGenBuffers(1, &mesh.ebo);
+    glBindVertexArray(mesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    GLsizei stride = 8 * sizeof(float);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0); glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)(3 * sizeof(float))); glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float))); glEnableVertexAttribArray(2);
+    glBindVertexArray(0);
+    mesh.indexCount = (GLsizei)indices.size();
+    return mesh;
+}
+
+static Mesh createImpostorQuad() {
+    const float corners[] = { -1.0f, -1.0f,  1.0f, -1.0f,  1.0f, 1.0f,  -1.0f, 1.0f };
+    const unsigned int indices[] = { 0, 1, 2, 0, 2, 3 };
+    Mesh mesh;
+    glGenVertexArrays(1, &mesh.vao);
+    glGenBuffers(1, &mesh.vbo);
+    glGenBuffers(1, &mesh.ebo);
+    glBindVertexArray(mesh.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0); glEnableVertexAttribArray(0);
+    glBindVertexArray(0);
+    mesh.indexCount = 6;
+    return mesh;
+}
+
+// Attributes 3-5 read AsteroidInstance records from record `first` on;
+// divisor 1 for the instanced tiers, 0 for points.
+static void bindInstanceRecords(GLuint buffer, GLuint divisor, size_t first = 0) {
+    const size_t base = first * sizeof(AsteroidInstance);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (void*)(base + offsetof(AsteroidInstance, centreRadius)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(AsteroidInstance), (void*)(base + offsetof(AsteroidInstance, axisAngle)));
+    glEnableVertexAttribArray(4);
+    glVertexAttribIPointer(5, 1, GL_UNSIGNED_INT, sizeof(AsteroidInstance), (void*)(base + offsetof(AsteroidInstance, id)));
+    glEnableVertexAttribArray(5);
+    glVertexAttribDivisor(3, divisor);
+    glVertexAttribDivisor(4, divisor);
+    glVertexAttribDivisor(5, divisor);
+}
+
+void AsteroidSystem::createTierBuffers() {
+    const size_t n = belt.size();
+    glGenBuffers(TIER_COUNT, tierBuffers);
+    for (int tier = 0; tier < TIER_COUNT; ++tier) {
+        glBindBuffer(GL_ARRAY_BUFFER, tierBuffers[tier]);
+        glBufferData(GL_ARRAY_BUFFER, n * sizeof(AsteroidInstance), nullptr, GL_STREAM_DRAW);
+    }
+
+    for (int shape = 0; shape < SHAPE_COUNT; ++shape) {
+        rocks[shape] = createRockShape(shape, 12, 8);
+        glBindVertexArray(rocks[shape].vao);
+        bindInstanceRecords(tierBuffers[TIER_MESH], 1);
+    }
+
+    impostorQuad = createImpostorQuad();
+    glBindVertexArray(impostorQuad.vao);
+    bindInstanceRecords(tierBuffers[TIER_IMPOSTOR], 1);
+
+    glGenVertexArrays(1, &pointVao);
+    glBindVertexArray(pointVao);
+    bindInstanceRecords(tierBuffers[TIER_POINT], 0);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    const char *sources[TIER_COUNT][2] = {
+        { "shader/asteroid.vert", "shader/planet.frag" },
+        { "shader/asteroid_impostor.vert", "shader/asteroid_impostor.frag" },
+        { "shader/asteroid_point.vert", "shader/asteroid_point.frag" },
+    };
+    for (int tier = 0; tier < TIER_COUNT; ++tier) {
+        TierProgram &program = programs[tier];
+        program.shader = std::make_unique<Shader>(std::string(sources[tier][0]), std::string(sources[tier][1]));
+        GLuint id = program.shader->ID;
+        program.view = glGetUniformLocation(id, "view");
+        program.projection = glGetUniformLocation(id, "projection");
+        program.lightPos = glGetUniformLocation(id, "lightPos");
+        program.pixelScale = glGetUniformLocation(id, "pixelScale");
+        program.texture = glGetUniformLocation(id, "texture1");
+    }
+}
+
+// Pass 1 works out each rock's slot and record and counts slots per fixed
+// block; prefix sums over the blocks then give every block its output range,
+// and pass 2 copies records into the mapped tier buffers.
+bool AsteroidSystem::classify(double simulationTime, const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &origin, float pixelScale,
+                              const std::vector<glm::dvec3> *positions, const DepthPyramid *occluders, float farDistance) {
+    const size_t n = belt.size();
+    const size_t blocks = (n + CLASSIFY_BLOCK - 1) / CLASSIFY_BLOCK;
+    records.resize(n);
+    tiers.resize(n);
+    blockCounts.assign(blocks * SLOT_COUNT, 0);
+    blockOccluded.assign(blocks, 0);
+    blockChunkCulled.assign(blocks, 0);
+    if (occluders && !occluders->usable()) occluders = nullptr;
+    const glm::mat4 toOccluders = occluders ? occluders->reprojection(origin) : glm::mat4(1.0f);
+    const bool useChunks = !positions && chunks.size() == (n + CULL_CHUNK - 1) / CULL_CHUNK;
+    const float drift = (float)std::fabs(simulationTime - layoutTime);
+    const float farSquared = farDistance * farDistance;
+
+    // side planes of a symmetric perspective frustum, in view space: a point
+    // is inside when p00 |x| + z <= 0, and likewise for y
+    const float p00 = proj[0][0], p11 = proj[1][1];
+    const float slackX = std::sqrt(p00 * p00 + 1.0f), slackY = std::sqrt(p11 * p11 + 1.0f);
+    auto outside = [&](const glm::vec3 &centre, float radius, float &depth) {
+        glm::vec3 v = glm::vec3(view * glm::vec4(centre, 1.0f));
+        depth = -v.z;
+        return depth < -radius || p00 * std::abs(v.x) - depth > radius * slackX || p11 * std::abs(v.y) - depth > radius * slackY;
+    };
+    ThreadPool::shared().parallelFor(blocks, 1, [&](size_t blockBegin, size_t blockEnd) {
+        glm::vec3 centres[TRIG_BATCH];
+        for (size_t block = blockBegin; block < blockEnd; ++block) {
+            size_t *counts = &blockCounts[block * SLOT_COUNT];
+            const size_t end = std::min(n, (block + 1) * CLASSIFY_BLOCK);
+            for (size_t first = block * CLASSIFY_BLOCK; first < end; first += TRIG_BATCH) {
+                const size_t count = std::min(TRIG_BATCH, end - first);
+                if (useChunks) {
+                    const BeltChunk &chunk = chunks[first / CULL_CHUNK];
+                    glm::vec3 centre(glm::dvec3(0.5f * (chunk.low + chunk.high)) - origin);
+                    float reach = 0.5f * glm::length(chunk.high - chunk.low) + chunk.speed * drift, depth;
+                    if (glm::length(centre) - reach > farDistance || outside(centre, reach, depth) || (occluders && occluders->occluded(toOccluders, centre, reach))) {
+                        std::fill(&tiers[first], &tiers[first] + count, TIER_CULLED);
+                        blockChunkCulled[block] += count;
+                        continue;
+                    }
+                }
+                asteroidCentres(belt, simulationTime, origin, positions, first, count, centres);
+                for (size_t k = 0; k < count; ++k) {
+                    const size_t i = first + k;
+                    const float radius = belt.radius[i];
+                    float depth;
+                    if (glm::dot(centres[k], centres[k]) > farSquared || outside(centres[k], radius, depth)) {
+                        tiers[i] = TIER_CULLED;
+                        continue;
+                    }
+                    if (occluders && occluders->occluded(toOccluders, centres[k], radius)) {
+                        tiers[i] = TIER_CULLED;
+                        ++blockOccluded[block];
+                        continue;
+                    }
+                    float pixels = radius / std::max(depth, radius) * pixelScale;
+                    uint8_t tier = pixels >= MESH_MIN_PIXELS ? TIER_MESH : pixels >= IMPOSTOR_MIN_PIXELS ? TIER_IMPOSTOR : TIER_POINT;
+                    uint8_t slot = tier == TIER_MESH ? (uint8_t)(belt.id[i] % SHAPE_COUNT) : (uint8_t)(SHAPE_COUNT + tier - 1);
+                    tiers[i] = slot;
+                    ++counts[slot];
+                    AsteroidInstance &record = records[i];
+                    record.centreRadius = glm::vec4(centres[k], radius);
+                    record.axisAngle = glm::vec4(belt.axisX[i], belt.axisY[i], belt.axisZ[i],
+                                                 tier == TIER_MESH ? spinAngle(belt, i, simulationTime) : 0.0f);
+                    record.id = belt.id[i];
+                }
+            }
+        }
+    });
+
+    // exclusive prefix sums: blockCounts becomes each block's first record
+    // per slot, counted from the start of the slot's tier buffer
+    for (int tier = 0; tier < TIER_COUNT; ++tier) drawCounts[tier] = 0;
+    occludedRocks = chunkCulledRocks = 0;
+    for (size_t count : blockOccluded) occludedRocks += count;
+    for (size_t count : blockChunkCulled) chunkCulledRocks += count;
+    for (int slot = 0; slot < SLOT_COUNT; ++slot) {
+        size_t &total = drawCounts[slotTier(slot)];
+        const size_t first = total;
+        for (size_t block = 0; block < blocks; ++block) {
+            size_t count = blockCounts[block * SLOT_COUNT + slot];
+            blockCounts[block * SLOT_COUNT + slot] = total;
+            total += count;
+        }
+        if (slot < SHAPE_COUNT) shapeCounts[slot] = total - first;
+    }
+
+    AsteroidInstance *mapped[TIER_COUNT] = {};
+    bool ok = true;
+    for (int tier = 0; tier < TIER_COUNT; ++tier) {
+        if (drawCounts[tier] == 0) continue;
+        glBindBuffer(GL_ARRAY_BUFFER, tierBuffers[tier]);
+        mapped[tier] = static_cast<AsteroidInstance *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, drawCounts[tier] * sizeof(AsteroidInstance),
+                                                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        ok = ok && mapped[tier];
+    }
+    if (ok) {
+        ThreadPool::shared().parallelFor(blocks, 1, [&](size_t blockBegin, size_t blockEnd) {
+            for (size_t block = blockBegin; block < blockEnd; ++block) {
+                size_t next[SLOT_COUNT];
+                for (int slot = 0; slot < SLOT_COUNT; ++slot) next[slot] = blockCounts[block * SLOT_COUNT + slot];
+                const size_t end = std::min(n, (block + 1) * CLASSIFY_BLOCK);
+                for (size_t i = block * CLASSIFY_BLOCK; i < end; ++i) {
+                    const uint8_t slot = tiers[i];
+                    if (slot != TIER_CULLED) mapped[slotTier(slot)][next[slot]++] = records[i];
+                }
+            }
+        });
+    }
+    for (int tier = 0; tier < TIER_COUNT; ++tier) {
+        if (!mapped[tier]) continue;
+        glBindBuffer(GL_ARRAY_BUFFER, tierBuffers[tier]);
+        ok = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE && ok;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return ok;
+}
+
+void AsteroidSystem::render(double simulationTime, const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &lightPos,
+                            const glm::dvec3 &origin, int screenHeight, const std::vector<glm::dvec3> *positions,
+                            const DepthPyramid *occluders, bool farField) {
+    if (!programs[TIER_MESH].shader || belt.empty()) return;
+    if (positions && positions->size() != belt.size()) positions = nullptr;
+    if (!positions) refreshLayout(simulationTime);
+    // pixels per unit of radius at unit depth
+    float pixelScale = proj[1][1] * 0.5f * (float)screenHeight;
+    // an average rock beyond this would be drawn as a point anyway
+    farDistance = INFINITY;
+    if (farField && volumeShader && belt.size() >= FAR_FIELD_MIN_ROCKS && !volume.density.empty())
+        farDistance = volume.meanRadius * pixelScale / IMPOSTOR_MIN_PIXELS;
+    if (!classify(simulationTime, view, proj, origin, pixelScale, positions, occluders, farDistance)) return;
+
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, asteroidTexture);
-    planetShader.setInt("texture1", 0);
-    planetShader.setInt("isSun", 0);
-
-    float asteroidOrbitPeriod = 70.0f;
-    float asteroidOrbitT = simulationTime / asteroidOrbitPeriod;
-
-    glBindVertexArray(sphere.vao);
-    for (const auto& ast : asteroids) {
-        float orbitAngle = ast.orbitalPhase + asteroidOrbitT * 2.0f * 3.14159265358979323846f;
-        float x = ast.distance * cos(orbitAngle);
-        float z = ast.distance * sin(orbitAngle);
-        float y = sin(ast.inclination) * 1.5f;
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(x, y, z));
-        float rotationAngle = simulationTime * ast.rotationSpeed;
-        model = glm::rotate(model, glm::radians(rotationAngle), ast.rotationAxis);
-        model = glm::scale(model, glm::vec3(ast.radius));
-        planetShader.setMat4("model", model);
-        glDrawElements(GL_TRIANGLES, sphere.indexCount, GL_UNSIGNED_INT, 0);
+    // the volume lies beyond every instance, so it goes first
+    if (farDistance < INFINITY) renderVolume(simulationTime, view, proj, lightPos, origin);
+    for (int tier = 0; tier < TIER_COUNT; ++tier) {
+        if (drawCounts[tier] == 0) continue;
+        const TierProgram &program = programs[tier];
+        program.shader->use();
+        glUniformMatrix4fv(program.view, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(program.projection, 1, GL_FALSE, glm::value_ptr(proj));
+        glUniform3fv(program.lightPos, 1, glm::value_ptr(lightPos));
+        glUniform1f(program.pixelScale, pixelScale);
+        glUniform1i(program.texture, 0);
+        GLsizei count = (GLsizei)drawCounts[tier];
+        if (tier == TIER_MESH) {
+            // GL 3.3 has no base instance, so each shape's range is bound by offset
+            size_t first = 0;
+            for (int shape = 0; shape < SHAPE_COUNT; ++shape) {
+                if (shapeCounts[shape] == 0) continue;
+                glBindVertexArray(rocks[shape].vao);
+                bindInstanceRecords(tierBuffers[TIER_MESH], 1, first);
+                glDrawElementsInstanced(GL_TRIANGLES, rocks[shape].indexCount, GL_UNSIGNED_INT, 0, (GLsizei)shapeCounts[shape]);
+                first += shapeCounts[shape];
+            }
+        } else if (tier == TIER_IMPOSTOR) {
+            glBindVertexArray(impostorQuad.vao);
+            glDrawElementsInstanced(GL_TRIANGLES, impostorQuad.indexCount, GL_UNSIGNED_INT, 0, count);
+        } else {
+            glBindVertexArray(pointVao);
+            glDrawArrays(GL_POINTS, 0, count);
+        }
     }
     glBindVertexArray(0);
 }
 
+void AsteroidSystem::renderVolume(double simulationTime, const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &lightPos,
+                                  const glm::dvec3 &origin) {
+    const glm::mat4 viewProjection = proj * view;
+    const float azimuthOffset = (float)std::fmod(volume.meanMotion * (simulationTime - layoutTime), 2.0 * 3.14159265358979323846);
+    volumeShader->use();
+    glUniformMatrix4fv(volumeInverseViewProjection, 1, GL_FALSE, glm::value_ptr(glm::inverse(viewProjection)));
+    glUniformMatrix4fv(volumeViewProjection, 1, GL_FALSE, glm::value_ptr(viewProjection));
+    glUniform3fv(volumeCentre, 1, glm::value_ptr(glm::vec3(-origin)));
+    glUniform4fv(volumeShell, 1, glm::value_ptr(volume.shell));
+    glUniform1f(volumeAzimuthOffset, azimuthOffset);
+    glUniform1f(volumeNearDistance, farDistance);
+    glUniform3fv(volumeLightPos, 1, glm::value_ptr(lightPos));
+    glUniform1i(volumeTexture1, 0);
+    glUniform1i(volumeDensity, 1);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, volumeTexture);
+    glActiveTexture(GL_TEXTURE0);
+    // the march sets each pixel's depth to where the belt starts, so
+    // planets in front hide it; nothing is written back
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(volumeVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glDepthMask(GL_TRUE);
+}
+
+void AsteroidSystem::transforms(double simulationTime, const glm::dvec3 &origin, std::vector<glm::mat4> &out,
+                                const std::vector<glm::dvec3> *positions) const {
+    if (positions && positions->size() != belt.size()) positions = nullptr;
+    out.resize(belt.size());
+    ThreadPool::shared().parallelFor(belt.size(), TRANSFORM_CHUNK, [&](size_t begin, size_t end) {
+        buildAsteroidTransforms(belt, simulationTime, origin, positions, begin, end, out.data() + begin);
+    });
+}
+
 void AsteroidSystem::cleanup() {
+    stopLayout();
+    if (tierBuffers[0]) glDeleteBuffers(TIER_COUNT, tierBuffers);
+    if (pointVao) glDeleteVertexArrays(1, &pointVao);
     if (asteroidTexture) glDeleteTextures(1, &asteroidTexture);
+    if (volumeTexture) glDeleteTextures(1, &volumeTexture);
+    if (volumeVao) glDeleteVertexArrays(1, &volumeVao);
+    volumeTexture = volumeVao = 0;
+    volumeShader.reset();
+    for (Mesh &mesh : rocks) {
+        mesh.destroy();
+        mesh = Mesh{0, 0, 0, 0};
+    }
+    impostorQuad.destroy();
+    impostorQuad = Mesh{0, 0, 0, 0};
+    for (GLuint &buffer : tierBuffers) buffer = 0;
+    pointVao = asteroidTexture = 0;
+    for (TierProgram &program : programs) program.shader.reset();
 }
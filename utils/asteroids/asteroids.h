@@ -1,29 +1,190 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <glad/glad.h>
 #include "../mesh/mesh.h"
+#include "../occlusion/occlusion.h"
 #include "../../shader/shader.h"
 
-struct Asteroid {
-    float radius;
-    float distance;
-    float inclination;
-    float orbitalPhase;
-    float rotationSpeed;
-    glm::vec3 rotationAxis;
+// Structure-of-arrays belt: one column per element, so passes that only need
+// a few fields (positions, bounds) stream just those columns. Orbits are
+// Keplerian ellipses about the origin; angles are in radians.
+struct AsteroidBelt {
+    std::vector<float> radius;
+    std::vector<float> distance;           // semi-major axis
+    std::vector<float> eccentricity;
+    std::vector<float> inclination;
+    std::vector<float> ascendingNode;
+    std::vector<float> argPeriapsis;
+    std::vector<float> orbitalPhase;       // mean anomaly at time 0
+    std::vector<float> period;
+    std::vector<float> rotationSpeed;      // degrees per time unit
+    std::vector<float> axisX, axisY, axisZ;
+    // semi-major and semi-minor axis vectors in the world frame, from updateOrbitFrames()
+    std::vector<float> majorX, majorY, majorZ, minorX, minorY, minorZ;
+    // index the rock had when the belt was built; it survives reordering, and
+    // N-body positions, collision events and rock shapes all go by it
+    std::vector<uint32_t> id;
+
+    size_t size() const { return radius.size(); }
+    bool empty() const { return radius.empty(); }
+    // new entries get their index as id
+    void resize(size_t n);
+    // Copy with entry k taken from entry order[k].
+    AsteroidBelt permuted(const std::vector<uint32_t> &order) const;
+    // Recomputes the derived axis columns for [begin, end) after the elements change.
+    void updateOrbitFrames(size_t begin, size_t end);
+};
+
+// Period of the generated belt.
+const float ASTEROID_ORBIT_PERIOD = 70.0f;
+// Closed-form belt orbit, shared by the renderer and the N-body set-up.
+glm::dvec3 asteroidPosition(const AsteroidBelt &belt, size_t i, double simulationTime);
+// Its time derivative, relative to the Sun.
+glm::dvec3 asteroidVelocity(const AsteroidBelt &belt, size_t i, double simulationTime);
+// The same for asteroids [begin, end), with the Kepler solve batched.
+void asteroidPositions(const AsteroidBelt &belt, double simulationTime, size_t begin, size_t end, glm::dvec3 *out);
+
+// Model matrices (translate to position - origin, spin, scale) for asteroids
+// [begin, end). positions, when given, replace the closed-form orbits; they
+// are indexed by id.
+void buildAsteroidTransforms(const AsteroidBelt &belt, double simulationTime, const glm::dvec3 &origin,
+                             const std::vector<glm::dvec3> *positions, size_t begin, size_t end, glm::mat4 *out);
+
+// Per-instance record streamed to the GPU for one detail tier.
+struct AsteroidInstance {
+    glm::vec4 centreRadius;     // camera-relative centre, radius
+    glm::vec4 axisAngle;        // spin axis, spin angle in radians
+    uint32_t id;                // belt id, seeds the rock's shape
 };
 
+// Every frame the belt is classified by projected size into three tiers:
+// low-poly meshes for rocks a few pixels across, a lit sphere impostor
+// below that, and a single point for sub-pixel rocks. The mesh tier shares
+// SHAPE_COUNT lumpy base meshes, one draw each, which the vertex shader
+// displaces with noise seeded by the rock's id, so every rock has its own
+// outline without per-rock vertices. The other tiers are one draw each.
+// Classification runs in fixed blocks across the shared pool and writes each
+// tier's records straight into its mapped instance buffer. Rocks behind the
+// depth pyramid of the planet pass, when one is given, are dropped there too.
+//
+// A worker thread periodically re-sorts the belt by the Morton code of the
+// rocks' positions, so consecutive rocks are near each other in space. Each
+// run of CULL_CHUNK rocks then carries the bounding box it had at sort time
+// and its fastest orbital speed; grown by how far the rocks can have moved
+// since, the box lets classification drop whole chunks outside the view or
+// behind occluders before solving any orbits. The layout is refreshed once
+// the rocks may have drifted further than the chunks are wide. With N-body
+// positions the order is kept but the boxes no longer apply.
+//
+// Large belts (FAR_FIELD_MIN_ROCKS and up) can be drawn as a far field:
+// each layout also bins the belt's cross-section into a low-resolution
+// annular texture (radius, azimuth, height), which a full-screen pass ray
+// marches beyond the distance where an average rock drops below the point
+// tier. Only rocks nearer than that are classified and instanced; chunks
+// wholly beyond it are skipped. Between layouts the texture is turned by
+// the belt's mean motion.
 class AsteroidSystem {
 public:
-    AsteroidSystem();
+    enum Tier { TIER_MESH, TIER_IMPOSTOR, TIER_POINT, TIER_COUNT };
+    static const int SHAPE_COUNT = 4;
+    static const size_t CULL_CHUNK = 256;
+    static const size_t FAR_FIELD_MIN_ROCKS = 50000;
+
+    explicit AsteroidSystem(int count = 2000);
     ~AsteroidSystem();
-    void init();
-    void render(float simulationTime, Mesh &sphere, Shader &planetShader);
+    // the same seed always produces the same belt
+    void init(uint64_t seed);
+    // takes over a belt built elsewhere, e.g. from a minor-planet catalog
+    void init(AsteroidBelt &&elements);
+    // positions, when given, override the closed-form orbits (N-body mode).
+    // view must have the camera at the origin; origin is its world position.
+    // occluders, when given and usable, culls rocks hidden behind the planets.
+    // farField allows the density volume for large belts.
+    void render(double simulationTime, const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &lightPos,
+                const glm::dvec3 &origin, int screenHeight, const std::vector<glm::dvec3> *positions = nullptr,
+                const DepthPyramid *occluders = nullptr, bool farField = false);
     void cleanup();
+    // in the current layout order; id maps entries back to the original belt
+    const AsteroidBelt &getBelt() const { return belt; }
+    // CPU-side model matrices, one per belt entry, for picking, collision or export, built across the shared pool.
+    void transforms(double simulationTime, const glm::dvec3 &origin, std::vector<glm::mat4> &out,
+                    const std::vector<glm::dvec3> *positions = nullptr) const;
+    // instances drawn per tier in the last frame
+    size_t tierCount(Tier tier) const { return drawCounts[tier]; }
+    // rocks in the view but hidden by occluders in the last frame
+    size_t occludedCount() const { return occludedRocks; }
+    // rocks dropped with their whole chunk in the last frame
+    size_t chunkCulledCount() const { return chunkCulledRocks; }
+    // distance beyond which the last frame drew the density volume; infinite without it
+    float farFieldDistance() const { return farDistance; }
+
 private:
-    std::vector<Asteroid> asteroids;
+    // bounds of one chunk at layout time, radii included
+    struct BeltChunk {
+        glm::vec3 low, high;
+        float speed;                // fastest rock, distance per time unit
+    };
+    // cross-section per unit volume, binned over the belt's annulus
+    struct BeltVolume {
+        std::vector<float> density;     // radial index fastest, then azimuth, then height
+        glm::vec4 shell;                // inner and outer radius, lowest and highest y
+        float meanMotion, meanRadius;   // radians per time unit; scene units
+    };
+    struct Layout {
+        AsteroidBelt belt;
+        std::vector<BeltChunk> chunks;
+        BeltVolume volume;
+        double time;
+    };
+
+    struct TierProgram {
+        std::unique_ptr<Shader> shader;
+        GLint view, projection, lightPos, pixelScale, texture;
+    };
+
+    void createResources();
+    void createTierBuffers();
+    void createVolume();
+    void renderVolume(double simulationTime, const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &lightPos,
+                      const glm::dvec3 &origin);
+    // starts a re-sort at simulationTime when the worker is idle and the
+    // current layout has gone stale; adopts a finished one
+    void refreshLayout(double simulationTime);
+    static void buildLayout(const AsteroidBelt &belt, double simulationTime, Layout &out);
+    void stopLayout();
+    bool classify(double simulationTime, const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &origin, float pixelScale,
+                  const std::vector<glm::dvec3> *positions, const DepthPyramid *occluders, float farDistance);
+
+    AsteroidBelt belt;
+    std::vector<BeltChunk> chunks;  // empty until the first layout
+    double layoutTime;
+    float layoutReach, layoutSpeed; // mean chunk half-diagonal and speed
+    std::unique_ptr<Layout> pendingLayout;
+    std::thread layoutWorker;
+    std::atomic<bool> layoutDone;
+    // far field: the density texture is filled from each adopted layout
+    BeltVolume volume;
+    GLuint volumeTexture, volumeVao;
+    std::unique_ptr<Shader> volumeShader;
+    GLint volumeInverseViewProjection, volumeViewProjection, volumeDensity, volumeTexture1, volumeCentre, volumeShell,
+          volumeAzimuthOffset, volumeNearDistance, volumeLightPos;
+    float farDistance;
+    Mesh rocks[SHAPE_COUNT], impostorQuad;
+    GLuint pointVao;
+    GLuint tierBuffers[TIER_COUNT];
+    TierProgram programs[TIER_COUNT];
     GLuint asteroidTexture;
-    const int ASTEROID_COUNT = 2000;
+    // classification scratch: records and slots (tier, and shape in the mesh tier) per rock, counts per block
+    std::vector<AsteroidInstance> records;
+    std::vector<uint8_t> tiers;
+    std::vector<size_t> blockCounts, blockOccluded, blockChunkCulled;
+    size_t drawCounts[TIER_COUNT];
+    size_t shapeCounts[SHAPE_COUNT];
+    size_t occludedRocks, chunkCulledRocks;
+    const int asteroidCount;
 };
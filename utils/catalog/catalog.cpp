@@ -0,0 +1,351 @@
+#include "catalog.h"
+#include "../asteroids/asteroids.h"
+#include "../random/random.h"
+#include "../threadpool/threadpool.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint32_t CATALOG_STREAM = 3;
+static const size_t COLUMN_ALIGNMENT = 64;
+static const double J2000 = 2451545.0;
+static const double DAYS_PER_YEAR = 365.25;
+
+// MPCORB fixed-width fields: first byte (0-based) and width.
+struct Field { int start, width; };
+static const Field FIELD_MAGNITUDE = {8, 5};
+static const Field FIELD_EPOCH = {20, 5};
+static const Field FIELD_MEAN_ANOMALY = {26, 9};
+static const Field FIELD_ARG_PERIHELION = {37, 9};
+static const Field FIELD_ASCENDING_NODE = {48, 9};
+static const Field FIELD_INCLINATION = {59, 9};
+static const Field FIELD_ECCENTRICITY = {70, 9};
+static const Field FIELD_SEMI_MAJOR_AXIS = {92, 11};
+static const size_t MIN_RECORD_LENGTH = 103;
+
+// Element lines have their decimal points in fixed places; header and
+// comment lines do not.
+static bool isRecord(const char *line, size_t length) {
+    return length >= MIN_RECORD_LENGTH && line[29] == '.' && line[40] == '.' && line[51] == '.' &&
+           line[62] == '.' && line[71] == '.' && line[95] == '.';
+}
+
+static bool parseField(const char *line, Field field, float &out) {
+    const char *p = line + field.start, *end = p + field.width;
+    while (p < end && *p == ' ') ++p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    double value = 0.0;
+    bool digits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, digits = true) value = value * 10.0 + (*p - '0');
+    if (p < end && *p == '.') {
+        double scale = 0.1;
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, scale *= 0.1, digits = true) value += (*p - '0') * scale;
+    }
+    while (p < end && *p == ' ') ++p;
+    if (!digits || p != end) return false;
+    out = (float)(negative ? -value : value);
+    return true;
+}
+
+// 1-9 then A, B, C... for 10, 11, 12...
+static int packedDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'Z') return c - 'A' + 10;
+    return -1;
+}
+
+// Packed epoch "K2555" = 2025-05-05, 0h TT, as days from J2000.
+static bool parseEpoch(const char *line, float &out) {
+    const char *p = line + FIELD_EPOCH.start;
+    int century = packedDigit(p[0]), month = packedDigit(p[3]), day = packedDigit(p[4]);
+    if (century < 18 || p[1] < '0' || p[1] > '9' || p[2] < '0' || p[2] > '9' || month < 1 || month > 12 || day < 1 || day > 31) return false;
+    int year = century * 100 + (p[1] - '0') * 10 + (p[2] - '0');
+    int a = (14 - month) / 12, y = year + 4800 - a, m = month + 12 * a - 3;
+    long dayNumber = day + (153 * m + 2) / 5 + 365L * y + y / 4 - y / 100 + y / 400 - 32045;
+    out = (float)((double)dayNumber - 0.5 - J2000);
+    return true;
+}
+
+static int64_t modifiedTime(const struct stat &info) {
+#if defined(__APPLE__)
+    return (int64_t)info.st_mtimespec.tv_sec;
+#else
+    return (int64_t)info.st_mtim.tv_sec;
+#endif
+}
+
+MinorPlanetCatalog::~MinorPlanetCatalog() { close(); }
+
+void MinorPlanetCatalog::close() {
+    if (data) munmap(data, length);
+    data = nullptr;
+    length = 0;
+    for (auto &column : imported) std::vector<float>().swap(column);
+    for (auto &column : columns) column = nullptr;
+    count = 0;
+}
+
+bool MinorPlanetCatalog::load(const std::string &path) {
+    close();
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+        std::cerr << "Failed to open catalog: " << path << std::endl;
+        return false;
+    }
+    const std::string cachePath = path + ".cache";
+    auto start = std::chrono::steady_clock::now();
+    if (mapCache(cachePath, (uint64_t)info.st_size, modifiedTime(info))) {
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Loaded " << count << " minor planets from " << cachePath << " in " << ms << " ms" << std::endl;
+        return true;
+    }
+    if (!import(path)) return false;
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Imported " << count << " minor planets from " << path << " in " << ms << " ms" << std::endl;
+
+    // continue from the cache, so the parsed columns can be released
+    if (writeCache(cachePath, (uint64_t)info.st_size, modifiedTime(info))) {
+        size_t imports = count;
+        std::vector<float> kept[COLUMN_COUNT];
+        for (int c = 0; c < COLUMN_COUNT; ++c) kept[c].swap(imported[c]);
+        if (mapCache(cachePath, (uint64_t)info.st_size, modifiedTime(info)) && count == imports) return true;
+        close();
+        for (int c = 0; c < COLUMN_COUNT; ++c) {
+            imported[c].swap(kept[c]);
+            columns[c] = imported[c].data();
+        }
+        count = imports;
+    }
+    return true;
+}
+
+bool MinorPlanetCatalog::mapCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceModified) {
+    int fd = ::open(cachePath.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CatalogFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+    data = mapped;
+    length = (size_t)info.st_size;
+
+    const char *bytes = static_cast<const char *>(data);
+    const CatalogFileHeader *header = reinterpret_cast<const CatalogFileHeader *>(bytes);
+    size_t tableEnd = sizeof(CatalogFileHeader) + (size_t)header->columnCount * sizeof(CatalogColumn);
+    if (memcmp(header->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 || header->version != CATALOG_VERSION ||
+        header->sourceSize != sourceSize || header->sourceModified != sourceModified || tableEnd > length) {
+        close();
+        return false;
+    }
+    const CatalogColumn *table = reinterpret_cast<const CatalogColumn *>(bytes + sizeof(CatalogFileHeader));
+    for (uint32_t i = 0; i < header->columnCount; ++i) {
+        const CatalogColumn &column = table[i];
+        if (column.id >= COLUMN_COUNT) continue;
+        if (column.offset % sizeof(float) != 0 || column.offset > length ||
+            header->count > (length - column.offset) / sizeof(float)) {
+            std::cerr << "Corrupt catalog cache column " << i << ": " << cachePath << std::endl;
+            close();
+            return false;
+        }
+        columns[column.id] = reinterpret_cast<const float *>(bytes + column.offset);
+    }
+    for (int c = 0; c < COLUMN_COUNT; ++c) {
+        if (!columns[c]) {
+            close();
+            return false;
+        }
+    }
+    count = (size_t)header->count;
+    return true;
+}
+
+// Two passes over line-aligned chunks of the mapped source: count the records
+// in each chunk, then parse every chunk into its own slice of the columns.
+bool MinorPlanetCatalog::import(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open catalog: " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        std::cerr << "Empty catalog: " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    const size_t size = (size_t)info.st_size;
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map catalog: " << path << std::endl;
+        return false;
+    }
+    const char *text = static_cast<const char *>(mapped);
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    ThreadPool &pool = ThreadPool::shared();
+    const size_t chunks = std::max<size_t>(1, std::min<size_t>(size / (1 << 20) + 1, pool.lanes() * 8));
+    std::vector<size_t> bounds(chunks + 1);
+    for (size_t c = 0; c <= chunks; ++c) {
+        size_t at = c == chunks ? size : size / chunks * c;
+        if (c > 0 && at < size) {
+            const char *newline = static_cast<const char *>(memchr(text + at - 1, '\n', size - at + 1));
+            at = newline ? (size_t)(newline - text) + 1 : size;
+        }
+        bounds[c] = std::max(at, c > 0 ? bounds[c - 1] : 0);
+    }
+
+    auto forEachLine = [&](size_t chunk, const std::function<void(const char *, size_t)> &fn) {
+        const char *p = text + bounds[chunk], *end = text + bounds[chunk + 1];
+        while (p < end) {
+            const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+            const char *lineEnd = newline ? newline : end;
+            size_t n = lineEnd - p;
+            if (n > 0 && p[n - 1] == '\r') --n;
+            fn(p, n);
+            p = lineEnd + 1;
+        }
+    };
+
+    std::vector<size_t> firstRecord(chunks + 1, 0);
+    pool.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+        for (size_t chunk = begin; chunk < end; ++chunk) {
+            size_t records = 0;
+            forEachLine(chunk, [&](const char *line, size_t n) { records += isRecord(line, n); });
+            firstRecord[chunk + 1] = records;
+        }
+    });
+    for (size_t c = 0; c < chunks; ++c) firstRecord[c + 1] += firstRecord[c];
+    count = firstRecord[chunks];
+    if (count == 0) {
+        std::cerr << "No MPCORB element lines in " << path << std::endl;
+        munmap(mapped, size);
+        return false;
+    }
+
+    for (auto &column : imported) column.resize(count);
+    pool.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+        for (size_t chunk = begin; chunk < end; ++chunk) {
+            size_t i = firstRecord[chunk];
+            forEachLine(chunk, [&](const char *line, size_t n) {
+                if (!isRecord(line, n)) return;
+                float values[COLUMN_COUNT];
+                bool ok = parseField(line, FIELD_SEMI_MAJOR_AXIS, values[SEMI_MAJOR_AXIS]) &&
+                          parseField(line, FIELD_ECCENTRICITY, values[ECCENTRICITY]) &&
+                          parseField(line, FIELD_INCLINATION, values[INCLINATION]) &&
+                          parseField(line, FIELD_ASCENDING_NODE, values[ASCENDING_NODE]) &&
+                          parseField(line, FIELD_ARG_PERIHELION, values[ARG_PERIHELION]) &&
+                          parseField(line, FIELD_MEAN_ANOMALY, values[MEAN_ANOMALY]) &&
+                          parseEpoch(line, values[EPOCH]);
+                // catalogToBelt drops records with a NAN semi-major axis
+                if (!ok) values[SEMI_MAJOR_AXIS] = NAN;
+                if (!parseField(line, FIELD_MAGNITUDE, values[MAGNITUDE])) values[MAGNITUDE] = NAN;
+                for (int c = 0; c < COLUMN_COUNT; ++c) imported[c][i] = values[c];
+                ++i;
+            });
+        }
+    });
+    munmap(mapped, size);
+    for (int c = 0; c < COLUMN_COUNT; ++c) columns[c] = imported[c].data();
+    return true;
+}
+
+// Written to a temporary file and renamed, so a reader never sees half a cache.
+bool MinorPlanetCatalog::writeCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceModified) const {
+    CatalogFileHeader header = {};
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header.version = CATALOG_VERSION;
+    header.columnCount = COLUMN_COUNT;
+    header.count = count;
+    header.sourceSize = sourceSize;
+    header.sourceModified = sourceModified;
+
+    auto align = [](uint64_t offset) { return (offset + COLUMN_ALIGNMENT - 1) / COLUMN_ALIGNMENT * COLUMN_ALIGNMENT; };
+    CatalogColumn table[COLUMN_COUNT] = {};
+    uint64_t offset = align(sizeof(header) + sizeof(table));
+    for (int c = 0; c < COLUMN_COUNT; ++c) {
+        table[c].id = c;
+        table[c].offset = offset;
+        offset = align(offset + count * sizeof(float));
+    }
+
+    const std::string temporary = cachePath + ".tmp";
+    FILE *out = fopen(temporary.c_str(), "wb");
+    if (!out) {
+        std::cerr << "Cannot write catalog cache " << temporary << std::endl;
+        return false;
+    }
+    static const char padding[COLUMN_ALIGNMENT] = {};
+    bool ok = fwrite(&header, sizeof(header), 1, out) == 1 && fwrite(table, sizeof(table), 1, out) == 1;
+    uint64_t written = sizeof(header) + sizeof(table);
+    for (int c = 0; c < COLUMN_COUNT && ok; ++c) {
+        ok = fwrite(padding, 1, table[c].offset - written, out) == table[c].offset - written &&
+             fwrite(columns[c], sizeof(float), count, out) == count;
+        written = table[c].offset + count * sizeof(float);
+    }
+    if (fclose(out) != 0 || !ok || rename(temporary.c_str(), cachePath.c_str()) != 0) {
+        std::cerr << "Failed writing catalog cache " << cachePath << std::endl;
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+void catalogToBelt(const MinorPlanetCatalog &catalog, const std::function<double(double)> &distanceMap,
+                   double yearLength, uint64_t seed, AsteroidBelt &belt) {
+    typedef MinorPlanetCatalog C;
+    const float *a = catalog.column(C::SEMI_MAJOR_AXIS), *e = catalog.column(C::ECCENTRICITY);
+    const float *inc = catalog.column(C::INCLINATION), *node = catalog.column(C::ASCENDING_NODE);
+    const float *peri = catalog.column(C::ARG_PERIHELION), *M = catalog.column(C::MEAN_ANOMALY);
+    const float *epoch = catalog.column(C::EPOCH), *H = catalog.column(C::MAGNITUDE);
+
+    std::vector<uint32_t> bound;
+    bound.reserve(catalog.size());
+    for (size_t i = 0; i < catalog.size(); ++i) {
+        if (a[i] > 0.0f && e[i] >= 0.0f && e[i] < 1.0f) bound.push_back((uint32_t)i);
+    }
+
+    const double RADIANS = 3.14159265358979323846 / 180.0, TWO_PI = 2.0 * 3.14159265358979323846;
+    belt.resize(bound.size());
+    ThreadPool::shared().parallelFor(bound.size(), 4096, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            const size_t i = bound[k];
+            double years = std::pow((double)a[i], 1.5);
+            // mean anomaly carried from the element epoch back to J2000
+            double meanMotion = 360.0 / (years * DAYS_PER_YEAR);
+            double phase = fmod((M[i] - meanMotion * epoch[i]) * RADIANS, TWO_PI);
+            // diameter from H for a typical 0.14 albedo, compressed into scene sizes
+            double magnitude = std::isnan(H[i]) ? 16.0 : H[i];
+            double diameterKm = 1329.0 / std::sqrt(0.14) * std::pow(10.0, -magnitude / 5.0);
+
+            CounterRng rng(seed, i, CATALOG_STREAM);
+            belt.radius[k] = (float)std::min(0.6, std::max(0.02, 0.03 * std::cbrt(diameterKm)));
+            belt.distance[k] = (float)distanceMap(a[i]);
+            belt.eccentricity[k] = e[i];
+            belt.inclination[k] = (float)(inc[i] * RADIANS);
+            belt.ascendingNode[k] = (float)(node[i] * RADIANS);
+            belt.argPeriapsis[k] = (float)(peri[i] * RADIANS);
+            belt.orbitalPhase[k] = (float)(phase < 0.0 ? phase + TWO_PI : phase);
+            belt.period[k] = (float)(years * yearLength);
+            belt.rotationSpeed[k] = rng.uniform(15.0f, 45.0f);
+            float theta = rng.uniform() * 2.0f * 3.14159265358979323846f;
+            float phi = rng.uniform() * 3.14159265358979323846f;
+            belt.axisX[k] = std::sin(phi) * std::cos(theta);
+            belt.axisY[k] = std::sin(phi) * std::sin(theta);
+            belt.axisZ[k] = std::cos(phi);
+        }
+        belt.updateOrbitFrames(begin, end);
+    });
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include "catalogformat.h"
+
+struct AsteroidBelt;
+
+// Osculating elements of a minor-planet catalog in MPCORB format, held as
+// float columns. load() maps the columnar cache next to the source when it
+// is current; otherwise it parses the source in parallel, line-aligned
+// chunks and writes a fresh cache. Mapped columns are paged in only when
+// read, so memory follows the columns a caller actually touches.
+class MinorPlanetCatalog {
+public:
+    enum Column {
+        SEMI_MAJOR_AXIS,        // AU
+        ECCENTRICITY,
+        INCLINATION,            // degrees, J2000 ecliptic
+        ASCENDING_NODE,         // degrees
+        ARG_PERIHELION,         // degrees
+        MEAN_ANOMALY,           // degrees, at the epoch
+        EPOCH,                  // days from J2000 (TT)
+        MAGNITUDE,              // absolute magnitude H, NAN if unknown
+        COLUMN_COUNT
+    };
+
+    MinorPlanetCatalog() = default;
+    ~MinorPlanetCatalog();
+    MinorPlanetCatalog(const MinorPlanetCatalog &) = delete;
+    MinorPlanetCatalog &operator=(const MinorPlanetCatalog &) = delete;
+
+    // Reads path (e.g. MPCORB.DAT) through the cache at path + ".cache".
+    bool load(const std::string &path);
+    void close();
+
+    size_t size() const { return count; }
+    const float *column(Column c) const { return columns[c]; }
+
+private:
+    bool mapCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceModified);
+    bool import(const std::string &path);
+    bool writeCache(const std::string &cachePath, uint64_t sourceSize, int64_t sourceModified) const;
+
+    void *data = nullptr;       // mapped cache
+    size_t length = 0;
+    std::vector<float> imported[COLUMN_COUNT];     // used when the cache cannot be written
+    const float *columns[COLUMN_COUNT] = {};
+    size_t count = 0;
+};
+
+// Converts catalog elements into belt columns. distanceMap takes a
+// semi-major axis in AU to scene units, and yearLength is the length of one
+// year in simulation time. Simulation time 0 is J2000. Unbound orbits are
+// skipped. Spin axes and rates come from seed.
+void catalogToBelt(const MinorPlanetCatalog &catalog, const std::function<double(double)> &distanceMap,
+                   double yearLength, uint64_t seed, AsteroidBelt &belt);
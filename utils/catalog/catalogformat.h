@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+
+// Columnar cache of a minor-planet element file, written by
+// MinorPlanetCatalog after an import and mapped on later start-ups. Native
+// byte order, all offsets from the start of the file:
+//
+//   CatalogFileHeader
+//   CatalogColumn[columnCount]
+//   column data: count floats each, every column 64-byte aligned
+//
+// The header records the size and modification time of the source file; a
+// cache that no longer matches them is rebuilt.
+
+static const char CATALOG_MAGIC[8] = {'S', 'S', 'M', 'P', 'C', 'A', 'T', '\0'};
+static const uint32_t CATALOG_VERSION = 1;
+
+struct CatalogFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t columnCount;
+    uint64_t count;             // objects
+    uint64_t sourceSize;
+    int64_t sourceModified;     // seconds since the epoch
+};
+
+struct CatalogColumn {
+    uint32_t id;                // MinorPlanetCatalog::Column
+    uint32_t reserved;
+    uint64_t offset;
+};
@@ -0,0 +1,340 @@
+#include "collision.h"
+#include <algorithm>
+#include <cmath>
+
+static const size_t PAIR_BLOCK = 4096;
+// partners tested together before the hits go on to the narrowphase
+static const size_t RUN_BATCH = 64;
+static const size_t SORT_BLOCK = 1 << 14;
+// widest radix digit; the passes split the key bits evenly below it
+static const int MAX_RADIX_BITS = 11;
+static const size_t SAMPLE_SIZE = 4096;
+// the base cells fit this share of the swept spheres; the rest go up a level or more
+static const double BASE_LEVEL_FRACTION = 0.99;
+static const int MAX_LEVELS = 48;
+// a step is split into sweeps so that typical motion stays within a few
+// radii; past MAX_SWEEPS the swept spheres simply grow
+static const int MAX_SWEEPS = 4;
+// keys place bodies along a row in steps of this share of a cell
+static const int64_t X_STEPS = 8;
+
+// Step along a row for an offset from the low corner, with two cells of
+// margin before it so that search windows stay inside the row. Offsets are
+// never more than a cell below the corner, so truncating is flooring.
+static int64_t xStep(double offset, double stepsPerUnit) {
+    return (int64_t)(offset * stepsPerUnit + 2 * X_STEPS);
+}
+
+static uint64_t powerOfTwoAbove(uint64_t n) {
+    return n <= 1 ? 1 : (uint64_t)1 << (64 - __builtin_clzll(n - 1));
+}
+
+static double levelCellSize(double baseCellSize, int level) {
+    return baseCellSize * (double)((uint64_t)1 << level);
+}
+
+// Value below which the given share of an evenly strided sample falls.
+template <typename F>
+static double sampleQuantile(size_t count, double share, F value) {
+    const size_t stride = std::max<size_t>(1, count / SAMPLE_SIZE);
+    std::vector<double> sample;
+    sample.reserve(count / stride + 1);
+    for (size_t i = 0; i < count; i += stride) sample.push_back(value(i));
+    size_t k = std::min(sample.size() - 1, (size_t)(sample.size() * share));
+    std::nth_element(sample.begin(), sample.begin() + k, sample.end());
+    return sample[k];
+}
+
+void CollisionDetector::detect(const glm::dvec3 *previousPositions, const glm::dvec3 *currentPositions, const float *bodyRadii,
+                               size_t count, double startTime, double dt, std::vector<CollisionEvent> &events) {
+    candidates = 0;
+    if (count < 2 || dt == 0.0) return;
+    previous = previousPositions;
+    current = currentPositions;
+    radii = bodyRadii;
+    bodyCount = count;
+    sweepStart = startTime;
+    sweepLength = dt;
+
+    double motion = sampleQuantile(count, 0.5, [&](size_t i) { return glm::length(current[i] - previous[i]); });
+    double size = sampleQuantile(count, 0.5, [&](size_t i) { return (double)radii[i]; });
+    int sweeps = size > 0.0 ? (int)std::clamp(std::ceil(motion / (4.0 * size)), 1.0, (double)MAX_SWEEPS) : 1;
+
+    const size_t first = events.size();
+    for (int s = 0; s < sweeps; ++s) {
+        sweep((double)s / sweeps, (double)(s + 1) / sweeps);
+        for (auto &block : blockEvents) events.insert(events.end(), block.begin(), block.end());
+    }
+    std::sort(events.begin() + first, events.end(), [](const CollisionEvent &x, const CollisionEvent &y) {
+        if (x.time != y.time) return x.time < y.time;
+        return x.a != y.a ? x.a < y.a : x.b < y.b;
+    });
+}
+
+// One sweep over [from, to] of the step, as fractions of it.
+void CollisionDetector::sweep(double from, double to) {
+    sweepFrom = from;
+    sweepTo = to;
+    const size_t count = bodyCount;
+    const size_t blocks = (count + PAIR_BLOCK - 1) / PAIR_BLOCK;
+    centres.resize(count);
+    reach.resize(count);
+    std::vector<glm::dvec3> blockLow(blocks), blockHigh(blocks);
+    std::vector<double> blockWidest(blocks);
+    pool.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; ++block) {
+            glm::dvec3 low(HUGE_VAL), high(-HUGE_VAL);
+            double widest = 0.0;
+            for (size_t i = block * PAIR_BLOCK; i < std::min(count, (block + 1) * PAIR_BLOCK); ++i) {
+                glm::dvec3 p0 = glm::mix(previous[i], current[i], from), p1 = glm::mix(previous[i], current[i], to);
+                centres[i] = 0.5 * (p0 + p1);
+                reach[i] = radii[i] + 0.5 * glm::length(p1 - p0);
+                low = glm::min(low, centres[i]);
+                high = glm::max(high, centres[i]);
+                widest = std::max(widest, reach[i]);
+            }
+            blockLow[block] = low;
+            blockHigh[block] = high;
+            blockWidest[block] = widest;
+        }
+    });
+    glm::dvec3 low(HUGE_VAL), high(-HUGE_VAL);
+    double widest = 0.0;
+    for (size_t block = 0; block < blocks; ++block) {
+        low = glm::min(low, blockLow[block]);
+        high = glm::max(high, blockHigh[block]);
+        widest = std::max(widest, blockWidest[block]);
+    }
+
+    baseCellSize = 2.0 * sampleQuantile(count, BASE_LEVEL_FRACTION, [&](size_t i) { return reach[i]; });
+    if (!(baseCellSize > 0.0)) baseCellSize = std::max(1e-9, 2.0 * widest);
+    // coarser base cells if the keys would not fit in 62 bits
+    for (;;) {
+        levelCount = widest > 0.5 * baseCellSize ? std::min(MAX_LEVELS, (int)std::ceil(std::log2(2.0 * widest / baseCellSize)) + 1) : 1;
+        // powers of two, so a key splits into its row and cell with shifts
+        dims = glm::u64vec3((high - low) / baseCellSize) + glm::u64vec3(3);
+        dims = glm::u64vec3(powerOfTwoAbove((dims.x + 2) * X_STEPS), powerOfTwoAbove(dims.y), powerOfTwoAbove(dims.z));
+        if ((double)levelCount * dims.x * dims.y * dims.z < 4.0e18) break;
+        baseCellSize *= 2.0;
+    }
+    lowCorner = low;
+    sortCells();
+
+    blockEvents.resize(blocks);
+    blockCandidates.assign(blocks, 0);
+    // rows in the half stencil: the next row up, then the three rows of the next slice
+    const int rowSteps[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+    const int64_t row = (int64_t)dims.x, slice = (int64_t)(dims.x * dims.y);
+    const int rowBits = __builtin_ctzll(dims.x), sliceBits = rowBits + __builtin_ctzll(dims.y);
+    // a window's start is at most this many x steps before the body's own
+    const uint64_t lead = X_STEPS + 2;
+    pool.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; ++block) {
+            std::vector<CollisionEvent> &out = blockEvents[block];
+            size_t &tested = blockCandidates[block];
+            out.clear();
+            // Spheres in [from, to) that reach sphere s. Most are misses, so
+            // hits are gathered without branching and tested after.
+            auto visit = [&](size_t s, size_t from, size_t to) {
+                const glm::vec4 a = spheres[s], p = starts[s];
+                uint32_t hits[RUN_BATCH];
+                for (size_t batch = from; batch < to; batch += RUN_BATCH) {
+                    size_t found = 0;
+                    for (size_t t = batch; t < std::min(to, batch + RUN_BATCH); ++t) {
+                        const glm::vec4 b = spheres[t];
+                        const glm::vec3 d = glm::vec3(b) - glm::vec3(a);
+                        const float r = a.w + b.w;
+                        hits[found] = (uint32_t)t;
+                        found += glm::dot(d, d) <= r * r;
+                    }
+                    for (size_t k = 0; k < found; ++k) {
+                        const size_t t = hits[k];
+                        // touching at the start: the contact was reported when they met
+                        const glm::vec4 q = starts[t];
+                        const glm::vec3 gap = glm::vec3(q) - glm::vec3(p);
+                        const float touch = p.w + q.w - padding;
+                        if (touch > 0.0f && glm::dot(gap, gap) < touch * touch) continue;
+                        ++tested;
+                        narrowphase(s, t, out);
+                    }
+                }
+            };
+            // one past the run of keys from t that are at most lastKey
+            auto runEnd = [&](size_t t, uint64_t lastKey) {
+                while (t < count && keys[t] <= lastKey) ++t;
+                return t;
+            };
+
+            const size_t first = block * PAIR_BLOCK, last = std::min(count, first + PAIR_BLOCK);
+            size_t cursors[4];
+            for (int r = 0; r < 4; ++r) {
+                const uint64_t target = keys[first] + rowSteps[r][0] * row + rowSteps[r][1] * slice - lead;
+                cursors[r] = std::lower_bound(keys.begin(), keys.end(), target) - keys.begin();
+            }
+            int level = (int)(std::upper_bound(levelStart.begin(), levelStart.end(), first) - levelStart.begin()) - 1;
+
+            for (size_t s = first; s < last; ++s) {
+                const uint64_t key = keys[s];
+                while (s >= levelStart[level + 1]) ++level;
+                const glm::vec4 sphere = spheres[s];
+                const double cellSize = levelCellSize(baseCellSize, level), steps = X_STEPS / cellSize;
+                // no partner on this level has its centre further away than this
+                const double limit = sphere.w + 0.5 * cellSize;
+                const uint64_t rowKey = key & ~(uint64_t)(row - 1);
+                const int64_t y = (int64_t)((key >> rowBits) & (dims.y - 1)), z = (int64_t)((key >> sliceBits) & (dims.z - 1));
+
+                // same level: further along this row, then the rows above
+                const uint64_t rowEnd = rowKey + xStep(sphere.x + limit, steps);
+                visit(s, s + 1, runEnd(s + 1, rowEnd));
+                for (int r = 0; r < 4; ++r) {
+                    const int64_t offset = rowSteps[r][0] * row + rowSteps[r][1] * slice;
+                    size_t &t = cursors[r];
+                    while (t < count && keys[t] < key + offset - lead) ++t;
+                    // gap between the body and the row's slab; the rest of the limit bounds x
+                    const double gapY = std::max(0.0, rowSteps[r][0] > 0 ? y * cellSize - sphere.y : rowSteps[r][0] < 0 ? sphere.y - (y - 1) * cellSize : 0.0);
+                    const double gapZ = std::max(0.0, rowSteps[r][1] > 0 ? z * cellSize - sphere.z : 0.0);
+                    const double gapSq = gapY * gapY + gapZ * gapZ;
+                    if (gapSq > limit * limit) continue;
+                    const double halfWidth = std::sqrt(limit * limit - gapSq);
+                    const uint64_t windowStart = rowKey + offset + xStep(sphere.x - halfWidth, steps);
+                    const uint64_t windowEnd = rowKey + offset + xStep(sphere.x + halfWidth, steps);
+                    size_t u = t;
+                    while (u < count && keys[u] < windowStart) ++u;
+                    visit(s, u, runEnd(u, windowEnd));
+                }
+
+                // finer levels: search the rows a partner's centre could be in
+                for (int fine = 0; fine < level; ++fine) {
+                    const size_t levelBegin = levelStart[fine], levelEnd = levelStart[fine + 1];
+                    if (levelBegin == levelEnd) continue;
+                    const double fineSize = levelCellSize(baseCellSize, fine), extent = sphere.w + 0.5 * fineSize;
+                    glm::i64vec3 lo, hi;
+                    for (int axis = 1; axis < 3; ++axis) {
+                        lo[axis] = std::clamp((int64_t)std::floor((sphere[axis] - extent) / fineSize) + 1, (int64_t)0, (int64_t)dims[axis] - 1);
+                        hi[axis] = std::clamp((int64_t)std::floor((sphere[axis] + extent) / fineSize) + 1, (int64_t)0, (int64_t)dims[axis] - 1);
+                    }
+                    lo.x = std::clamp(xStep(sphere.x - extent, X_STEPS / fineSize), (int64_t)0, (int64_t)dims.x - 1);
+                    hi.x = std::clamp(xStep(sphere.x + extent, X_STEPS / fineSize), (int64_t)0, (int64_t)dims.x - 1);
+                    const double rows = (double)(hi.y - lo.y + 1) * (double)(hi.z - lo.z + 1);
+                    if (rows * (std::log2((double)(levelEnd - levelBegin)) + 1.0) >= (double)(levelEnd - levelBegin)) {
+                        visit(s, levelBegin, levelEnd);
+                        continue;
+                    }
+                    for (int64_t fz = lo.z; fz <= hi.z; ++fz)
+                        for (int64_t fy = lo.y; fy <= hi.y; ++fy) {
+                            const uint64_t fineEnd = cellKey(fine, hi.x, fy, fz);
+                            const size_t t = std::lower_bound(keys.begin() + levelBegin, keys.begin() + levelEnd, cellKey(fine, lo.x, fy, fz)) - keys.begin();
+                            visit(s, t, std::min(levelEnd, runEnd(t, fineEnd)));
+                        }
+                }
+            }
+        }
+    });
+    for (size_t n : blockCandidates) candidates += n;
+}
+
+// Keys every body by its level and cell, then sorts by key with a parallel
+// LSD radix sort: per pass, each block counts its digits, a prefix sum over
+// (digit, block) gives every block its output ranges, and the blocks
+// scatter. Passes cover only the bits the keys use.
+void CollisionDetector::sortCells() {
+    const size_t count = bodyCount;
+    keys.resize(count);
+    order.resize(count);
+    keyScratch.resize(count);
+    orderScratch.resize(count);
+    pool.parallelFor(count, PAIR_BLOCK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            int level = 0;
+            if (reach[i] > 0.5 * baseCellSize) level = std::min(levelCount - 1, (int)std::ceil(std::log2(2.0 * reach[i] / baseCellSize)));
+            while (level < levelCount - 1 && reach[i] > 0.5 * levelCellSize(baseCellSize, level)) ++level;
+            const double cellSize = levelCellSize(baseCellSize, level);
+            const glm::dvec3 offset = centres[i] - lowCorner;
+            keys[i] = cellKey(level, xStep(offset.x, X_STEPS / cellSize), (int64_t)(offset.y / cellSize) + 1, (int64_t)(offset.z / cellSize) + 1);
+            order[i] = (uint32_t)i;
+        }
+    });
+
+    const uint64_t maxKey = cellKey(levelCount, 0, 0, 0) - 1;
+    const int bits = 64 - __builtin_clzll(maxKey | 1);
+    const int passes = (bits + MAX_RADIX_BITS - 1) / MAX_RADIX_BITS, digitBits = (bits + passes - 1) / passes;
+    const size_t RADIX = (size_t)1 << digitBits;
+    const size_t blocks = (count + SORT_BLOCK - 1) / SORT_BLOCK;
+    histograms.resize(blocks * RADIX);
+    for (int shift = 0; shift < bits; shift += digitBits) {
+        pool.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; ++block) {
+                size_t *histogram = &histograms[block * RADIX];
+                std::fill(histogram, histogram + RADIX, 0);
+                for (size_t i = block * SORT_BLOCK; i < std::min(count, (block + 1) * SORT_BLOCK); ++i) ++histogram[(keys[i] >> shift) & (RADIX - 1)];
+            }
+        });
+        size_t offset = 0;
+        for (size_t digit = 0; digit < RADIX; ++digit) {
+            for (size_t block = 0; block < blocks; ++block) {
+                size_t n = histograms[block * RADIX + digit];
+                histograms[block * RADIX + digit] = offset;
+                offset += n;
+            }
+        }
+        pool.parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; ++block) {
+                size_t *position = &histograms[block * RADIX];
+                for (size_t i = block * SORT_BLOCK; i < std::min(count, (block + 1) * SORT_BLOCK); ++i) {
+                    size_t at = position[(keys[i] >> shift) & (RADIX - 1)]++;
+                    keyScratch[at] = keys[i];
+                    orderScratch[at] = order[i];
+                }
+            }
+        });
+        keys.swap(keyScratch);
+        order.swap(orderScratch);
+    }
+
+    // Everything the pair walk reads, gathered into key order so partners
+    // are near each other in memory. The spheres are single precision,
+    // relative to the low corner, with the reach padded to cover rounding;
+    // the narrowphase works on the exact double inputs.
+    const glm::dvec3 extent = glm::dvec3(dims.x / X_STEPS, dims.y, dims.z) * baseCellSize;
+    const double slack = 1e-6 * std::max({extent.x, extent.y, extent.z});
+    padding = (float)slack;
+    spheres.resize(count);
+    sortedStart.resize(count);
+    sortedMotion.resize(count);
+    starts.resize(count);
+    pool.parallelFor(count, PAIR_BLOCK, [&](size_t begin, size_t end) {
+        for (size_t s = begin; s < end; ++s) {
+            const uint32_t i = order[s];
+            spheres[s] = glm::vec4(glm::vec3(centres[i] - lowCorner), (float)(reach[i] + slack));
+            sortedMotion[s] = current[i] - previous[i];
+            sortedStart[s] = glm::mix(previous[i], current[i], sweepFrom);
+            starts[s] = glm::vec4(glm::vec3(sortedStart[s] - lowCorner), radii[i]);
+        }
+    });
+    levelStart.resize(levelCount + 1);
+    for (int l = 0; l <= levelCount; ++l) levelStart[l] = std::lower_bound(keys.begin(), keys.end(), cellKey(l, 0, 0, 0)) - keys.begin();
+}
+
+// Earliest time in the sweep at which the spheres touch, from
+// |p + v t| = r with p, v the relative position and motion. Pairs already
+// touching at the start of the sweep were reported when they met. s and t
+// are positions in key order.
+void CollisionDetector::narrowphase(size_t s, size_t t, std::vector<CollisionEvent> &out) const {
+    if (order[s] > order[t]) std::swap(s, t);
+    const uint32_t i = order[s], j = order[t];
+    const glm::dvec3 motion = sortedMotion[t] - sortedMotion[s];
+    const glm::dvec3 p = sortedStart[t] - sortedStart[s];
+    const glm::dvec3 v = motion * (sweepTo - sweepFrom);
+    const double r = (double)starts[s].w + starts[t].w;
+    const double c = glm::dot(p, p) - r * r;
+    const double b = glm::dot(p, v);
+    if (c <= 0.0 || b >= 0.0) return;
+    const double disc = b * b - glm::dot(v, v) * c;
+    if (disc < 0.0) return;
+    // c / (-b + sqrt(disc)) is the smaller root without cancellation
+    const double time = c / (-b + std::sqrt(disc));
+    if (time > 1.0) return;
+    const double at = sweepFrom + time * (sweepTo - sweepFrom);
+    const glm::dvec3 centreI = glm::mix(previous[i], current[i], at), centreJ = glm::mix(previous[j], current[j], at);
+    out.push_back({i, j, sweepStart + sweepLength * at, motion / sweepLength, centreI + (centreJ - centreI) * (r > 0.0 ? starts[s].w / r : 0.5)});
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "../threadpool/threadpool.h"
+
+struct CollisionEvent {
+    uint32_t a, b;                  // body indices, a < b
+    double time;                    // simulation time of first contact
+    glm::dvec3 relativeVelocity;    // velocity of b relative to a
+    glm::dvec3 contact;             // where the surfaces meet at that time
+};
+
+// Finds spheres that come into contact during one step, with each body
+// moving in a straight line from its previous to its current position.
+//
+// Broadphase: a hierarchy of uniform grids, rebuilt on every call. Each
+// body's swept sphere goes into the finest level whose cells are at least
+// its diameter, so within a level a partner can only be in a neighbouring
+// cell. Bodies are ordered by key (level, cell row, then position along the
+// row in eighths of a cell) with a parallel counting (radix) sort; each
+// neighbouring row is then a contiguous run of the sorted keys, walked with
+// cursors that only move forward, and a body tests only the stretch of it
+// that a partner's centre could lie in. Cells double in size per level, and
+// bodies look for partners on finer levels by searching the rows they
+// cover, or by scanning the level when that is cheaper (planets among
+// rocks). The walk tests single-precision spheres padded for rounding and
+// drops pairs that already overlap at the start; the narrowphase solves,
+// in double precision, for the exact time the two spheres touch.
+// Pairs already touching at the start of the step are not reported again,
+// so one contact is one event.
+class CollisionDetector {
+public:
+    // The passes run their parallel loops on pool.
+    explicit CollisionDetector(ThreadPool &pool = ThreadPool::shared()) : pool(pool) {}
+
+    // Appends contacts in [startTime, startTime + dt] to events, ordered by
+    // time, then body indices.
+    void detect(const glm::dvec3 *previous, const glm::dvec3 *current, const float *radii, size_t count,
+                double startTime, double dt, std::vector<CollisionEvent> &events);
+
+    // pairs that reached the narrowphase in the last detect()
+    size_t candidatePairs() const { return candidates; }
+
+private:
+    void sweep(double from, double to);
+    void sortCells();
+    void narrowphase(size_t s, size_t t, std::vector<CollisionEvent> &out) const;
+    uint64_t cellKey(int level, int64_t x, int64_t y, int64_t z) const {
+        return (((uint64_t)level * dims.z + z) * dims.y + y) * dims.x + x;
+    }
+
+    ThreadPool &pool;
+    const glm::dvec3 *previous = nullptr, *current = nullptr;
+    const float *radii = nullptr;
+    size_t bodyCount = 0;
+    double sweepFrom = 0.0, sweepTo = 1.0, sweepStart = 0.0, sweepLength = 0.0;
+
+    // per body: swept-sphere centre and reach
+    std::vector<glm::dvec3> centres;
+    std::vector<double> reach;
+    // level l has cells of baseCellSize * 2^l counted from lowCorner - cell
+    // size; dims are powers of two, x counting steps of an eighth of a cell
+    double baseCellSize = 1.0;
+    glm::dvec3 lowCorner;
+    glm::u64vec3 dims;
+    int levelCount = 0;
+    // bodies in key order; level l is levelStart[l] .. levelStart[l + 1]
+    std::vector<uint64_t> keys, keyScratch;
+    std::vector<uint32_t> order, orderScratch;
+    // in key order: swept sphere (centre from lowCorner, padded reach) and
+    // sphere at the start of the sweep (centre from lowCorner, radius) in
+    // single precision, then the start and motion over the step exactly
+    std::vector<glm::vec4> spheres, starts;
+    std::vector<glm::dvec3> sortedStart, sortedMotion;
+    float padding = 0.0f;   // covers the rounding of the single-precision positions
+    std::vector<size_t> levelStart, histograms;
+    std::vector<std::vector<CollisionEvent>> blockEvents;
+    std::vector<size_t> blockCandidates;
+    size_t candidates = 0;
+};
@@ -1,82 +1,53 @@
 #include "dust.h"
 #include "../texture/texture.h"
-#include <glm/gtc/matrix_transform.hpp>
+#include "../threadpool/threadpool.h"
 #include <glm/gtc/type_ptr.hpp>
 #include <cstdlib>
-#include <ctime>
+#include <cstddef>
+#include <cmath>
 #include <iostream>
 #include <GLFW/glfw3.h>
 
 using namespace std;
 
-// Parameters (copied from additions.cpp)
-static const int DUST_PARTICLES = 5000;
-static const float DUST_MIN_DISTANCE = 50.0f;
-static const float DUST_MAX_DISTANCE = 300.0f;
-static const float DUST_SIZE = 0.03f;
-static const float DUST_VELOCITY = 0.5f;
-static const float DUST_ROTATION_SPEED = 10.0f;
-
 extern float getTimeSeconds(); // optional hook; we will use glfwGetTime directly in code when needed
 
-DustSystem::DustSystem() : dustTexture(0), uniModel(-1), uniView(-1), uniProj(-1), uniCameraRight(-1), uniCameraUp(-1), uniSize(-1), uniLightColor(-1) {}
+DustSystem::DustSystem(size_t count)
+    : particleCount(count), stateBuffers{0, 0}, stateVaos{0, 0}, current(0), dustTexture(0),
+      uniView(-1), uniProj(-1), uniOrigin(-1), uniPixelScale(-1), uniTwinklePhase(-1), uniLightColor(-1), uniDeltaTime(-1),
+      uniCentre(-1), uniUpdatePerLevel(-1), uniUpdateInnerExtent(-1), uniPerLevel(-1), uniInnerExtent(-1) {}
 
 DustSystem::~DustSystem() { cleanup(); }
 
-static Mesh createDustQuad() {
-    float vertices[] = {
-        // positions    // texCoords
-        -0.5f,  0.5f,   0.0f, 1.0f,
-        -0.5f, -0.5f,   0.0f, 0.0f,
-         0.5f, -0.5f,   1.0f, 0.0f,
-         0.5f,  0.5f,   1.0f, 1.0f
-    };
-
-    unsigned int indices[] = { 0,1,2, 0,2,3 };
-
-    Mesh mesh;
-    glGenVertexArrays(1, &mesh.vao);
-    glGenBuffers(1, &mesh.vbo);
-    glGenBuffers(1, &mesh.ebo);
-
-    glBindVertexArray(mesh.vao);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    // pos (2)
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    // tex (2)
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glBindVertexArray(0);
-    mesh.indexCount = 6;
-    return mesh;
+void DustSystem::packStates(ParticleState *out) const {
+    ThreadPool::shared().parallelFor(field.size(), 16384, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            out[i] = ParticleState{glm::vec3(field.x[i], field.y[i], field.z[i]), glm::vec3(field.vx[i], field.vy[i], field.vz[i]),
+                                   glm::vec3(field.diameter[i], field.rotation[i], field.spin[i])};
+        }
+    });
 }
 
-void DustSystem::init() {
-    srand(static_cast<unsigned>(time(nullptr)));
-    dust.clear(); dust.reserve(DUST_PARTICLES);
-
-    for (int i = 0; i < DUST_PARTICLES; ++i) {
-        SpaceDustParticle p;
-        float radius = DUST_MIN_DISTANCE + static_cast<float>(rand()) / RAND_MAX * (DUST_MAX_DISTANCE - DUST_MIN_DISTANCE);
-        float theta = static_cast<float>(rand()) / RAND_MAX * 2.0f * 3.14159265358979323846f;
-        float phi = acos(2.0f * static_cast<float>(rand()) / RAND_MAX - 1.0f);
-        p.position.x = radius * sin(phi) * cos(theta);
-        p.position.y = radius * sin(phi) * sin(theta) * 0.3f;
-        p.position.z = radius * cos(phi);
-        glm::vec3 tangent = glm::normalize(glm::cross(p.position, glm::vec3(0.0f,1.0f,0.0f)));
-        p.velocity = tangent * (DUST_VELOCITY + static_cast<float>(rand()) / RAND_MAX * 0.3f);
-        p.size = DUST_SIZE * (0.8f + static_cast<float>(rand()) / RAND_MAX * 0.4f);
-        p.life = 1.0f;
-        p.rotation = static_cast<float>(rand()) / RAND_MAX * 360.0f;
-        p.rotationSpeed = DUST_ROTATION_SPEED * (0.5f + static_cast<float>(rand()) / RAND_MAX);
-        dust.push_back(p);
+void DustSystem::init(uint64_t seed) {
+    field.init(seed, particleCount);
+    std::vector<ParticleState> states(particleCount);
+    packStates(states.data());
+    glGenBuffers(2, stateBuffers);
+    glGenVertexArrays(2, stateVaos);
+    const GLsizei stride = sizeof(ParticleState);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_ARRAY_BUFFER, stateBuffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, states.size() * sizeof(ParticleState), i == 0 ? states.data() : nullptr, GL_DYNAMIC_COPY);
+
+        glBindVertexArray(stateVaos[i]);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ParticleState, position));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ParticleState, velocity));
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(ParticleState, sizeRotation));
+        for (GLuint attribute = 0; attribute < 3; ++attribute) glEnableVertexAttribArray(attribute);
     }
-
-    quad = createDustQuad();
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    current = 0;
 
     // load dust texture (fallback to procedural)
     dustTexture = loadTexture("utils/textures/dust_particle.png");
@@ -113,60 +84,89 @@ void DustSystem::init() {
     // compile dust shader using file-based Shader
     shader = std::make_unique<Shader>(std::string("shader/dust.vert"), std::string("shader/dust.frag"));
     shader->use();
-    uniModel = glGetUniformLocation(shader->ID, "model");
     uniView = glGetUniformLocation(shader->ID, "view");
     uniProj = glGetUniformLocation(shader->ID, "projection");
-    uniCameraRight = glGetUniformLocation(shader->ID, "cameraRight");
-    uniCameraUp = glGetUniformLocation(shader->ID, "cameraUp");
-    uniSize = glGetUniformLocation(shader->ID, "size");
+    uniOrigin = glGetUniformLocation(shader->ID, "origin");
+    uniPixelScale = glGetUniformLocation(shader->ID, "pixelScale");
+    uniTwinklePhase = glGetUniformLocation(shader->ID, "twinklePhase");
     uniLightColor = glGetUniformLocation(shader->ID, "lightColor");
+    uniPerLevel = glGetUniformLocation(shader->ID, "perLevel");
+    uniInnerExtent = glGetUniformLocation(shader->ID, "innerExtent");
+
+    updateShader = std::make_unique<Shader>(std::string("shader/dust_update.vert"),
+                                            std::vector<std::string>{"Position", "Velocity", "SizeRotation"});
+    uniDeltaTime = glGetUniformLocation(updateShader->ID, "deltaTime");
+    uniCentre = glGetUniformLocation(updateShader->ID, "centre");
+    uniUpdatePerLevel = glGetUniformLocation(updateShader->ID, "perLevel");
+    uniUpdateInnerExtent = glGetUniformLocation(updateShader->ID, "innerExtent");
+    // the CPU copy is only kept when the GPU cannot advance the field
+    if (updateShader->ID) field = DustField();
 
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
-void DustSystem::update(float deltaTime) {
-    for (auto &p : dust) {
-        p.position += p.velocity * deltaTime;
-        p.rotation += p.rotationSpeed * deltaTime;
-        if (p.rotation > 360.0f) p.rotation -= 360.0f;
-        p.life = 0.8f + 0.2f * sin(glfwGetTime() * 2.0f + p.position.x);
+// One point per particle through the update shader, with rasterization off;
+// the outputs land in the other buffer, which becomes the current one.
+void DustSystem::update(float deltaTime, const glm::dvec3 &origin) {
+    if (!updateShader || particleCount == 0) return;
+    if (!updateShader->ID) {
+        // no transform feedback: advance on the CPU and upload in place
+        field.advance(deltaTime, glm::vec3(origin));
+        staging.resize(particleCount);
+        packStates(staging.data());
+        glBindBuffer(GL_ARRAY_BUFFER, stateBuffers[current]);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, staging.size() * sizeof(ParticleState), staging.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return;
     }
+    updateShader->use();
+    glUniform1f(uniDeltaTime, deltaTime);
+    glUniform3fv(uniCentre, 1, glm::value_ptr(glm::vec3(origin)));
+    glUniform1i(uniUpdatePerLevel, (GLint)DustField::levelSize(particleCount));
+    glUniform1f(uniUpdateInnerExtent, DustField::INNER_EXTENT);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray(stateVaos[current]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, stateBuffers[1 - current]);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)particleCount);
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    current = 1 - current;
 }
 
-void DustSystem::render(const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &camFront, const glm::vec3 &camUp) {
-    if (!shader) return;
+void DustSystem::render(const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &origin, int screenHeight) {
+    if (!shader || particleCount == 0) return;
     shader->use();
     glUniformMatrix4fv(uniView, 1, GL_FALSE, glm::value_ptr(view));
     glUniformMatrix4fv(uniProj, 1, GL_FALSE, glm::value_ptr(proj));
-
-    // camera basis
-    glm::vec3 cameraRight = glm::normalize(glm::cross(camFront, camUp));
-    glm::vec3 cameraUpV = glm::normalize(glm::cross(cameraRight, camFront));
-    glUniform3fv(uniCameraRight, 1, glm::value_ptr(cameraRight));
-    glUniform3fv(uniCameraUp, 1, glm::value_ptr(cameraUpV));
+    glUniform3fv(uniOrigin, 1, glm::value_ptr(glm::vec3(origin)));
+    glUniform1f(uniPixelScale, proj[1][1] * 0.5f * (float)screenHeight);
+    glUniform1f(uniTwinklePhase, (float)fmod(glfwGetTime() * 2.0, 2.0 * 3.14159265358979323846));
+    glUniform1i(uniPerLevel, (GLint)DustField::levelSize(particleCount));
+    glUniform1f(uniInnerExtent, DustField::INNER_EXTENT);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, dustTexture);
 
-    glBindVertexArray(quad.vao);
-    for (const auto &p : dust) {
-        if (p.life <= 0.0f) continue;
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, p.position);
-        model = glm::rotate(model, glm::radians(p.rotation), glm::vec3(0.0f, 0.0f, 1.0f));
-        glUniformMatrix4fv(uniModel, 1, GL_FALSE, glm::value_ptr(model));
-        glUniform1f(uniSize, p.size * p.life);
-        glDrawElements(GL_TRIANGLES, quad.indexCount, GL_UNSIGNED_INT, 0);
-    }
+    // one sprite per particle, sized by the vertex shader
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glBindVertexArray(stateVaos[current]);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)particleCount);
     glBindVertexArray(0);
+    glDisable(GL_PROGRAM_POINT_SIZE);
 }
 
 void DustSystem::cleanup() {
-    if (quad.vbo) glDeleteBuffers(1, &quad.vbo);
-    if (quad.ebo) glDeleteBuffers(1, &quad.ebo);
-    if (quad.vao) glDeleteVertexArrays(1, &quad.vao);
+    if (stateBuffers[0]) glDeleteBuffers(2, stateBuffers);
+    if (stateVaos[0]) glDeleteVertexArrays(2, stateVaos);
+    stateBuffers[0] = stateBuffers[1] = stateVaos[0] = stateVaos[1] = 0;
     if (dustTexture) glDeleteTextures(1, &dustTexture);
+    dustTexture = 0;
     // Shader destructor will delete program
     shader.reset();
+    updateShader.reset();
+    field = DustField();
 }
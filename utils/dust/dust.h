@@ -1,34 +1,50 @@
 #pragma once
 #include <vector>
 #include <memory>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <glad/glad.h>
-#include "../mesh/mesh.h"
 #include "../../shader/shader.h"
+#include "dustfield.h"
 
-struct SpaceDustParticle {
-    glm::vec3 position;
-    glm::vec3 velocity;
-    float size;
-    float life;
-    float rotation;
-    float rotationSpeed;
-};
-
+// Dust lives on the GPU: after init() the particle state sits in two
+// buffers, and update() advances it from one into the other with transform
+// feedback. render() draws the newest buffer as point sprites in a single
+// draw, so the CPU never sees a particle again. Without transform
+// feedback the field is advanced on the CPU instead and uploaded each frame.
+// Either way the field wraps around the camera in nested cubes (see
+// DustField), so dust surrounds the viewer anywhere in the system.
 class DustSystem {
 public:
-    DustSystem();
+    explicit DustSystem(size_t count = 5000);
     ~DustSystem();
-    void init();
-    void update(float deltaTime);
-    void render(const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &camFront, const glm::vec3 &camUp);
+    void init(uint64_t seed);
+    // origin is the camera's world position, which the field wraps around
+    void update(float deltaTime, const glm::dvec3 &origin);
+    // view is camera-relative; origin is the camera's world position
+    void render(const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &origin, int screenHeight);
     void cleanup();
 private:
-    std::vector<SpaceDustParticle> dust;
-    Mesh quad;
+    // One particle as stored on the GPU, read as vertex attributes and
+    // written back by the update shader in the same order.
+    struct ParticleState {
+        glm::vec3 position;
+        glm::vec3 velocity;
+        glm::vec3 sizeRotation;     // size, rotation and spin, in degrees
+    };
+
+    void packStates(ParticleState *out) const;
+
+    const size_t particleCount;
+    DustField field;                        // generation, and the CPU fallback
+    std::vector<ParticleState> staging;
+    GLuint stateBuffers[2];
+    GLuint stateVaos[2];                    // reading stateBuffers[i], for updates and sprites alike
+    int current;                            // buffer holding the latest state
     GLuint dustTexture;
-    std::unique_ptr<Shader> shader;
+    std::unique_ptr<Shader> shader, updateShader;
 
     // uniform locations (queried after shader program creation)
-    GLint uniModel, uniView, uniProj, uniCameraRight, uniCameraUp, uniSize, uniLightColor;
+    GLint uniView, uniProj, uniOrigin, uniPixelScale, uniTwinklePhase, uniLightColor, uniDeltaTime;
+    GLint uniCentre, uniUpdatePerLevel, uniUpdateInnerExtent, uniPerLevel, uniInnerExtent;
 };
@@ -0,0 +1,85 @@
+#include "dustfield.h"
+#include "../random/random.h"
+#include "../threadpool/threadpool.h"
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <cmath>
+
+// Parameters (copied from additions.cpp)
+static const float DUST_SIZE = 1.0f;          // sprite diameter
+static const float DUST_VELOCITY = 0.5f;
+static const float DUST_ROTATION_SPEED = 10.0f;
+static const uint32_t DUST_STREAM = 2;
+
+// Particles per pool task, and per pass inside a task: each pass runs the
+// drift and the spin on a batch while it is still in L1.
+static const size_t ADVANCE_CHUNK = 16384;
+static const size_t ADVANCE_BATCH = 1024;
+
+void DustField::resize(size_t count) {
+    for (simd::AlignedVector<float> *column : {&x, &y, &z, &vx, &vy, &vz, &diameter, &rotation, &spin}) column->resize(count);
+}
+
+void DustField::init(uint64_t seed, size_t count) {
+    resize(count);
+    const size_t perLevel = std::max<size_t>(levelSize(count), 1);
+    ThreadPool::shared().parallelFor(count, 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            CounterRng rng(seed, i, DUST_STREAM);
+            const float half = 0.5f * levelExtent((int)(i / perLevel));
+            glm::vec3 position(rng.uniform(-half, half), rng.uniform(-half, half), rng.uniform(-half, half));
+            // a heading unrelated to position keeps the wrapped field uniform
+            float theta = rng.uniform() * 2.0f * 3.14159265358979323846f;
+            float height = rng.uniform(-1.0f, 1.0f);
+            float across = std::sqrt(1.0f - height * height);
+            glm::vec3 heading(across * std::cos(theta), height, across * std::sin(theta));
+            glm::vec3 velocity = heading * (DUST_VELOCITY + rng.uniform() * 0.3f);
+            x[i] = position.x; y[i] = position.y; z[i] = position.z;
+            vx[i] = velocity.x; vy[i] = velocity.y; vz[i] = velocity.z;
+            diameter[i] = DUST_SIZE * rng.uniform(0.8f, 1.2f);
+            rotation[i] = rng.uniform() * 360.0f;
+            spin[i] = DUST_ROTATION_SPEED * rng.uniform(0.5f, 1.5f);
+        }
+    });
+}
+
+// One column pair per loop keeps the vectorizer's overlap check to two pointers.
+// The offset from centre comes back into [-extent/2, extent/2); floor is a
+// truncation of a value kept positive, which vectorizes, and is exact within
+// a thousand cube sides. Anything further off lands one cube short and is
+// brought in by the next step.
+static void drift(float *position, const float *velocity, float deltaTime, float centre, float extent, size_t count) {
+    const float inverse = 1.0f / extent;
+    for (size_t k = 0; k < count; ++k) {
+        float offset = position[k] + velocity[k] * deltaTime - centre;
+        float turns = (float)(int)(offset * inverse + 1024.5f) - 1024.0f;
+        position[k] = centre + (offset - turns * extent);
+    }
+}
+
+static void turn(float *rotation, const float *spin, float deltaTime, size_t count) {
+    for (size_t k = 0; k < count; ++k) {
+        float r = rotation[k] + spin[k] * deltaTime;
+        // whole turns by truncation, which vectorizes where a compare and
+        // select would not under trapping math; spins are positive
+        rotation[k] = r - 360.0f * (float)(int)(r * (1.0f / 360.0f));
+    }
+}
+
+void DustField::advance(float deltaTime, const glm::vec3 &centre) {
+    const size_t perLevel = std::max<size_t>(levelSize(size()), 1);
+    // captured by value, so the stores below cannot alias them
+    ThreadPool::shared().parallelFor(size(), ADVANCE_CHUNK, [this, deltaTime, centre, perLevel](size_t begin, size_t end) {
+        size_t count;
+        for (size_t first = begin; first < end; first += count) {
+            // batches stop at level boundaries, so each wraps into one cube
+            const size_t level = first / perLevel;
+            count = std::min({ADVANCE_BATCH, end - first, (level + 1) * perLevel - first});
+            const float extent = levelExtent((int)level);
+            drift(&x[first], &vx[first], deltaTime, centre.x, extent, count);
+            drift(&y[first], &vy[first], deltaTime, centre.y, extent, count);
+            drift(&z[first], &vz[first], deltaTime, centre.z, extent, count);
+            turn(&rotation[first], &spin[first], deltaTime, count);
+        }
+    });
+}
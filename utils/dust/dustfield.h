@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "../simd/simd.h"
+
+// Dust state on the CPU as aligned float columns, with no GL dependency.
+// It generates the field for every build and advances it where transform
+// feedback is not available, or with no GL at all. advance() streams the
+// columns through plain loops the compiler vectorizes and splits large
+// fields across the shared pool. The twinkle is not kept here: the sprite
+// shader derives it from the position and one phase per frame, on either path.
+//
+// The field follows the viewer. Particles are split evenly into LEVELS
+// nested cubes centred on the camera, each twice the side of the one before,
+// and every step wraps a particle toroidally back into its level's cube. A
+// particle left behind re-enters on the far side, so the budget stays
+// around the camera wherever it goes, and density falls eightfold per level.
+class DustField {
+public:
+    static constexpr int LEVELS = 4;
+    static constexpr float INNER_EXTENT = 75.0f;     // side of the level 0 cube
+
+    // Particles per level for a field of count; the last may hold fewer.
+    static size_t levelSize(size_t count) { return (count + LEVELS - 1) / LEVELS; }
+    static float levelExtent(int level) { return INNER_EXTENT * (float)(1 << level); }
+
+    // count particles spread through the cubes around the origin; the same
+    // seed always gives the same field
+    void init(uint64_t seed, size_t count);
+    size_t size() const { return x.size(); }
+
+    // Moves every particle by its velocity, wraps it into its cube around
+    // centre, and spins it.
+    void advance(float deltaTime, const glm::vec3 &centre);
+
+    simd::AlignedVector<float> x, y, z;
+    simd::AlignedVector<float> vx, vy, vz;
+    simd::AlignedVector<float> diameter;
+    simd::AlignedVector<float> rotation;      // degrees, in [0, 360)
+    simd::AlignedVector<float> spin;          // degrees per second
+
+private:
+    void resize(size_t count);
+};
@@ -0,0 +1,119 @@
+#include "ephemeris.h"
+#include <iostream>
+#include <iomanip>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+Ephemeris::~Ephemeris() { close(); }
+
+bool Ephemeris::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Failed to open ephemeris: " << path << std::endl;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(EphemerisFileHeader)) {
+        std::cerr << "Ephemeris too small: " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    length = (size_t)info.st_size;
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Failed to map ephemeris: " << path << std::endl;
+        length = 0;
+        return false;
+    }
+    data = mapped;
+
+    const char *bytes = static_cast<const char *>(data);
+    header = reinterpret_cast<const EphemerisFileHeader *>(bytes);
+    if (memcmp(header->magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC)) != 0 || header->version != EPHEMERIS_VERSION) {
+        std::cerr << "Unsupported ephemeris format: " << path << std::endl;
+        close();
+        return false;
+    }
+    size_t tableEnd = sizeof(EphemerisFileHeader) + (size_t)header->seriesCount * sizeof(EphemerisSeries);
+    if (tableEnd > length) {
+        std::cerr << "Truncated ephemeris: " << path << std::endl;
+        close();
+        return false;
+    }
+    const EphemerisSeries *table = reinterpret_cast<const EphemerisSeries *>(bytes + sizeof(EphemerisFileHeader));
+    for (uint32_t i = 0; i < header->seriesCount; ++i) {
+        const EphemerisSeries &s = table[i];
+        uint64_t size = s.segmentCount * 3 * s.coefficientCount * sizeof(double);
+        if (s.body >= (uint32_t)EARTH || s.coefficientCount == 0 || s.segmentDays <= 0.0 ||
+            s.offset % sizeof(double) != 0 || s.offset > length || size > length - s.offset) {
+            std::cerr << "Corrupt ephemeris series " << i << ": " << path << std::endl;
+            close();
+            return false;
+        }
+        series[s.body] = &s;
+    }
+    std::cout << std::fixed << std::setprecision(1) << "Loaded ephemeris: " << path << " (JD " << header->startDate << " - " << header->endDate << ")" << std::defaultfloat << std::endl;
+    return true;
+}
+
+void Ephemeris::close() {
+    if (data) munmap(data, length);
+    data = nullptr;
+    length = 0;
+    header = nullptr;
+    for (auto &s : series) s = nullptr;
+}
+
+const EphemerisSeries *Ephemeris::findSeries(int body) const {
+    return body >= 0 && body < EARTH ? series[body] : nullptr;
+}
+
+// Clenshaw recurrence for the three components of one segment at once:
+// b_k = 2 tau b_{k+1} - b_{k+2} + c_k, then f = tau b_1 - b_2 + c_0.
+bool Ephemeris::evaluate(const EphemerisSeries &s, double date, glm::dvec3 &out) const {
+    double offset = (date - header->startDate) / s.segmentDays;
+    if (!(offset >= 0.0)) return false;
+    uint64_t segment = (uint64_t)offset;
+    if (segment == s.segmentCount && offset == (double)segment) --segment;     // end of the table
+    if (segment >= s.segmentCount) return false;
+    double tau = 2.0 * (offset - (double)segment) - 1.0;
+
+    const size_t n = s.coefficientCount;
+    const double *c = reinterpret_cast<const double *>(static_cast<const char *>(data) + s.offset) + segment * 3 * n;
+    const double *cx = c, *cy = c + n, *cz = c + 2 * n;
+    double bx1 = 0.0, bx2 = 0.0, by1 = 0.0, by2 = 0.0, bz1 = 0.0, bz2 = 0.0;
+    const double twoTau = 2.0 * tau;
+    for (size_t k = n - 1; k >= 1; --k) {
+        double bx = twoTau * bx1 - bx2 + cx[k];
+        double by = twoTau * by1 - by2 + cy[k];
+        double bz = twoTau * bz1 - bz2 + cz[k];
+        bx2 = bx1; bx1 = bx;
+        by2 = by1; by1 = by;
+        bz2 = bz1; bz1 = bz;
+    }
+    out = glm::dvec3(tau * bx1 - bx2 + cx[0], tau * by1 - by2 + cy[0], tau * bz1 - bz2 + cz[0]);
+    return true;
+}
+
+bool Ephemeris::positions(double date, const int *bodies, size_t count, glm::dvec3 *out) const {
+    if (!isOpen()) return false;
+    for (size_t i = 0; i < count; ++i) {
+        if (bodies[i] == EARTH) {
+            // Earth = barycentre - Moon / (1 + Earth/Moon mass ratio)
+            const EphemerisSeries *emb = findSeries(EARTH_MOON_BARYCENTER), *moon = findSeries(MOON);
+            glm::dvec3 barycentre, geocentricMoon;
+            if (!emb || !moon || !evaluate(*emb, date, barycentre) || !evaluate(*moon, date, geocentricMoon)) return false;
+            out[i] = barycentre - geocentricMoon / (1.0 + header->earthMoonRatio);
+            continue;
+        }
+        const EphemerisSeries *s = findSeries(bodies[i]);
+        if (!s || !evaluate(*s, date, out[i])) return false;
+    }
+    return true;
+}
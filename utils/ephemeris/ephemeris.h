@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <glm/glm.hpp>
+#include "ephemerisformat.h"
+
+// Read-only view of a memory-mapped Chebyshev ephemeris table. Opening
+// only validates the header; coefficients are paged in by the OS as they
+// are used, and evaluating a body costs one segment lookup plus a Clenshaw
+// recurrence.
+class Ephemeris {
+public:
+    // JPL DE body order. EARTH is derived from the barycentre and the Moon.
+    enum Body { MERCURY, VENUS, EARTH_MOON_BARYCENTER, MARS, JUPITER, SATURN,
+                URANUS, NEPTUNE, PLUTO, MOON, SUN, EARTH, BODY_COUNT };
+
+    Ephemeris() = default;
+    ~Ephemeris();
+    Ephemeris(const Ephemeris &) = delete;
+    Ephemeris &operator=(const Ephemeris &) = delete;
+
+    bool open(const std::string &path);
+    void close();
+    bool isOpen() const { return data != nullptr; }
+
+    double startDate() const { return header ? header->startDate : 0.0; }
+    double endDate() const { return header ? header->endDate : 0.0; }
+
+    // Positions in AU in the ICRF equatorial frame, barycentric except the
+    // Moon, which is geocentric. Evaluates all bodies for one Julian date
+    // (TDB); returns false if the date or a body is not in the table.
+    bool positions(double date, const int *bodies, size_t count, glm::dvec3 *out) const;
+
+private:
+    const EphemerisSeries *findSeries(int body) const;
+    bool evaluate(const EphemerisSeries &series, double date, glm::dvec3 &out) const;
+
+    void *data = nullptr;
+    size_t length = 0;
+    const EphemerisFileHeader *header = nullptr;
+    const EphemerisSeries *series[BODY_COUNT] = {};
+};
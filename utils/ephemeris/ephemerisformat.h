@@ -0,0 +1,35 @@
+#pragma once
+#include <cstdint>
+
+// Binary Chebyshev ephemeris written by tools/ephemeris_ingest and mapped by
+// Ephemeris. Native byte order, all offsets from the start of the file:
+//
+//   EphemerisFileHeader
+//   EphemerisSeries[seriesCount]
+//   coefficients (double, AU), one block per series: segmentCount segments of
+//   3 * coefficientCount values, x then y then z
+//
+// Every series starts at startDate and uses equal segments, so the segment
+// for any date is found with one division.
+
+static const char EPHEMERIS_MAGIC[8] = {'S', 'S', 'E', 'P', 'H', 'E', 'M', '\0'};
+static const uint32_t EPHEMERIS_VERSION = 1;
+
+struct EphemerisFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t seriesCount;
+    double startDate;           // Julian date (TDB) of the first segment
+    double endDate;
+    double earthMoonRatio;      // Earth / Moon mass, to split the barycentre
+    uint32_t sourceNumber;      // DE number of the source, 0 if unknown
+    uint32_t reserved;
+};
+
+struct EphemerisSeries {
+    uint32_t body;              // JPL body number minus one (0 = Mercury ... 10 = Sun)
+    uint32_t coefficientCount;  // per component
+    double segmentDays;
+    uint64_t segmentCount;
+    uint64_t offset;            // of the first coefficient
+};
@@ -0,0 +1,295 @@
+#include "impact.h"
+#include "../threadpool/threadpool.h"
+#include "../random/random.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+static const double TWO_PI = 6.28318530717958647692;
+static const double DEGREES = 0.017453292519943295769;
+static const uint32_t CLONE_STREAM = 5;
+
+// Lower-triangular L with L L^T = c. Semi-definite matrices are accepted:
+// a direction with no variance gets a zero column.
+static bool choleskyFactor(const double *c, double *l) {
+    std::fill(l, l + 36, 0.0);
+    for (int j = 0; j < 6; ++j) {
+        double sum = c[j * 6 + j];
+        for (int k = 0; k < j; ++k) sum -= l[j * 6 + k] * l[j * 6 + k];
+        if (sum < -1e-12 * std::max(std::fabs(c[j * 6 + j]), 1e-300)) return false;
+        double pivot = sum > 0.0 ? std::sqrt(sum) : 0.0;
+        l[j * 6 + j] = pivot;
+        for (int i = j + 1; i < 6; ++i) {
+            double s = c[i * 6 + j];
+            for (int k = 0; k < j; ++k) s -= l[i * 6 + k] * l[j * 6 + k];
+            l[i * 6 + j] = pivot > 0.0 ? s / pivot : 0.0;
+        }
+    }
+    return true;
+}
+
+// One lane's working set: up to CHUNK clones copied out of the batch into
+// fixed arrays, which the compiler can tell apart, so the loops over clones
+// vectorize.
+struct CloneChunk {
+    static const size_t SIZE = ImpactEngine::CHUNK;
+    double x[SIZE], y[SIZE], z[SIZE], vx[SIZE], vy[SIZE], vz[SIZE], ax[SIZE], ay[SIZE], az[SIZE];
+    double relX[SIZE], relY[SIZE], relZ[SIZE], distance2[SIZE], along[SIZE];
+    size_t n = 0;
+
+    void accelerate(const glm::dvec3 *positions, const std::vector<int> &massive, const std::vector<double> &gm) {
+        for (size_t i = 0; i < n; ++i) ax[i] = ay[i] = az[i] = 0.0;
+        for (int body : massive) {
+            const double bx = positions[body].x, by = positions[body].y, bz = positions[body].z, g = gm[body];
+            for (size_t i = 0; i < n; ++i) {
+                double dx = bx - x[i], dy = by - y[i], dz = bz - z[i];
+                double r2 = dx * dx + dy * dy + dz * dz;
+                double s = g / (r2 * std::sqrt(r2));
+                ax[i] += dx * s;
+                ay[i] += dy * s;
+                az[i] += dz * s;
+            }
+        }
+    }
+
+    // Closest approach to target along the straight line from the previous
+    // relative position to the current one; leaves distance2 and along.
+    void approach(const glm::dvec3 &target) {
+        for (size_t i = 0; i < n; ++i) {
+            double nx = x[i] - target.x, ny = y[i] - target.y, nz = z[i] - target.z;
+            double dx = nx - relX[i], dy = ny - relY[i], dz = nz - relZ[i];
+            double dd = dx * dx + dy * dy + dz * dz;
+            double s = -(relX[i] * dx + relY[i] * dy + relZ[i] * dz) / (dd > DBL_MIN ? dd : DBL_MIN);
+            s = s < 0.0 ? 0.0 : s;
+            along[i] = s > 1.0 ? 1.0 : s;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            double nx = x[i] - target.x, ny = y[i] - target.y, nz = z[i] - target.z;
+            double cx = relX[i] + along[i] * (nx - relX[i]), cy = relY[i] + along[i] * (ny - relY[i]), cz = relZ[i] + along[i] * (nz - relZ[i]);
+            distance2[i] = cx * cx + cy * cy + cz * cz;
+            relX[i] = nx; relY[i] = ny; relZ[i] = nz;
+        }
+    }
+};
+
+ImpactEngine::ImpactEngine(const OrbitPropagator &bodies, const std::vector<double> &bodyGM) : bodies(bodies), bodyGM(bodyGM) {
+    this->bodyGM.resize(bodies.size(), 0.0);
+    for (size_t i = 0; i < bodies.size(); ++i) {
+        if (this->bodyGM[i] > 0.0) massive.push_back((int)i);
+    }
+}
+
+bool ImpactEngine::run(const ImpactCase &nominal, const ImpactSettings &settings, std::ostream *out, ImpactSummary &summary) {
+    summary = ImpactSummary();
+    if (bodies.size() == 0 || bodyGM[0] <= 0.0) {
+        std::cerr << "Impact run needs a central body with mass" << std::endl;
+        return false;
+    }
+    if (settings.target < 0 || (size_t)settings.target >= bodies.size() || settings.step <= 0.0 || settings.duration < 0.0) {
+        std::cerr << "Impact run: bad target or time settings" << std::endl;
+        return false;
+    }
+    double factor[36];
+    if (!choleskyFactor(nominal.covariance, factor)) {
+        std::cerr << "Impact run: covariance is not positive semi-definite" << std::endl;
+        return false;
+    }
+
+    if (out) *out << "clone,a,e,i,node,peri,M,min_distance,min_time\n";
+    const double radius2 = settings.targetRadius * settings.targetRadius;
+    double closest2 = INFINITY;
+    for (size_t first = 0; first < settings.clones; first += BATCH) {
+        const size_t count = std::min(BATCH, settings.clones - first);
+        sample(nominal, factor, settings, first, count);
+        integrate(settings, count);
+
+        std::ostringstream rows;
+        rows.precision(17);
+        for (size_t k = 0; k < count; ++k) {
+            if (!bound[k]) {
+                ++summary.unbound;
+                continue;
+            }
+            ++summary.clones;
+            if (minDistance2[k] < radius2) ++summary.hits;
+            if (minDistance2[k] < closest2) {
+                closest2 = minDistance2[k];
+                summary.closestTime = minTime[k];
+            }
+            if (out) {
+                rows << first + k << ',' << elements[0][k] << ',' << elements[1][k];
+                for (int e = 2; e < 6; ++e) rows << ',' << elements[e][k] / DEGREES;
+                rows << ',' << std::sqrt(minDistance2[k]) << ',' << minTime[k] << '\n';
+            }
+        }
+        if (out) {
+            *out << rows.str();
+            if (!*out) {
+                std::cerr << "Impact run: writing clone results failed" << std::endl;
+                return false;
+            }
+        }
+    }
+    if (summary.clones) {
+        double p = (double)summary.hits / summary.clones;
+        summary.probability = p;
+        summary.standardError = std::sqrt(p * (1.0 - p) / summary.clones);
+        summary.closest = std::sqrt(closest2);
+    }
+    return true;
+}
+
+// Draws clones [first, first + count) and sets up their state at the epoch.
+void ImpactEngine::sample(const ImpactCase &nominal, const double *factor, const ImpactSettings &settings, size_t first, size_t count) {
+    for (std::vector<double> &column : elements) column.resize(count);
+    for (std::vector<double> *column : {&x, &y, &z, &vx, &vy, &vz, &ax, &ay, &az, &relX, &relY, &relZ, &minDistance2, &minTime}) {
+        column->resize(count);
+    }
+    bound.resize(count);
+
+    bodies.propagate(nominal.epoch);
+    const glm::dvec3 target = bodies.position(settings.target);
+    const double centralGM = bodyGM[0];
+    ThreadPool::shared().parallelFor(count, CHUNK, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            // Box-Muller pairs; 1 - u keeps the logarithm finite
+            CounterRng rng(settings.seed, first + k, CLONE_STREAM);
+            double normal[6];
+            for (int j = 0; j < 6; j += 2) {
+                double r = std::sqrt(-2.0 * std::log(1.0 - rng.uniformDouble())), theta = TWO_PI * rng.uniformDouble();
+                normal[j] = r * std::cos(theta);
+                normal[j + 1] = r * std::sin(theta);
+            }
+            double el[6];
+            for (int i = 0; i < 6; ++i) {
+                el[i] = nominal.elements[i];
+                for (int j = 0; j <= i; ++j) el[i] += factor[i * 6 + j] * normal[j];
+                elements[i][k] = el[i];
+            }
+            const double a = el[0], e = el[1];
+            bound[k] = a > 0.0 && e >= 0.0 && e < 1.0;
+            if (!bound[k]) {
+                // integrated along with the rest but never reported
+                x[k] = y[k] = z[k] = vx[k] = vy[k] = vz[k] = 0.0;
+                relX[k] = relY[k] = relZ[k] = minDistance2[k] = minTime[k] = 0.0;
+                continue;
+            }
+
+            // Kepler's equation by Newton from a start that converges for all e < 1
+            double meanAnomaly = std::remainder(el[5], TWO_PI);
+            double E = e < 0.8 ? meanAnomaly : (meanAnomaly < 0.0 ? -M_PI : M_PI);
+            for (int it = 0; it < 30; ++it) {
+                double delta = (E - e * std::sin(E) - meanAnomaly) / (1.0 - e * std::cos(E));
+                E -= delta;
+                if (std::fabs(delta) < 1e-15) break;
+            }
+            glm::dvec3 p, q;
+            perifocalBasis(el[2], el[3], el[4], p, q);
+            const double b = a * std::sqrt(1.0 - e * e), cE = std::cos(E), sE = std::sin(E);
+            const double Edot = std::sqrt(centralGM / (a * a * a)) / (1.0 - e * cE);
+            glm::dvec3 position = p * (a * (cE - e)) + q * (b * sE);
+            glm::dvec3 velocity = p * (-a * sE * Edot) + q * (b * cE * Edot);
+            x[k] = position.x; y[k] = position.y; z[k] = position.z;
+            vx[k] = velocity.x; vy[k] = velocity.y; vz[k] = velocity.z;
+            relX[k] = position.x - target.x; relY[k] = position.y - target.y; relZ[k] = position.z - target.z;
+            minDistance2[k] = glm::dot(position - target, position - target);
+            minTime[k] = nominal.epoch;
+        }
+    });
+    startTime = nominal.epoch;
+}
+
+// Advances the batch from the epoch over the whole duration.
+void ImpactEngine::integrate(const ImpactSettings &settings, size_t count) {
+    const size_t steps = (size_t)std::ceil(settings.duration / settings.step - 1e-9);
+    const double dt = settings.step, half = 0.5 * dt;
+    const size_t bodyCount = bodies.size();
+    for (size_t blockFirst = 0; blockFirst < steps; blockFirst += STEP_BLOCK) {
+        const size_t blockSteps = std::min(STEP_BLOCK, steps - blockFirst);
+        blockPositions.resize((blockSteps + 1) * bodyCount);
+        for (size_t s = 0; s <= blockSteps; ++s) {
+            bodies.propagate(startTime + (double)(blockFirst + s) * dt);
+            std::copy(bodies.allPositions().begin(), bodies.allPositions().end(), blockPositions.begin() + s * bodyCount);
+        }
+
+        ThreadPool::shared().parallelFor(count, CHUNK, [&](size_t begin, size_t end) {
+            CloneChunk chunk;
+            for (size_t first = begin; first < end; first += CHUNK) {
+                const size_t n = chunk.n = std::min(CHUNK, end - first);
+                std::copy_n(&x[first], n, chunk.x); std::copy_n(&y[first], n, chunk.y); std::copy_n(&z[first], n, chunk.z);
+                std::copy_n(&vx[first], n, chunk.vx); std::copy_n(&vy[first], n, chunk.vy); std::copy_n(&vz[first], n, chunk.vz);
+                std::copy_n(&relX[first], n, chunk.relX); std::copy_n(&relY[first], n, chunk.relY); std::copy_n(&relZ[first], n, chunk.relZ);
+                if (blockFirst == 0) {
+                    chunk.accelerate(&blockPositions[0], massive, bodyGM);
+                } else {
+                    std::copy_n(&ax[first], n, chunk.ax); std::copy_n(&ay[first], n, chunk.ay); std::copy_n(&az[first], n, chunk.az);
+                }
+
+                for (size_t s = 1; s <= blockSteps; ++s) {
+                    const glm::dvec3 *positions = &blockPositions[s * bodyCount];
+                    for (size_t i = 0; i < n; ++i) {
+                        chunk.vx[i] += half * chunk.ax[i]; chunk.vy[i] += half * chunk.ay[i]; chunk.vz[i] += half * chunk.az[i];
+                        chunk.x[i] += dt * chunk.vx[i]; chunk.y[i] += dt * chunk.vy[i]; chunk.z[i] += dt * chunk.vz[i];
+                    }
+                    chunk.accelerate(positions, massive, bodyGM);
+                    for (size_t i = 0; i < n; ++i) {
+                        chunk.vx[i] += half * chunk.ax[i]; chunk.vy[i] += half * chunk.ay[i]; chunk.vz[i] += half * chunk.az[i];
+                    }
+
+                    chunk.approach(positions[settings.target]);
+                    const double stepStart = startTime + (double)(blockFirst + s - 1) * dt;
+                    for (size_t i = 0; i < n; ++i) {
+                        if (chunk.distance2[i] < minDistance2[first + i]) {
+                            minDistance2[first + i] = chunk.distance2[i];
+                            minTime[first + i] = stepStart + chunk.along[i] * dt;
+                        }
+                    }
+                }
+
+                std::copy_n(chunk.x, n, &x[first]); std::copy_n(chunk.y, n, &y[first]); std::copy_n(chunk.z, n, &z[first]);
+                std::copy_n(chunk.vx, n, &vx[first]); std::copy_n(chunk.vy, n, &vy[first]); std::copy_n(chunk.vz, n, &vz[first]);
+                std::copy_n(chunk.ax, n, &ax[first]); std::copy_n(chunk.ay, n, &ay[first]); std::copy_n(chunk.az, n, &az[first]);
+                std::copy_n(chunk.relX, n, &relX[first]); std::copy_n(chunk.relY, n, &relY[first]); std::copy_n(chunk.relZ, n, &relZ[first]);
+            }
+        });
+    }
+}
+
+bool loadImpactCase(const std::string &path, ImpactCase &out) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open impact case " << path << std::endl;
+        return false;
+    }
+    std::vector<double> values;
+    std::string line;
+    while (std::getline(in, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string token;
+        while (fields >> token) {
+            char *end = nullptr;
+            double value = strtod(token.c_str(), &end);
+            if (*end) {
+                std::cerr << "Impact case " << path << ": not a number: " << token << std::endl;
+                return false;
+            }
+            values.push_back(value);
+        }
+    }
+    if (values.size() != 43) {
+        std::cerr << "Impact case " << path << ": expected 7 element values and 36 covariance entries, found " << values.size() << std::endl;
+        return false;
+    }
+    // angles to radians, covariance entries scaled by both of their factors
+    double scale[6] = {1.0, 1.0, DEGREES, DEGREES, DEGREES, DEGREES};
+    for (int i = 0; i < 6; ++i) out.elements[i] = values[i] * scale[i];
+    out.epoch = values[6];
+    for (int i = 0; i < 6; ++i) {
+        for (int j = 0; j < 6; ++j) out.covariance[i * 6 + j] = values[7 + i * 6 + j] * scale[i] * scale[j];
+    }
+    return true;
+}
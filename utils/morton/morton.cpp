@@ -0,0 +1,46 @@
+#include "morton.h"
+#include <algorithm>
+
+// spreads the low 10 bits of v so two zero bits follow each one
+static uint32_t spreadBits(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+uint32_t mortonCode(const glm::vec3 &p, const glm::vec3 &low, const glm::vec3 &high) {
+    glm::vec3 extent = glm::max(high - low, glm::vec3(1e-20f));
+    glm::vec3 cell = glm::clamp((p - low) / extent * 1024.0f, glm::vec3(0.0f), glm::vec3(1023.0f));
+    return spreadBits((uint32_t)cell.x) | (spreadBits((uint32_t)cell.y) << 1) | (spreadBits((uint32_t)cell.z) << 2);
+}
+
+void mortonOrder(const glm::vec3 *points, size_t count, std::vector<uint32_t> &order) {
+    order.resize(count);
+    if (count == 0) return;
+    glm::vec3 low = points[0], high = points[0];
+    for (size_t i = 1; i < count; ++i) {
+        low = glm::min(low, points[i]);
+        high = glm::max(high, points[i]);
+    }
+    std::vector<uint32_t> codes(count), codeScratch(count), orderScratch(count);
+    for (size_t i = 0; i < count; ++i) {
+        codes[i] = mortonCode(points[i], low, high);
+        order[i] = (uint32_t)i;
+    }
+    // three passes of 10 bits
+    for (int shift = 0; shift < 30; shift += 10) {
+        size_t histogram[1025] = {};
+        for (size_t i = 0; i < count; ++i) ++histogram[((codes[i] >> shift) & 0x3ff) + 1];
+        for (int digit = 0; digit < 1024; ++digit) histogram[digit + 1] += histogram[digit];
+        for (size_t i = 0; i < count; ++i) {
+            size_t slot = histogram[(codes[i] >> shift) & 0x3ff]++;
+            codeScratch[slot] = codes[i];
+            orderScratch[slot] = order[i];
+        }
+        codes.swap(codeScratch);
+        order.swap(orderScratch);
+    }
+}
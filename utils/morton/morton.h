@@ -0,0 +1,15 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+
+// 30-bit Morton (Z-order) code of p quantized to 1024 cells per axis of the
+// box [low, high]; points outside are clamped to it.
+uint32_t mortonCode(const glm::vec3 &p, const glm::vec3 &low, const glm::vec3 &high);
+
+// Permutation listing the points in Morton order over their bounding box:
+// order[k] is the index of the k-th point. The LSD radix sort is stable, so
+// points sharing a cell keep their relative order and re-sorting a set that
+// has barely moved leaves it almost untouched.
+void mortonOrder(const glm::vec3 *points, size_t count, std::vector<uint32_t> &order);
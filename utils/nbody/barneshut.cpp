@@ -0,0 +1,322 @@
+#include "barneshut.h"
+#include "../threadpool/threadpool.h"
+#include <algorithm>
+#include <cmath>
+
+static const size_t LEAF_SIZE = 16;
+static const int MAX_LEVEL = 21;           // 21 bits per axis in a 63-bit key
+static const size_t SORT_CHUNK = 1 << 14;
+
+// spreads the low 21 bits of v so that they occupy every third bit
+static uint64_t spreadBits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2)  & 0x1249249249249249ULL;
+    return v;
+}
+
+static int octantAt(uint64_t key, int level) {
+    return (int)((key >> (3 * (MAX_LEVEL - 1 - level))) & 7);
+}
+
+void BarnesHutTree::build(const double *x, const double *y, const double *z, const double *gm, size_t n) {
+    nodes.clear();
+    subtrees.clear();
+    if (n == 0) return;
+
+    sortByMorton(x, y, z, gm, n);
+
+    // Build the top levels serially and the subtrees below them in parallel,
+    // then splice everything into one depth-first array.
+    ThreadPool &pool = ThreadPool::shared();
+    int splitLevels = 1;
+    while (splitLevels < 3 && (size_t(1) << (3 * splitLevels)) < pool.lanes() * 8) ++splitLevels;
+    collectSubtrees(0, n, 0, splitLevels);
+    pool.parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Subtree &st = subtrees[i];
+            st.nodes.clear();
+            buildRange(st.nodes, st.begin, st.end, st.level);
+        }
+    });
+    size_t cursor = 0;
+    emitTop(0, n, 0, splitLevels, cursor);
+
+    leaves.clear();
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].leaf) leaves.push_back(i);
+    }
+}
+
+void BarnesHutTree::sortByMorton(const double *x, const double *y, const double *z, const double *gm, size_t n) {
+    ThreadPool &pool = ThreadPool::shared();
+
+    double lo[3] = {x[0], y[0], z[0]}, hi[3] = {x[0], y[0], z[0]};
+    for (size_t i = 1; i < n; ++i) {
+        lo[0] = std::min(lo[0], x[i]); hi[0] = std::max(hi[0], x[i]);
+        lo[1] = std::min(lo[1], y[i]); hi[1] = std::max(hi[1], y[i]);
+        lo[2] = std::min(lo[2], z[i]); hi[2] = std::max(hi[2], z[i]);
+    }
+    boxSize = std::max({hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2], 1e-9}) * 1.0001;
+    for (int a = 0; a < 3; ++a) boxMin[a] = lo[a];
+
+    struct KeyIndex { uint64_t key; uint32_t index; };
+    std::vector<KeyIndex> pairs(n), scratch(n);
+    const double scale = double(1 << MAX_LEVEL) / boxSize;
+    pool.parallelFor(n, SORT_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t qx = (uint64_t)std::min((x[i] - boxMin[0]) * scale, double((1 << MAX_LEVEL) - 1));
+            uint64_t qy = (uint64_t)std::min((y[i] - boxMin[1]) * scale, double((1 << MAX_LEVEL) - 1));
+            uint64_t qz = (uint64_t)std::min((z[i] - boxMin[2]) * scale, double((1 << MAX_LEVEL) - 1));
+            pairs[i] = {spreadBits(qx) << 2 | spreadBits(qy) << 1 | spreadBits(qz), (uint32_t)i};
+        }
+    });
+
+    // sort fixed-size runs in parallel, then merge runs pairwise
+    auto byKey = [](const KeyIndex &a, const KeyIndex &b) { return a.key < b.key; };
+    const size_t runs = (n + SORT_CHUNK - 1) / SORT_CHUNK;
+    pool.parallelFor(runs, 1, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; ++r) {
+            std::sort(pairs.begin() + r * SORT_CHUNK, pairs.begin() + std::min(n, (r + 1) * SORT_CHUNK), byKey);
+        }
+    });
+    for (size_t width = SORT_CHUNK; width < n; width *= 2) {
+        size_t merges = (n + 2 * width - 1) / (2 * width);
+        pool.parallelFor(merges, 1, [&](size_t begin, size_t end) {
+            for (size_t m = begin; m < end; ++m) {
+                size_t lo = m * 2 * width, mid = std::min(n, lo + width), hi = std::min(n, lo + 2 * width);
+                std::merge(pairs.begin() + lo, pairs.begin() + mid, pairs.begin() + mid, pairs.begin() + hi,
+                           scratch.begin() + lo, byKey);
+            }
+        });
+        pairs.swap(scratch);
+    }
+
+    keys.resize(n); order.resize(n);
+    sx.resize(n); sy.resize(n); sz.resize(n); sgm.resize(n);
+    pool.parallelFor(n, SORT_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t src = pairs[i].index;
+            keys[i] = pairs[i].key;
+            order[i] = src;
+            sx[i] = x[src]; sy[i] = y[src]; sz[i] = z[src]; sgm[i] = gm[src];
+        }
+    });
+}
+
+// first index in [begin, end) whose octant at `level` is >= octant
+size_t BarnesHutTree::splitChild(size_t begin, size_t end, int level, int octant) const {
+    return std::partition_point(keys.begin() + begin, keys.begin() + end,
+                                [&](uint64_t k) { return octantAt(k, level) < octant; }) - keys.begin();
+}
+
+void BarnesHutTree::buildRange(std::vector<Node> &out, size_t begin, size_t end, int level) const {
+    size_t self = out.size();
+    out.push_back(Node());
+    Node node = Node();
+    node.size = boxSize / double(uint64_t(1) << level);
+
+    if (end - begin <= LEAF_SIZE || level >= MAX_LEVEL) {
+        node.leaf = true;
+        node.bodyBegin = (uint32_t)begin;
+        node.bodyEnd = (uint32_t)end;
+        for (size_t i = begin; i < end; ++i) {
+            node.gm += sgm[i];
+            node.comX += sgm[i] * sx[i]; node.comY += sgm[i] * sy[i]; node.comZ += sgm[i] * sz[i];
+        }
+    } else {
+        node.leaf = false;
+        size_t childBegin = begin;
+        for (int oct = 0; oct < 8; ++oct) {
+            size_t childEnd = oct == 7 ? end : splitChild(childBegin, end, level, oct + 1);
+            if (childEnd > childBegin) {
+                size_t child = out.size();
+                buildRange(out, childBegin, childEnd, level + 1);
+                const Node &c = out[child];
+                node.gm += c.gm;
+                node.comX += c.gm * c.comX; node.comY += c.gm * c.comY; node.comZ += c.gm * c.comZ;
+            }
+            childBegin = childEnd;
+        }
+    }
+    if (node.gm > 0.0) { node.comX /= node.gm; node.comY /= node.gm; node.comZ /= node.gm; }
+    node.next = (uint32_t)out.size();
+    out[self] = node;
+}
+
+void BarnesHutTree::collectSubtrees(size_t begin, size_t end, int level, int splitLevels) {
+    if (splitLevels == 0 || end - begin <= LEAF_SIZE || level >= MAX_LEVEL) {
+        subtrees.push_back({begin, end, level, {}});
+        return;
+    }
+    size_t childBegin = begin;
+    for (int oct = 0; oct < 8; ++oct) {
+        size_t childEnd = oct == 7 ? end : splitChild(childBegin, end, level, oct + 1);
+        if (childEnd > childBegin) collectSubtrees(childBegin, childEnd, level + 1, splitLevels - 1);
+        childBegin = childEnd;
+    }
+}
+
+// Mirrors collectSubtrees(), appending top-level nodes and splicing the
+// prebuilt subtrees in depth-first order.
+uint32_t BarnesHutTree::emitTop(size_t begin, size_t end, int level, int splitLevels, size_t &cursor) {
+    uint32_t self = (uint32_t)nodes.size();
+    if (splitLevels == 0 || end - begin <= LEAF_SIZE || level >= MAX_LEVEL) {
+        const std::vector<Node> &local = subtrees[cursor++].nodes;
+        for (Node n : local) {
+            n.next += self;
+            nodes.push_back(n);
+        }
+        return self;
+    }
+    nodes.push_back(Node());
+    Node node = Node();
+    node.size = boxSize / double(uint64_t(1) << level);
+    node.leaf = false;
+    size_t childBegin = begin;
+    for (int oct = 0; oct < 8; ++oct) {
+        size_t childEnd = oct == 7 ? end : splitChild(childBegin, end, level, oct + 1);
+        if (childEnd > childBegin) {
+            const Node &c = nodes[emitTop(childBegin, childEnd, level + 1, splitLevels - 1, cursor)];
+            node.gm += c.gm;
+            node.comX += c.gm * c.comX; node.comY += c.gm * c.comY; node.comZ += c.gm * c.comZ;
+        }
+        childBegin = childEnd;
+    }
+    if (node.gm > 0.0) { node.comX /= node.gm; node.comY /= node.gm; node.comZ /= node.gm; }
+    node.next = (uint32_t)nodes.size();
+    nodes[self] = node;
+    return self;
+}
+
+// Calls visit(dx, dy, dz, gm) for every source or accepted cell seen from p.
+template <typename Visit>
+void BarnesHutTree::walk(double px, double py, double pz, Visit visit) const {
+    const double theta2 = theta * theta;
+    const uint32_t count = (uint32_t)nodes.size();
+    uint32_t i = 0;
+    while (i < count) {
+        const Node &node = nodes[i];
+        if (node.leaf) {
+            for (uint32_t b = node.bodyBegin; b < node.bodyEnd; ++b) {
+                double dx = sx[b] - px, dy = sy[b] - py, dz = sz[b] - pz;
+                if (dx == 0.0 && dy == 0.0 && dz == 0.0) continue;
+                visit(dx, dy, dz, sgm[b]);
+            }
+            i = node.next;
+            continue;
+        }
+        double dx = node.comX - px, dy = node.comY - py, dz = node.comZ - pz;
+        double d2 = dx * dx + dy * dy + dz * dz;
+        if (node.size * node.size < theta2 * d2) {
+            visit(dx, dy, dz, node.gm);
+            i = node.next;
+        } else {
+            i = i + 1;  // descend: first child follows its parent
+        }
+    }
+}
+
+void BarnesHutTree::addAccelerations(const double *x, const double *y, const double *z,
+                                     double *ax, double *ay, double *az, size_t begin, size_t end) const {
+    const double eps2 = softening * softening;
+    for (size_t i = begin; i < end; ++i) {
+        double sumX = 0.0, sumY = 0.0, sumZ = 0.0;
+        walk(x[i], y[i], z[i], [&](double dx, double dy, double dz, double gm) {
+            double r2 = dx * dx + dy * dy + dz * dz + eps2;
+            double inv = gm / (r2 * std::sqrt(r2));
+            sumX += dx * inv; sumY += dy * inv; sumZ += dz * inv;
+        });
+        ax[i] += sumX; ay[i] += sumY; az[i] += sumZ;
+    }
+}
+
+void BarnesHutTree::addSourceAccelerations(double *ax, double *ay, double *az, size_t begin, size_t end) const {
+    const double theta2 = theta * theta;
+    const double eps2 = softening * softening;
+    const uint32_t count = (uint32_t)nodes.size();
+    // interaction list: accepted cells and bodies of opened leaves, stored in
+    // single precision relative to the group's corner; the opening angle
+    // already limits accuracy far below float round-off
+    std::vector<float> lx, ly, lz, lgm;
+
+    for (size_t l = begin; l < end; ++l) {
+        const Node &group = nodes[leaves[l]];
+        double lo[3] = {sx[group.bodyBegin], sy[group.bodyBegin], sz[group.bodyBegin]};
+        double hi[3] = {lo[0], lo[1], lo[2]};
+        for (uint32_t b = group.bodyBegin + 1; b < group.bodyEnd; ++b) {
+            lo[0] = std::min(lo[0], sx[b]); hi[0] = std::max(hi[0], sx[b]);
+            lo[1] = std::min(lo[1], sy[b]); hi[1] = std::max(hi[1], sy[b]);
+            lo[2] = std::min(lo[2], sz[b]); hi[2] = std::max(hi[2], sz[b]);
+        }
+
+        lx.clear(); ly.clear(); lz.clear(); lgm.clear();
+        uint32_t i = 0;
+        while (i < count) {
+            const Node &node = nodes[i];
+            if (node.leaf) {
+                for (uint32_t b = node.bodyBegin; b < node.bodyEnd; ++b) {
+                    lx.push_back(float(sx[b] - lo[0])); ly.push_back(float(sy[b] - lo[1])); lz.push_back(float(sz[b] - lo[2]));
+                    lgm.push_back(float(sgm[b]));
+                }
+                i = node.next;
+                continue;
+            }
+            // distance from the cell's centre of mass to the group's box
+            double dx = std::max({lo[0] - node.comX, 0.0, node.comX - hi[0]});
+            double dy = std::max({lo[1] - node.comY, 0.0, node.comY - hi[1]});
+            double dz = std::max({lo[2] - node.comZ, 0.0, node.comZ - hi[2]});
+            if (node.size * node.size < theta2 * (dx * dx + dy * dy + dz * dz)) {
+                lx.push_back(float(node.comX - lo[0])); ly.push_back(float(node.comY - lo[1])); lz.push_back(float(node.comZ - lo[2]));
+                lgm.push_back(float(node.gm));
+                i = node.next;
+            } else {
+                i = i + 1;
+            }
+        }
+
+        // bodies in the inner loop so each lane accumulates its own sum; a
+        // leaf at MAX_LEVEL can hold more than LEAF_SIZE coincident bodies,
+        // so the group goes through in slices that fit the scratch arrays
+        const size_t listSize = lgm.size();
+        const uint32_t groupSize = group.bodyEnd - group.bodyBegin;
+        const float eps2f = (float)eps2;
+        for (uint32_t first = 0; first < groupSize; first += (uint32_t)LEAF_SIZE) {
+            const uint32_t sliceBegin = group.bodyBegin + first;
+            const uint32_t sliceSize = std::min<uint32_t>((uint32_t)LEAF_SIZE, groupSize - first);
+            float gx[LEAF_SIZE], gy[LEAF_SIZE], gz[LEAF_SIZE];
+            float sumX[LEAF_SIZE] = {}, sumY[LEAF_SIZE] = {}, sumZ[LEAF_SIZE] = {};
+            for (uint32_t b = 0; b < sliceSize; ++b) {
+                gx[b] = float(sx[sliceBegin + b] - lo[0]);
+                gy[b] = float(sy[sliceBegin + b] - lo[1]);
+                gz[b] = float(sz[sliceBegin + b] - lo[2]);
+            }
+            for (size_t k = 0; k < listSize; ++k) {
+                const float qx = lx[k], qy = ly[k], qz = lz[k], qgm = lgm[k];
+                for (uint32_t b = 0; b < sliceSize; ++b) {
+                    float dx = qx - gx[b], dy = qy - gy[b], dz = qz - gz[b];
+                    // the body itself is in the list; dx = 0 makes its term vanish
+                    float r2 = dx * dx + dy * dy + dz * dz + eps2f;
+                    float inv = qgm / (r2 * std::sqrt(r2));
+                    sumX[b] += dx * inv; sumY[b] += dy * inv; sumZ[b] += dz * inv;
+                }
+            }
+            for (uint32_t b = 0; b < sliceSize; ++b) {
+                uint32_t target = order[sliceBegin + b];
+                ax[target] += sumX[b]; ay[target] += sumY[b]; az[target] += sumZ[b];
+            }
+        }
+    }
+}
+
+double BarnesHutTree::potential(double px, double py, double pz) const {
+    const double eps2 = softening * softening;
+    double phi = 0.0;
+    walk(px, py, pz, [&](double dx, double dy, double dz, double gm) {
+        phi -= gm / std::sqrt(dx * dx + dy * dy + dz * dz + eps2);
+    });
+    return phi;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Barnes-Hut octree over a set of point masses. Bodies are sorted by 63-bit
+// Morton key and the tree is stored as one flat depth-first node array: a
+// node's first child directly follows it and `next` skips its subtree, so a
+// force walk needs no stack and touches memory mostly in order.
+class BarnesHutTree {
+public:
+    // Rebuilds the tree over n sources (gm = G*m). Pointers must stay valid
+    // only for the duration of the call; positions are copied in sorted order.
+    void build(const double *x, const double *y, const double *z, const double *gm, size_t n);
+
+    size_t size() const { return order.size(); }
+
+    // Adds the tree's pull to targets [begin, end) of ax/ay/az. Sources that
+    // coincide with a target are skipped.
+    void addAccelerations(const double *x, const double *y, const double *z,
+                          double *ax, double *ay, double *az, size_t begin, size_t end) const;
+
+    // Same for the sources themselves, one walk per leaf [begin, end) of
+    // leafCount(): the leaf's bodies share a single interaction list built
+    // against the leaf's bounding box, then sum it in a tight loop. Results
+    // go to the sources' original indices.
+    size_t leafCount() const { return leaves.size(); }
+    void addSourceAccelerations(double *ax, double *ay, double *az, size_t begin, size_t end) const;
+
+    // Gravitational potential at one point (scaled by G), same approximation.
+    double potential(double px, double py, double pz) const;
+
+    double theta = 0.5;         // opening angle: a cell is used whole when size/distance < theta
+    double softening = 1e-3;
+
+private:
+    struct Node {
+        double comX, comY, comZ, gm;    // monopole
+        double size;                    // cell edge length
+        uint32_t next;                  // index after this node's subtree
+        uint32_t bodyBegin, bodyEnd;    // range in sorted order, leaves only
+        bool leaf;
+    };
+    struct Subtree {
+        size_t begin, end;
+        int level;
+        std::vector<Node> nodes;
+    };
+
+    void sortByMorton(const double *x, const double *y, const double *z, const double *gm, size_t n);
+    void buildRange(std::vector<Node> &out, size_t begin, size_t end, int level) const;
+    void collectSubtrees(size_t begin, size_t end, int level, int splitLevels);
+    size_t splitChild(size_t begin, size_t end, int level, int octant) const;
+    uint32_t emitTop(size_t begin, size_t end, int level, int splitLevels, size_t &subtreeCursor);
+    template <typename Visit> void walk(double px, double py, double pz, Visit visit) const;
+
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<double> sx, sy, sz, sgm;    // sources in Morton order
+    double boxMin[3] = {0.0, 0.0, 0.0};
+    double boxSize = 1.0;
+
+    std::vector<Subtree> subtrees;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> leaves;
+};
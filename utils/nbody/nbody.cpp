@@ -0,0 +1,320 @@
+#include "nbody.h"
+#include "../threadpool/threadpool.h"
+#include <cmath>
+#include <algorithm>
+
+// Yoshida 4th-order coefficients: three leapfrog substeps of w1, w0, w1
+static const double CBRT2 = 1.25992104989487316477;
+static const double W1 = 1.0 / (2.0 - CBRT2);
+static const double W0 = -CBRT2 / (2.0 - CBRT2);
+
+static const size_t FORCE_CHUNK = 256;
+static const double TWO_PI = 6.28318530717958647692;
+
+void NBodySystem::clear() {
+    x.clear(); y.clear(); z.clear();
+    vx.clear(); vy.clear(); vz.clear();
+    ax.clear(); ay.clear(); az.clear();
+    gm.clear();
+    majors = 0;
+    hasInitialEnergy = false;
+    accelerationsCurrent = false;
+}
+
+int NBodySystem::addMassive(const glm::dvec3 &p, const glm::dvec3 &v, double mu) {
+    if (majors != x.size()) return -1;      // later groups already started
+    ++majors;
+    gm.push_back(mu);
+    return addTestParticle(p, v);
+}
+
+int NBodySystem::addMinor(const glm::dvec3 &p, const glm::dvec3 &v, double mu) {
+    if (gm.size() != x.size()) return -1;   // test particles already added
+    gm.push_back(mu);
+    return addTestParticle(p, v);
+}
+
+int NBodySystem::addTestParticle(const glm::dvec3 &p, const glm::dvec3 &v) {
+    x.push_back(p.x); y.push_back(p.y); z.push_back(p.z);
+    vx.push_back(v.x); vy.push_back(v.y); vz.push_back(v.z);
+    ax.push_back(0.0); ay.push_back(0.0); az.push_back(0.0);
+    hasInitialEnergy = false;
+    accelerationsCurrent = false;
+    return (int)x.size() - 1;
+}
+
+void NBodySystem::step(double dt) {
+    if (dt == 0.0 || x.empty()) return;
+    if (!hasInitialEnergy) {
+        initialEnergy = energy();
+        hasInitialEnergy = true;
+    }
+    forceEvaluationCount = 0;
+    if (stepping == Stepping::Block) {
+        blockStep(dt);
+        lastForceEvaluations = forceEvaluationCount;
+        return;
+    }
+    drift(0.5 * W1 * dt);
+    kick(W1 * dt);
+    drift(0.5 * (W0 + W1) * dt);
+    kick(W0 * dt);
+    drift(0.5 * (W0 + W1) * dt);
+    kick(W1 * dt);
+    drift(0.5 * W1 * dt);
+    accelerationsCurrent = false;
+    lastForceEvaluations = forceEvaluationCount;
+}
+
+// Hierarchical block steps over one macro step dt, split into 2^top substeps.
+// A body on level L steps every 2^(top - L) substeps with kick-drift-kick;
+// positions are drifted lazily, only when a body is needed as a source or a
+// target. Levels are re-chosen at the end of each body's step and may only
+// coarsen at substeps where the coarser step is also aligned.
+void NBodySystem::blockStep(double dt) {
+    const size_t n = x.size();
+    const size_t massive = gm.size();
+    const bool useTree = solver == Solver::BarnesHut && massive > majors;
+    ThreadPool &pool = ThreadPool::shared();
+
+    if (!accelerationsCurrent) {
+        computeAccelerations();
+        accelerationsCurrent = true;
+    }
+    blockLevel.resize(n);
+    blockTick.assign(n, 0);
+    pool.parallelFor(n, FORCE_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) blockLevel[i] = chooseLevel(i, dt);
+    });
+    const int top = n ? *std::max_element(blockLevel.begin(), blockLevel.end()) : 0;
+    levelBodies.assign(top + 1, {});
+    for (size_t i = 0; i < n; ++i) levelBodies[blockLevel[i]].push_back((uint32_t)i);
+
+    const uint32_t ticks = 1u << top;
+    const double tick = dt / ticks;
+    auto span = [&](int level) { return 1u << (top - level); };
+    // levels [lowestActive(t), top] have a step boundary at substep t
+    auto lowestActive = [&](uint32_t t) { return t % ticks == 0 ? 0 : top - __builtin_ctz(t); };
+    auto driftTo = [&](size_t i, uint32_t t) {
+        double h = (double)(t - blockTick[i]) * tick;
+        x[i] += vx[i] * h; y[i] += vy[i] * h; z[i] += vz[i] * h;
+        blockTick[i] = t;
+    };
+    auto halfKick = [&](size_t i, int level) {
+        double h = 0.5 * span(level) * tick;
+        vx[i] += ax[i] * h; vy[i] += ay[i] * h; vz[i] += az[i] * h;
+    };
+
+    for (uint32_t t = 0; t < ticks; ++t) {
+        for (int level = lowestActive(t); level <= top; ++level) {
+            for (uint32_t i : levelBodies[level]) halfKick(i, level);
+        }
+
+        const uint32_t next = t + 1;
+        const int low = lowestActive(next);
+        activeBodies.clear();
+        bool minorActive = false;
+        for (int level = low; level <= top; ++level) {
+            for (uint32_t i : levelBodies[level]) {
+                activeBodies.push_back(i);
+                minorActive |= i >= majors && i < massive;
+            }
+        }
+
+        // sources first: the majors always, and the minors whenever the tree
+        // is rebuilt. Between rebuilds the tree lags by at most one step of
+        // the finest active minor, whose pull on the rest is tiny by design.
+        for (size_t j = 0; j < majors; ++j) driftTo(j, next);
+        if (useTree && minorActive) {
+            pool.parallelFor(massive - majors, FORCE_CHUNK, [&](size_t begin, size_t end) {
+                for (size_t j = majors + begin; j < majors + end; ++j) driftTo(j, next);
+            });
+        }
+        for (uint32_t i : activeBodies) driftTo(i, next);
+        computeAccelerations(activeBodies, minorActive || !tree.size());
+
+        for (int level = low; level <= top; ++level) {
+            for (uint32_t i : levelBodies[level]) halfKick(i, level);
+        }
+        if (next == ticks) break;
+
+        pool.parallelFor(activeBodies.size(), FORCE_CHUNK, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                uint32_t i = activeBodies[k];
+                int level = blockLevel[i];
+                int wanted = std::min(chooseLevel(i, dt), top);
+                if (wanted > level) level = wanted;
+                while (wanted < level && next % span(level - 1) == 0) --level;
+                blockLevel[i] = level;
+            }
+        });
+        for (int level = low; level <= top; ++level) levelBodies[level].clear();
+        for (uint32_t i : activeBodies) levelBodies[blockLevel[i]].push_back(i);
+    }
+    // every level ends at the last substep, so all bodies are synchronised
+    accelerationsCurrent = true;
+}
+
+// Level whose step resolves the body's shortest orbital period about any
+// major body, including its own mass for a two-body orbit.
+int NBodySystem::chooseLevel(size_t i, double dt) const {
+    const double eps2 = softening * softening;
+    const double own = i < gm.size() ? gm[i] : 0.0;
+    double shortest = HUGE_VAL;
+    for (size_t j = 0; j < majors; ++j) {
+        if (j == i) continue;
+        double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+        double r2 = dx * dx + dy * dy + dz * dz + eps2;
+        shortest = std::min(shortest, r2 * std::sqrt(r2) / (gm[j] + own));
+    }
+    if (!(shortest < HUGE_VAL)) return 0;
+    double wanted = blockAccuracy * TWO_PI * std::sqrt(shortest);
+    double ratio = std::fabs(dt) / wanted;
+    if (ratio <= 1.0) return 0;
+    return std::min(maxBlockLevel, (int)std::ceil(std::log2(ratio)));
+}
+
+void NBodySystem::drift(double dt) {
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; ++i) {
+        x[i] += vx[i] * dt;
+        y[i] += vy[i] * dt;
+        z[i] += vz[i] * dt;
+    }
+}
+
+void NBodySystem::kick(double dt) {
+    computeAccelerations();
+    const size_t n = x.size();
+    for (size_t i = 0; i < n; ++i) {
+        vx[i] += ax[i] * dt;
+        vy[i] += ay[i] * dt;
+        vz[i] += az[i] * dt;
+    }
+}
+
+void NBodySystem::computeAccelerations() {
+    const size_t n = x.size();
+    const size_t massive = gm.size();
+    const bool useTree = solver == Solver::BarnesHut && massive > majors;
+    const size_t directEnd = useTree ? majors : massive;
+    const double eps2 = softening * softening;
+    ThreadPool &pool = ThreadPool::shared();
+    forceEvaluationCount += n;
+
+    pool.parallelFor(n, FORCE_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            double axi = 0.0, ayi = 0.0, azi = 0.0;
+            for (size_t j = 0; j < directEnd; ++j) {
+                double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+                double r2 = dx * dx + dy * dy + dz * dz + eps2;
+                // self term has dx = dy = dz = 0 and contributes nothing
+                double inv = gm[j] / (r2 * std::sqrt(r2));
+                axi += dx * inv; ayi += dy * inv; azi += dz * inv;
+            }
+            ax[i] = axi; ay[i] = ayi; az[i] = azi;
+        }
+    });
+    if (!useTree) return;
+
+    tree.theta = openingAngle;
+    tree.softening = softening;
+    tree.build(&x[majors], &y[majors], &z[majors], &gm[majors], massive - majors);
+    // minor bodies walk leaf by leaf in Morton order; results land at their own indices
+    pool.parallelFor(tree.leafCount(), 4, [&](size_t begin, size_t end) {
+        tree.addSourceAccelerations(&ax[majors], &ay[majors], &az[majors], begin, end);
+    });
+    pool.parallelFor(majors, FORCE_CHUNK, [&](size_t begin, size_t end) {
+        tree.addAccelerations(x.data(), y.data(), z.data(), ax.data(), ay.data(), az.data(), begin, end);
+    });
+    pool.parallelFor(n - massive, FORCE_CHUNK, [&](size_t begin, size_t end) {
+        tree.addAccelerations(x.data(), y.data(), z.data(), ax.data(), ay.data(), az.data(), massive + begin, massive + end);
+    });
+}
+
+// Accelerations for a subset of bodies only. Tree targets are gathered into
+// contiguous arrays so the walk runs over a dense range.
+void NBodySystem::computeAccelerations(const std::vector<uint32_t> &targets, bool rebuildTree) {
+    const size_t count = targets.size();
+    const size_t massive = gm.size();
+    const bool useTree = solver == Solver::BarnesHut && massive > majors;
+    const size_t directEnd = useTree ? majors : massive;
+    const double eps2 = softening * softening;
+    ThreadPool &pool = ThreadPool::shared();
+    forceEvaluationCount += count;
+
+    pool.parallelFor(count, FORCE_CHUNK, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            const size_t i = targets[k];
+            double axi = 0.0, ayi = 0.0, azi = 0.0;
+            for (size_t j = 0; j < directEnd; ++j) {
+                double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+                double r2 = dx * dx + dy * dy + dz * dz + eps2;
+                double inv = gm[j] / (r2 * std::sqrt(r2));
+                axi += dx * inv; ayi += dy * inv; azi += dz * inv;
+            }
+            ax[i] = axi; ay[i] = ayi; az[i] = azi;
+        }
+    });
+    if (!useTree) return;
+
+    if (rebuildTree) {
+        tree.theta = openingAngle;
+        tree.softening = softening;
+        tree.build(&x[majors], &y[majors], &z[majors], &gm[majors], massive - majors);
+    }
+    tx.resize(count); ty.resize(count); tz.resize(count);
+    tax.assign(count, 0.0); tay.assign(count, 0.0); taz.assign(count, 0.0);
+    for (size_t k = 0; k < count; ++k) {
+        tx[k] = x[targets[k]]; ty[k] = y[targets[k]]; tz[k] = z[targets[k]];
+    }
+    pool.parallelFor(count, FORCE_CHUNK, [&](size_t begin, size_t end) {
+        tree.addAccelerations(tx.data(), ty.data(), tz.data(), tax.data(), tay.data(), taz.data(), begin, end);
+    });
+    for (size_t k = 0; k < count; ++k) {
+        ax[targets[k]] += tax[k]; ay[targets[k]] += tay[k]; az[targets[k]] += taz[k];
+    }
+}
+
+double NBodySystem::energy() const {
+    const size_t massive = gm.size();
+    const bool useTree = solver == Solver::BarnesHut && massive > majors;
+    const double eps2 = softening * softening;
+    auto pairPotential = [&](size_t i, size_t j) {
+        double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+        return -gm[i] * gm[j] / std::sqrt(dx * dx + dy * dy + dz * dz + eps2);
+    };
+
+    double kinetic = 0.0, potential = 0.0;
+    for (size_t i = 0; i < massive; ++i) {
+        kinetic += 0.5 * gm[i] * (vx[i] * vx[i] + vy[i] * vy[i] + vz[i] * vz[i]);
+    }
+    for (size_t i = 0; i < majors; ++i) {
+        for (size_t j = i + 1; j < massive; ++j) potential += pairPotential(i, j);
+    }
+    if (useTree) {
+        potentialTree.theta = openingAngle;
+        potentialTree.softening = softening;
+        potentialTree.build(&x[majors], &y[majors], &z[majors], &gm[majors], massive - majors);
+        const size_t minors = massive - majors;
+        std::vector<double> partial((minors + FORCE_CHUNK - 1) / FORCE_CHUNK, 0.0);
+        ThreadPool::shared().parallelFor(minors, FORCE_CHUNK, [&](size_t begin, size_t end) {
+            double sum = 0.0;
+            for (size_t i = majors + begin; i < majors + end; ++i) sum += gm[i] * potentialTree.potential(x[i], y[i], z[i]);
+            partial[begin / FORCE_CHUNK] = sum;     // chunks are at least FORCE_CHUNK long
+        });
+        double minor = 0.0;
+        for (double p : partial) minor += p;
+        potential += 0.5 * minor;
+    } else {
+        for (size_t i = majors; i < massive; ++i) {
+            for (size_t j = i + 1; j < massive; ++j) potential += pairPotential(i, j);
+        }
+    }
+    return kinetic + potential;
+}
+
+double NBodySystem::energyDrift() const {
+    if (!hasInitialEnergy || initialEnergy == 0.0) return 0.0;
+    return (energy() - initialEnergy) / std::fabs(initialEnergy);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include "barneshut.h"
+
+// Gravity with a 4th-order symplectic integrator (Yoshida/Forest-Ruth
+// composition of leapfrog). Bodies are stored in three consecutive groups:
+//   major bodies  - few and heavy (Sun, planets), always summed directly
+//   minor bodies  - many small self-gravitating ones (belt, debris), summed
+//                   directly or through a Barnes-Hut tree
+//   test particles - massless, feel everything above but pull on nothing
+// All state is kept as structure-of-arrays in double precision.
+//
+// Block stepping instead runs a 2nd-order kick-drift-kick leapfrog where each
+// body steps at dt / 2^level, the level chosen from its dynamical time about
+// the major bodies. Only bodies that finish a step at a given substep have
+// their forces evaluated, so a few fast moons no longer set the step for
+// the whole system.
+class NBodySystem {
+public:
+    enum class Solver { Direct, BarnesHut };
+    enum class Stepping { Global, Block };
+
+    void clear();
+
+    // Groups must be filled in order: major, then minor, then test particles.
+    // gm is the gravitational parameter G*m in scene units.
+    int addMassive(const glm::dvec3 &position, const glm::dvec3 &velocity, double gm);
+    int addMinor(const glm::dvec3 &position, const glm::dvec3 &velocity, double gm);
+    int addTestParticle(const glm::dvec3 &position, const glm::dvec3 &velocity);
+
+    void step(double dt);
+
+    size_t size() const { return x.size(); }
+    size_t massiveCount() const { return gm.size(); }
+    size_t majorCount() const { return majors; }
+    glm::dvec3 position(size_t i) const { return glm::dvec3(x[i], y[i], z[i]); }
+    glm::dvec3 velocity(size_t i) const { return glm::dvec3(vx[i], vy[i], vz[i]); }
+
+    // Total energy of the massive bodies (scaled by G), and its relative
+    // change since the last clear(); test particles carry no energy. With the
+    // Barnes-Hut solver the minor-minor potential uses the same tree.
+    double energy() const;
+    double energyDrift() const;
+
+    double softening = 1e-3;    // Plummer softening length
+    Solver solver = Solver::Direct;     // for minor-body gravity
+    double openingAngle = 0.5;          // Barnes-Hut theta
+    Stepping stepping = Stepping::Global;
+    double blockAccuracy = 0.005;       // block step as a fraction of the local orbital period
+    int maxBlockLevel = 12;
+
+    // Bodies whose acceleration was evaluated during the last step().
+    size_t forceEvaluations() const { return lastForceEvaluations; }
+
+private:
+    void drift(double dt);
+    void kick(double dt);
+    void computeAccelerations();
+    void computeAccelerations(const std::vector<uint32_t> &targets, bool rebuildTree);
+    void blockStep(double dt);
+    int chooseLevel(size_t i, double dt) const;
+
+    std::vector<double> x, y, z, vx, vy, vz;
+    std::vector<double> ax, ay, az;
+    std::vector<double> gm;     // major and minor bodies
+    size_t majors = 0;
+    BarnesHutTree tree;
+    mutable BarnesHutTree potentialTree;    // rebuilt by energy() at the current positions
+    double initialEnergy = 0.0;
+    bool hasInitialEnergy = false;
+    bool accelerationsCurrent = false;  // ax/ay/az match the current positions
+    size_t forceEvaluationCount = 0, lastForceEvaluations = 0;
+
+    // block stepping
+    std::vector<int> blockLevel;
+    std::vector<uint32_t> blockTick;                // substep each body was last drifted to
+    std::vector<std::vector<uint32_t>> levelBodies;
+    std::vector<uint32_t> activeBodies;
+    std::vector<double> tx, ty, tz, tax, tay, taz;  // gathered targets for the tree walk
+};
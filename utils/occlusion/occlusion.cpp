@@ -0,0 +1,211 @@
+#include "occlusion.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtc/matrix_transform.hpp>
+
+DepthPyramid::DepthPyramid()
+    : sourceLocation(-1), reductionLocation(-1), depthTexture(0), reducedTexture(0), framebuffer(0), emptyVao(0),
+      depthWidth(0), depthHeight(0), reducedWidth(0), reducedHeight(0), nextReadback(0), frame(0),
+      pyramidView(1.0f), pyramidOrigin(0.0), p00(1.0f), p11(1.0f), screenWidth(0), screenHeight(0),
+      pyramidFrame(0), built(false) {}
+
+DepthPyramid::~DepthPyramid() {
+    cleanup();
+}
+
+void DepthPyramid::init() {
+    reduceShader = std::make_unique<Shader>(std::string("shader/depth_reduce.vert"), std::string("shader/depth_reduce.frag"));
+    sourceLocation = glGetUniformLocation(reduceShader->ID, "source");
+    reductionLocation = glGetUniformLocation(reduceShader->ID, "reduction");
+
+    glGenTextures(1, &depthTexture);
+    glGenTextures(1, &reducedTexture);
+    glGenFramebuffers(1, &framebuffer);
+    glGenVertexArrays(1, &emptyVao);
+    for (Readback &readback : readbacks) glGenBuffers(1, &readback.buffer);
+}
+
+void DepthPyramid::collect() {
+    ++frame;
+    // fences pass in submission order, so the newest finished readback supersedes older ones
+    Readback *newest = nullptr;
+    for (Readback &readback : readbacks) {
+        if (!readback.fence) continue;
+        GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) continue;
+        glDeleteSync(readback.fence);
+        readback.fence = nullptr;
+        if (!newest || readback.frame > newest->frame) newest = &readback;
+    }
+    if (!newest || (built && newest->frame <= pyramidFrame)) return;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, newest->buffer);
+    const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (size_t)newest->width * newest->height * sizeof(float), GL_MAP_READ_BIT);
+    if (mapped) {
+        build(static_cast<const float *>(mapped), *newest);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void DepthPyramid::capture(const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &origin, int width, int height) {
+    if (!reduceShader || width <= 0 || height <= 0) return;
+    Readback &readback = readbacks[nextReadback];
+    // the GPU is more than MAX_LATENCY frames behind; skip rather than wait
+    if (readback.fence) return;
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depthTexture);
+    if (width != depthWidth || height != depthHeight) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        depthWidth = width;
+        depthHeight = height;
+    }
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, width, height);
+
+    const int reducedW = (width + REDUCTION - 1) / REDUCTION, reducedH = (height + REDUCTION - 1) / REDUCTION;
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    if (reducedW != reducedWidth || reducedH != reducedHeight) {
+        glBindTexture(GL_TEXTURE_2D, reducedTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, reducedW, reducedH, 0, GL_RED, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, reducedTexture, 0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        reducedWidth = reducedW;
+        reducedHeight = reducedH;
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glViewport(0, 0, reducedW, reducedH);
+    reduceShader->use();
+    glUniform1i(sourceLocation, 0);
+    glUniform1i(reductionLocation, REDUCTION);
+    glBindVertexArray(emptyVao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)reducedW * reducedH * sizeof(float), nullptr, GL_STREAM_READ);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, reducedW, reducedH, GL_RED, GL_FLOAT, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.width = reducedW;
+    readback.height = reducedH;
+    readback.screenWidth = width;
+    readback.screenHeight = height;
+    readback.view = view;
+    readback.proj = proj;
+    readback.origin = origin;
+    readback.frame = frame;
+    nextReadback = (nextReadback + 1) % MAX_LATENCY;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    if (depthTest) glEnable(GL_DEPTH_TEST);
+    if (blend) glEnable(GL_BLEND);
+}
+
+void DepthPyramid::build(const float *depth, const Readback &readback) {
+    // window depth to view depth for a GL perspective projection
+    const float p22 = readback.proj[2][2], p32 = readback.proj[3][2];
+    levelSizes.assign(1, glm::ivec2(readback.width, readback.height));
+    while (levelSizes.back().x > 1 || levelSizes.back().y > 1) {
+        glm::ivec2 size = levelSizes.back();
+        levelSizes.push_back(glm::ivec2((size.x + 1) / 2, (size.y + 1) / 2));
+    }
+    levels.resize(levelSizes.size());
+
+    std::vector<float> &base = levels[0];
+    base.resize((size_t)readback.width * readback.height);
+    for (size_t i = 0; i < base.size(); ++i) {
+        float d = depth[i];
+        base[i] = d >= 1.0f ? INFINITY : p32 / (2.0f * d - 1.0f + p22);
+    }
+    for (size_t level = 1; level < levels.size(); ++level) {
+        const std::vector<float> &below = levels[level - 1];
+        const glm::ivec2 belowSize = levelSizes[level - 1], size = levelSizes[level];
+        std::vector<float> &out = levels[level];
+        out.resize((size_t)size.x * size.y);
+        for (int y = 0; y < size.y; ++y) {
+            const int y0 = 2 * y, y1 = std::min(2 * y + 1, belowSize.y - 1);
+            for (int x = 0; x < size.x; ++x) {
+                const int x0 = 2 * x, x1 = std::min(2 * x + 1, belowSize.x - 1);
+                out[(size_t)y * size.x + x] = std::max(std::max(below[(size_t)y0 * belowSize.x + x0], below[(size_t)y0 * belowSize.x + x1]),
+                                                       std::max(below[(size_t)y1 * belowSize.x + x0], below[(size_t)y1 * belowSize.x + x1]));
+            }
+        }
+    }
+
+    pyramidView = readback.view;
+    pyramidOrigin = readback.origin;
+    p00 = readback.proj[0][0];
+    p11 = readback.proj[1][1];
+    screenWidth = readback.screenWidth;
+    screenHeight = readback.screenHeight;
+    pyramidFrame = readback.frame;
+    built = true;
+}
+
+bool DepthPyramid::usable() const {
+    return built && frame - pyramidFrame <= (uint64_t)MAX_LATENCY;
+}
+
+glm::mat4 DepthPyramid::reprojection(const glm::dvec3 &origin) const {
+    return glm::translate(pyramidView, glm::vec3(origin - pyramidOrigin));
+}
+
+bool DepthPyramid::occluded(const glm::mat4 &reprojection, const glm::vec3 &centre, float radius) const {
+    glm::vec3 v = glm::vec3(reprojection * glm::vec4(centre, 1.0f));
+    const float nearest = -v.z - radius, farthest = -v.z + radius;
+    if (nearest <= 0.0f) return false;
+
+    // screen bounds of the sphere's bounding box: each side's extreme slope
+    // is at the near face when the side is off-axis that way, else the far face
+    auto low = [&](float c) { float side = c - radius; return side / (side < 0.0f ? nearest : farthest); };
+    auto high = [&](float c) { float side = c + radius; return side / (side > 0.0f ? nearest : farthest); };
+    const float x0 = p00 * low(v.x), x1 = p00 * high(v.x), y0 = p11 * low(v.y), y1 = p11 * high(v.y);
+    // nothing is known about what lay outside the captured view
+    if (x0 < -1.0f || x1 > 1.0f || y0 < -1.0f || y1 > 1.0f) return false;
+
+    const glm::ivec2 base = levelSizes[0];
+    const float toTexelX = 0.5f * screenWidth / REDUCTION, toTexelY = 0.5f * screenHeight / REDUCTION;
+    const int tx0 = std::min((int)((x0 + 1.0f) * toTexelX), base.x - 1), tx1 = std::min((int)((x1 + 1.0f) * toTexelX), base.x - 1);
+    const int ty0 = std::min((int)((y0 + 1.0f) * toTexelY), base.y - 1), ty1 = std::min((int)((y1 + 1.0f) * toTexelY), base.y - 1);
+
+    // the finest level where the bounds cover at most 2x2 texels
+    int level = 0;
+    while ((tx1 >> level) - (tx0 >> level) > 1 || (ty1 >> level) - (ty0 >> level) > 1) ++level;
+    const std::vector<float> &depths = levels[level];
+    const int width = levelSizes[level].x;
+    float farthestOccluder = 0.0f;
+    for (int y = ty0 >> level; y <= ty1 >> level; ++y) {
+        for (int x = tx0 >> level; x <= tx1 >> level; ++x) farthestOccluder = std::max(farthestOccluder, depths[(size_t)y * width + x]);
+    }
+    return nearest > farthestOccluder;
+}
+
+void DepthPyramid::cleanup() {
+    for (Readback &readback : readbacks) {
+        if (readback.fence) glDeleteSync(readback.fence);
+        if (readback.buffer) glDeleteBuffers(1, &readback.buffer);
+        readback = Readback();
+    }
+    if (depthTexture) glDeleteTextures(1, &depthTexture);
+    if (reducedTexture) glDeleteTextures(1, &reducedTexture);
+    if (framebuffer) glDeleteFramebuffers(1, &framebuffer);
+    if (emptyVao) glDeleteVertexArrays(1, &emptyVao);
+    depthTexture = reducedTexture = framebuffer = emptyVao = 0;
+    depthWidth = depthHeight = reducedWidth = reducedHeight = 0;
+    reduceShader.reset();
+    levels.clear();
+    levelSizes.clear();
+    built = false;
+}
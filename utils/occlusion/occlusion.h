@@ -0,0 +1,77 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include "../../shader/shader.h"
+
+// Hierarchical depth (Hi-Z) of the opaque scene for occlusion tests on the
+// CPU. capture() runs once the planets are drawn: the depth buffer is copied,
+// reduced on the GPU to one texel per REDUCTION x REDUCTION pixels (keeping
+// the farthest depth) and read back through a pixel buffer. collect() picks
+// the readback up on a later frame, once its fence has passed, so rendering
+// never waits on it, and builds a max-depth pyramid on top.
+//
+// The pyramid keeps the camera it was captured with, and tests reproject
+// into that camera. Reprojection only moves what the capture saw: anything
+// parallax has uncovered since then is still judged by the old depth, so a
+// newly revealed object can stay culled for a frame or so. Occluders that
+// moved since the capture are not accounted for either, so callers should
+// stop testing when they move fast.
+class DepthPyramid {
+public:
+    static const int REDUCTION = 8;         // screen pixels per base texel, per axis
+    static const int MAX_LATENCY = 2;       // frames a pyramid stays usable
+
+    DepthPyramid();
+    ~DepthPyramid();
+    void init();
+    // Once per frame, before any test: builds the pyramid from the newest finished readback.
+    void collect();
+    // Queues a readback of the current depth buffer; view has the camera at
+    // origin, as for the scene's draws. width and height are the default
+    // framebuffer's size in pixels; the caller's viewport is left as it was.
+    void capture(const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &origin, int width, int height);
+    void cleanup();
+
+    // True when a recent pyramid is available.
+    bool usable() const;
+    // Takes positions relative to origin into the captured camera's view space.
+    glm::mat4 reprojection(const glm::dvec3 &origin) const;
+    // True when the sphere (centre relative to the origin passed to
+    // reprojection()) lies entirely behind the captured depth.
+    bool occluded(const glm::mat4 &reprojection, const glm::vec3 &centre, float radius) const;
+
+private:
+    struct Readback {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        int width = 0, height = 0;          // base texels
+        int screenWidth = 0, screenHeight = 0;
+        glm::mat4 view, proj;
+        glm::dvec3 origin;
+        uint64_t frame = 0;
+    };
+
+    void build(const float *depth, const Readback &readback);
+
+    std::unique_ptr<Shader> reduceShader;
+    GLint sourceLocation, reductionLocation;
+    GLuint depthTexture, reducedTexture, framebuffer, emptyVao;
+    int depthWidth, depthHeight, reducedWidth, reducedHeight;
+    Readback readbacks[MAX_LATENCY];
+    int nextReadback;
+    uint64_t frame;
+
+    // Pyramid: level 0 is the readback in linear view depth, each level
+    // above keeps the farthest of 2x2 texels below. Cleared pixels are infinite.
+    std::vector<std::vector<float>> levels;
+    std::vector<glm::ivec2> levelSizes;
+    glm::mat4 pyramidView;
+    glm::dvec3 pyramidOrigin;
+    float p00, p11;
+    int screenWidth, screenHeight;
+    uint64_t pyramidFrame;
+    bool built;
+};
@@ -0,0 +1,80 @@
+#include "orbits.h"
+#include "../simd/simd.h"
+#include <cmath>
+
+static const double TWO_PI = 6.28318530717958647692;
+
+void perifocalBasis(double inclination, double ascendingNode, double argPeriapsis, glm::dvec3 &p, glm::dvec3 &q) {
+    double ci = cos(inclination), si = sin(inclination);
+    double cn = cos(ascendingNode), sn = sin(ascendingNode);
+    double cw = cos(argPeriapsis), sw = sin(argPeriapsis);
+
+    // Ecliptic frame is x/y with z up; the scene uses y up, so ecliptic
+    // (x, y, z) maps to world (x, z, y).
+    p = glm::dvec3(cn * cw - sn * sw * ci, sw * si, sn * cw + cn * sw * ci);
+    q = glm::dvec3(-cn * sw - sn * cw * ci, cw * si, -sn * sw + cn * cw * ci);
+}
+
+int OrbitPropagator::addBody(const OrbitalElements &el) {
+    glm::dvec3 p, q;
+    perifocalBasis(el.inclination, el.ascendingNode, el.argPeriapsis, p, q);
+    px.push_back(p.x); py.push_back(p.y); pz.push_back(p.z);
+    qx.push_back(q.x); qy.push_back(q.y); qz.push_back(q.z);
+
+    semiMajorAxis.push_back(el.semiMajorAxis);
+    semiMinorAxis.push_back(el.semiMajorAxis * sqrt(1.0 - (double)el.eccentricity * el.eccentricity));
+    eccentricity.push_back(el.eccentricity);
+    meanAnomalyAtEpoch.push_back(el.meanAnomalyAtEpoch);
+    meanMotion.push_back(el.period != 0.0f ? TWO_PI / el.period : 0.0);
+    parent.push_back(el.parent);
+
+    positions.emplace_back(0.0);
+    velocities.emplace_back(0.0);
+    meanAnomaly.push_back(0.0);
+    eccentricAnomaly.push_back(0.0);
+    sinE.push_back(0.0);
+    cosE.push_back(0.0);
+    return (int)semiMajorAxis.size() - 1;
+}
+
+void OrbitPropagator::clear() {
+    semiMajorAxis.clear(); semiMinorAxis.clear(); eccentricity.clear();
+    meanAnomalyAtEpoch.clear(); meanMotion.clear(); parent.clear();
+    px.clear(); py.clear(); pz.clear(); qx.clear(); qy.clear(); qz.clear();
+    meanAnomaly.clear(); eccentricAnomaly.clear(); sinE.clear(); cosE.clear(); positions.clear(); velocities.clear();
+}
+
+void OrbitPropagator::propagate(double t) {
+    time = t;
+    const size_t n = size();
+
+    // Pass 1: mean anomaly and Kepler's equation (M = E - e sin E), solved in
+    // batches with a fixed number of Halley steps so every body runs the same
+    // instructions.
+    for (size_t i = 0; i < n; ++i) {
+        meanAnomaly[i] = fmod(meanAnomalyAtEpoch[i] + meanMotion[i] * t, TWO_PI);
+    }
+    simd::solveKepler(meanAnomaly.data(), eccentricity.data(), eccentricAnomaly.data(), n);
+    simd::sincos(eccentricAnomaly.data(), sinE.data(), cosE.data(), n);
+
+    // Pass 2: perifocal position/velocity rotated into the world frame.
+    for (size_t i = 0; i < n; ++i) {
+        double cE = cosE[i], sE = sinE[i];
+        double a = semiMajorAxis[i], b = semiMinorAxis[i], e = eccentricity[i];
+        double xp = a * (cE - e);
+        double yp = b * sE;
+        double Edot = meanMotion[i] / (1.0 - e * cE);
+        double vxp = -a * sE * Edot;
+        double vyp = b * cE * Edot;
+        positions[i] = glm::dvec3(xp * px[i] + yp * qx[i], xp * py[i] + yp * qy[i], xp * pz[i] + yp * qz[i]);
+        velocities[i] = glm::dvec3(vxp * px[i] + vyp * qx[i], vxp * py[i] + vyp * qy[i], vxp * pz[i] + vyp * qz[i]);
+    }
+
+    // Pass 3: parents always precede their children, so one forward sweep
+    // turns parent-relative states into absolute ones.
+    for (size_t i = 0; i < n; ++i) {
+        if (parent[i] < 0) continue;
+        positions[i] += positions[parent[i]];
+        velocities[i] += velocities[parent[i]];
+    }
+}
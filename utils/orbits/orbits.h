@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+
+// Classical Keplerian elements. Angles are in radians, the period is in
+// simulation time units and its sign selects the direction of motion
+// (negative = retrograde, matching Planet::orbitPeriod).
+struct OrbitalElements {
+    float semiMajorAxis;
+    float eccentricity;
+    float inclination;
+    float ascendingNode;
+    float argPeriapsis;
+    float meanAnomalyAtEpoch;
+    float period;
+    int parent = -1;    // body this orbit is relative to, -1 = origin
+};
+
+// Unit vectors towards periapsis (p) and 90 degrees ahead of it in the
+// orbit plane (q), in the scene's y-up world frame.
+void perifocalBasis(double inclination, double ascendingNode, double argPeriapsis, glm::dvec3 &p, glm::dvec3 &q);
+
+// Structure-of-arrays table of orbital elements. propagate() evaluates every
+// body once and stores a position/velocity snapshot that all consumers read,
+// instead of each caller re-solving the orbit with its own cos/sin.
+// Internals and results are double so long-running clocks and large orbits
+// keep their precision; elements are only stored as float on input.
+class OrbitPropagator {
+public:
+    // Returns the index of the new body. A parent must be added before its children.
+    int addBody(const OrbitalElements &elements);
+    void clear();
+    size_t size() const { return semiMajorAxis.size(); }
+
+    void propagate(double time);
+
+    double snapshotTime() const { return time; }
+    const glm::dvec3 &position(int body) const { return positions[body]; }
+    const glm::dvec3 &velocity(int body) const { return velocities[body]; }
+    const std::vector<glm::dvec3> &allPositions() const { return positions; }
+    const std::vector<glm::dvec3> &allVelocities() const { return velocities; }
+    int parentOf(int body) const { return parent[body]; }
+
+private:
+    // elements
+    std::vector<double> semiMajorAxis, semiMinorAxis, eccentricity;
+    std::vector<double> meanAnomalyAtEpoch, meanMotion;
+    std::vector<int> parent;
+    // perifocal basis (P towards periapsis, Q 90 degrees ahead) in world space,
+    // precomputed from i, node and argument of periapsis
+    std::vector<double> px, py, pz, qx, qy, qz;
+
+    // per-frame scratch
+    std::vector<double> meanAnomaly, eccentricAnomaly, sinE, cosE;
+
+    double time = 0.0;
+    std::vector<glm::dvec3> positions;
+    std::vector<glm::dvec3> velocities;
+};
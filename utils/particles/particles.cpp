@@ -0,0 +1,174 @@
+#include "particles.h"
+#include "../random/random.h"
+#include <algorithm>
+#include <cstddef>
+#include <cmath>
+
+static const uint32_t PARTICLE_STREAM = 6;
+
+ParticleEngine::ParticleEngine() : instanceCount(0), seed(0), spawned(0), droppedCount(0), vao(0), instanceVbo(0), uniPixelScale(-1) {}
+
+ParticleEngine::~ParticleEngine() { cleanup(); }
+
+int ParticleEngine::addEmitter(const EmitterDef &def) {
+    pools.emplace_back();
+    Pool &pool = pools.back();
+    pool.def = def;
+    for (std::vector<float> *column : {&pool.x, &pool.y, &pool.z, &pool.vx, &pool.vy, &pool.vz, &pool.age, &pool.life})
+        column->assign(def.capacity, 0.0f);
+    // popped from the back, so slots are handed out from 0 up
+    pool.freeSlots.resize(def.capacity);
+    for (size_t i = 0; i < def.capacity; ++i) pool.freeSlots[i] = (uint32_t)(def.capacity - 1 - i);
+    return (int)pools.size() - 1;
+}
+
+void ParticleEngine::init(uint64_t seed) {
+    this->seed = seed;
+    size_t capacity = 0;
+    for (const Pool &pool : pools) capacity += pool.def.capacity;
+    instances.resize(capacity);
+
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &instanceVbo);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(ParticleInstance), nullptr, GL_STREAM_DRAW);
+    // position and size, then colour; the quad's corners come from gl_VertexID
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)offsetof(ParticleInstance, position));
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ParticleInstance), (void*)offsetof(ParticleInstance, color));
+    for (GLuint attribute = 0; attribute < 2; ++attribute) {
+        glEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    shader = std::make_unique<Shader>(std::string("shader/particle.vert"), std::string("shader/particle.frag"));
+    uniPixelScale = glGetUniformLocation(shader->ID, "pixelScale");
+}
+
+void ParticleEngine::emit(int emitter, const glm::vec3 &position, const glm::vec3 &velocity, const glm::vec3 &axis, size_t count) {
+    if (emitter < 0 || (size_t)emitter >= pools.size()) return;
+    Pool &pool = pools[emitter];
+    const EmitterDef &def = pool.def;
+    if (count > pool.freeSlots.size()) {
+        droppedCount += count - pool.freeSlots.size();
+        count = pool.freeSlots.size();
+    }
+    // basis around the axis, for directions within the cone
+    float axisLength = glm::length(axis);
+    glm::vec3 w = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::vec3 u = glm::normalize(glm::cross(std::fabs(w.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f), w));
+    glm::vec3 v = glm::cross(w, u);
+    const float cosSpread = std::cos(std::min(def.spread, 3.14159265f));
+    for (size_t n = 0; n < count; ++n) {
+        const uint32_t i = pool.freeSlots.back();
+        pool.freeSlots.pop_back();
+        pool.highWater = std::max(pool.highWater, (size_t)i + 1);
+        ++pool.live;
+
+        CounterRng rng(seed, spawned++, PARTICLE_STREAM);
+        float cosTheta = rng.uniform(cosSpread, 1.0f);
+        float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+        float phi = rng.uniform() * 2.0f * 3.14159265358979323846f;
+        glm::vec3 heading = (u * std::cos(phi) + v * std::sin(phi)) * sinTheta + w * cosTheta;
+        glm::vec3 start = velocity + heading * rng.uniform(def.speedMin, def.speedMax);
+        pool.x[i] = position.x; pool.y[i] = position.y; pool.z[i] = position.z;
+        pool.vx[i] = start.x; pool.vy[i] = start.y; pool.vz[i] = start.z;
+        pool.age[i] = 0.0f;
+        pool.life[i] = rng.uniform(def.lifeMin, def.lifeMax);
+    }
+}
+
+// Whole columns up to the high-water mark, dead slots included: the loops
+// stay branch-free and a dead slot's values are never read.
+void ParticleEngine::advance(Pool &pool, float deltaTime) {
+    const size_t n = pool.highWater;
+    const float damping = std::exp(-pool.def.drag * deltaTime);
+    for (std::vector<float> *column : {&pool.vx, &pool.vy, &pool.vz}) {
+        float *velocity = column->data();
+        for (size_t k = 0; k < n; ++k) velocity[k] *= damping;
+    }
+    float *positions[] = {pool.x.data(), pool.y.data(), pool.z.data()};
+    const float *velocities[] = {pool.vx.data(), pool.vy.data(), pool.vz.data()};
+    for (int axis = 0; axis < 3; ++axis) {
+        float *position = positions[axis];
+        const float *velocity = velocities[axis];
+        for (size_t k = 0; k < n; ++k) position[k] += velocity[k] * deltaTime;
+    }
+    float *age = pool.age.data();
+    for (size_t k = 0; k < n; ++k) age[k] += deltaTime;
+
+    // expired slots go back on the free list; life 0 marks them dead
+    for (size_t k = 0; k < n; ++k) {
+        if (pool.life[k] > 0.0f && pool.age[k] >= pool.life[k]) {
+            pool.life[k] = 0.0f;
+            pool.freeSlots.push_back((uint32_t)k);
+            --pool.live;
+        }
+    }
+    // an empty pool starts again from slot 0, so one burst does not leave
+    // every later update walking its whole capacity
+    if (pool.live == 0 && pool.highWater > 0) {
+        pool.highWater = 0;
+        pool.freeSlots.resize(pool.def.capacity);
+        for (size_t i = 0; i < pool.def.capacity; ++i) pool.freeSlots[i] = (uint32_t)(pool.def.capacity - 1 - i);
+    }
+}
+
+void ParticleEngine::pack(Pool &pool, const glm::vec3 &origin) {
+    const EmitterDef &def = pool.def;
+    for (size_t k = 0; k < pool.highWater; ++k) {
+        if (pool.life[k] <= 0.0f) continue;
+        float t = pool.age[k] / pool.life[k];
+        glm::vec4 color = glm::mix(def.colorStart, def.colorEnd, t);
+        ParticleInstance &out = instances[instanceCount++];
+        out.position = glm::vec3(pool.x[k], pool.y[k], pool.z[k]) - origin;
+        out.size = glm::mix(def.sizeStart, def.sizeEnd, t);
+        out.color = glm::vec4(glm::vec3(color) * color.a, def.additive ? 0.0f : color.a);
+    }
+}
+
+void ParticleEngine::update(float deltaTime, const glm::dvec3 &origin) {
+    instanceCount = 0;
+    for (Pool &pool : pools) {
+        if (pool.live == 0) continue;
+        advance(pool, deltaTime);
+        pack(pool, glm::vec3(origin));
+    }
+}
+
+void ParticleEngine::render(const glm::mat4 &view, const glm::mat4 &proj, int screenHeight) {
+    if (!shader || instanceCount == 0) return;
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instanceCount * sizeof(ParticleInstance), instances.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    shader->use();
+    shader->setMat4("view", view);
+    shader->setMat4("projection", proj);
+    glUniform1f(uniPixelScale, proj[1][1] * 0.5f * (float)screenHeight);
+
+    // premultiplied colour covers with alpha and adds without it, so every
+    // emitter shares the one draw
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+    glBindVertexArray(vao);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instanceCount);
+    glBindVertexArray(0);
+    glDepthMask(GL_TRUE);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+size_t ParticleEngine::liveCount() const {
+    size_t live = 0;
+    for (const Pool &pool : pools) live += pool.live;
+    return live;
+}
+
+void ParticleEngine::cleanup() {
+    if (instanceVbo) glDeleteBuffers(1, &instanceVbo);
+    if (vao) glDeleteVertexArrays(1, &vao);
+    instanceVbo = vao = 0;
+    shader.reset();
+}
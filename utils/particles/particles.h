@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glad/glad.h>
+#include "../../shader/shader.h"
+
+// What one emitter spawns. Each particle draws its life and speed from the
+// ranges, heads off within spread of the emit axis, and goes linearly from
+// the start size and colour to the end ones over its life. Colours are
+// straight alpha; additive particles glow onto what is behind them instead
+// of covering it.
+struct EmitterDef {
+    size_t capacity = 1024;             // pool slots, allocated once
+    float lifeMin = 1.0f, lifeMax = 2.0f;       // seconds
+    float speedMin = 0.1f, speedMax = 0.5f;     // units per second
+    float spread = 3.14159265f;         // cone half-angle around the axis, radians; pi is all round
+    float drag = 0.0f;                  // share of velocity lost per second
+    float sizeStart = 0.05f, sizeEnd = 0.05f;   // world diameter
+    glm::vec4 colorStart = glm::vec4(1.0f), colorEnd = glm::vec4(1.0f, 1.0f, 1.0f, 0.0f);
+    bool additive = false;
+};
+
+// Short-lived effect particles: debris, impact flashes, outgassing.
+//
+// Each emitter owns a fixed pool of capacity slots held as float columns.
+// Spawning pops a slot off the pool's free list and dying pushes it back,
+// so nothing is allocated once the emitters are added; a burst larger than
+// the free list is cut short and counted in dropped(). update() runs each
+// pool as one batch over its slots in use, then packs the survivors of every
+// pool, camera-relative, into one instance buffer that render() draws as
+// billboards in a single instanced call.
+class ParticleEngine {
+public:
+    ParticleEngine();
+    ~ParticleEngine();
+
+    // Pools are sized here; add every emitter before init().
+    int addEmitter(const EmitterDef &def);
+    void init(uint64_t seed);
+
+    // count particles from position, moving with velocity plus their own
+    // speed along directions within the emitter's spread of axis.
+    void emit(int emitter, const glm::vec3 &position, const glm::vec3 &velocity, const glm::vec3 &axis, size_t count);
+    // origin is the camera's world position
+    void update(float deltaTime, const glm::dvec3 &origin);
+    // view is camera-relative
+    void render(const glm::mat4 &view, const glm::mat4 &proj, int screenHeight);
+    void cleanup();
+
+    size_t liveCount() const;
+    size_t dropped() const { return droppedCount; }
+
+private:
+    struct Pool {
+        EmitterDef def;
+        std::vector<float> x, y, z, vx, vy, vz, age, life;
+        std::vector<uint32_t> freeSlots;    // stack; slots below highWater not on it are alive
+        size_t highWater = 0;               // one past the highest slot ever handed out
+        size_t live = 0;
+    };
+    // One billboard as the vertex shader reads it.
+    struct ParticleInstance {
+        glm::vec3 position;                 // relative to the camera
+        float size;
+        glm::vec4 color;                    // premultiplied; alpha 0 adds
+    };
+
+    void advance(Pool &pool, float deltaTime);
+    void pack(Pool &pool, const glm::vec3 &origin);
+
+    std::vector<Pool> pools;
+    std::vector<ParticleInstance> instances;    // one per slot of every pool
+    size_t instanceCount;                       // packed by the last update()
+    uint64_t seed;
+    uint64_t spawned;                           // particles ever emitted, the RNG counter
+    size_t droppedCount;
+    GLuint vao, instanceVbo;
+    GLint uniPixelScale;
+    std::unique_ptr<Shader> shader;
+};
@@ -0,0 +1,9 @@
+#include "random.h"
+#include <chrono>
+#include <random>
+
+uint64_t randomSeed() {
+    std::random_device device;
+    uint64_t seed = ((uint64_t)device() << 32) | device();
+    return seed ^ (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+
+// Counter-based random numbers (Philox4x32-10, Salmon et al. 2011). Output is
+// a pure function of (seed, element, draw), so populations can be generated in
+// any order, split across threads, and reproduced bit for bit from the seed.
+//
+//   CounterRng rng(seed, i);          // stream for element i
+//   float r = rng.uniform(0.04f, 0.19f);
+//
+// Each element's stream is independent of every other element's, and the
+// integer-to-float conversion is exact, so the same seed yields the same draws
+// on every platform.
+class CounterRng {
+public:
+    CounterRng(uint64_t seed, uint64_t element, uint32_t stream = 0)
+        : key0((uint32_t)seed), key1((uint32_t)(seed >> 32)),
+          element0((uint32_t)element), element1((uint32_t)(element >> 32)), stream(stream) {}
+
+    uint32_t next() {
+        if (used == 4) refill();
+        return block[used++];
+    }
+
+    // [0, 1) with 24 random bits
+    float uniform() { return (float)(next() >> 8) * (1.0f / 16777216.0f); }
+    float uniform(float lo, float hi) { return lo + uniform() * (hi - lo); }
+    // [0, 1) with 53 random bits
+    double uniformDouble() {
+        uint64_t high = next() >> 6;
+        uint64_t low = next() >> 5;
+        return (double)((high << 27) | low) * (1.0 / 9007199254740992.0);
+    }
+
+    // One Philox4x32-10 block: counter (c0..c3) under key (k0, k1).
+    static void philox(uint32_t c[4], uint32_t k0, uint32_t k1) {
+        for (int round = 0; round < 10; ++round) {
+            uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+            uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+            uint32_t n0 = (uint32_t)(p1 >> 32) ^ c[1] ^ k0;
+            uint32_t n2 = (uint32_t)(p0 >> 32) ^ c[3] ^ k1;
+            c[0] = n0; c[1] = (uint32_t)p1;
+            c[2] = n2; c[3] = (uint32_t)p0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+    }
+
+private:
+    void refill() {
+        block[0] = element0;
+        block[1] = element1;
+        block[2] = stream;
+        block[3] = counter++;
+        philox(block, key0, key1);
+        used = 0;
+    }
+
+    uint32_t key0, key1;
+    uint32_t element0, element1, stream;
+    uint32_t counter = 0;
+    uint32_t block[4];
+    int used = 4;
+};
+
+// Seed for runs that did not ask for one: differs per launch, and is printed
+// by the caller so the run can be repeated.
+uint64_t randomSeed();
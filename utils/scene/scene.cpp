@@ -8,11 +8,43 @@
 #include <cctype>
 #include <cmath>
 #include <string>
+#include <fstream>
 #include "../dust/dust.h"
 #include "../asteroids/asteroids.h"
+#include "../catalog/catalog.h"
 #include <memory>
 using namespace std;
 
+// Main-belt mass in solar masses, shared by all belt particles when they
+// self-gravitate, and the Barnes-Hut opening angle used for them.
+static const double BELT_MASS = 4.5e-10;
+static const double BELT_OPENING_ANGLE = 0.5;
+
+// Ephemeris table, used when present, and how scene time maps onto it: time
+// 0 is J2000 and Earth's demo period is one Julian year. Real distances are
+// bent onto the demo layout through the semi-major axes below.
+static const char *EPHEMERIS_FILE = "utils/ephemeris/de.bin";
+static const double J2000 = 2451545.0;
+static const double DAYS_PER_YEAR = 365.25;
+static const double OBLIQUITY_J2000 = 0.40909280422232897;     // 23.4392811 degrees
+static const double PLANET_AU[] = {0.0, 0.387, 0.723, 1.0, 1.524, 5.203, 9.537, 19.19, 30.07};
+
+// A body whose orbit takes fewer frames than this would alias into random
+// positions, so it is drawn as a ribbon along its orbit instead.
+static const double RIBBON_FRAMES_PER_ORBIT = 4.0;
+// share of its radius an occluder may move while a depth pyramid is in use
+static const double OCCLUDER_DRIFT = 0.25;
+static const float RIBBON_HALF_WIDTH = 0.05f;   // relative to the orbit radius
+// particles emitted at each collision's contact point
+static const size_t DEBRIS_PER_IMPACT = 32;
+static const size_t FLASH_PER_IMPACT = 12;
+
+// Spin angle in degrees for `turns` = time / period, wrapped in double so it
+// stays exact however long the clock has run.
+static float spinDegrees(double turns) {
+    return (float)(fmod(turns, 1.0) * 360.0);
+}
+
 Scene::Scene() : orbitVAO(0), orbitVBO(0), moonTexture(0) {
     texFiles = {
         {"sun", "utils/textures/sun.jpeg"},
@@ -27,16 +59,43 @@ Scene::Scene() : orbitVAO(0), orbitVBO(0), moonTexture(0) {
     };
 
     planets = {
-        {"Sun",     6.0f,  0.0f,   0.0f,   25.0f, 0, glm::vec3(1.0f,0.9f,0.6f), false, glm::vec3(1.0f, 0.8f, 0.3f), 0.0f},
-        {"Mercury", 0.6f, 10.0f,  10.0f,   10.0f, 0, glm::vec3(0.6f), false, glm::vec3(0.0f), 0.0f},
-        {"Venus",   1.0f, 15.0f,  18.0f,  -20.0f, 0, glm::vec3(1.0f,0.8f,0.6f), true, glm::vec3(1.0f, 0.7f, 0.3f), 1.2f},
-        {"Earth",   1.1f, 20.0f,  20.0f,    1.0f, 0, glm::vec3(0.4f,0.6f,1.0f), true, glm::vec3(0.3f, 0.5f, 1.0f), 1.5f},
-        {"Mars",    0.8f, 26.0f,  30.0f,    1.03f, 0, glm::vec3(1.0f,0.5f,0.4f), true, glm::vec3(1.0f, 0.5f, 0.3f), 0.4f},
-        {"Jupiter", 2.4f, 36.0f,  60.0f,    0.4f, 0, glm::vec3(1.0f,0.9f,0.7f), true, glm::vec3(0.9f, 0.8f, 0.6f), 0.8f},
-        {"Saturn",  2.0f, 48.0f,  80.0f,    0.45f, 0, glm::vec3(1.0f,0.9f,0.8f), true, glm::vec3(1.0f, 0.9f, 0.7f), 0.6f},
-        {"Uranus",  1.6f, 60.0f, 100.0f,    0.72f, 0, glm::vec3(0.6f,0.9f,1.0f), true, glm::vec3(0.5f, 0.8f, 1.0f), 1.0f},
-        {"Neptune", 1.6f, 72.0f, 130.0f,    0.67f, 0, glm::vec3(0.4f,0.6f,1.0f), true, glm::vec3(0.4f, 0.5f, 1.0f), 1.2f}
+        {"Sun",     6.0f,  0.0f,   0.0f,   25.0f, 0, glm::vec3(1.0f,0.9f,0.6f), false, glm::vec3(1.0f, 0.8f, 0.3f), 0.0f, 1.0f},
+        {"Mercury", 0.6f, 10.0f,  10.0f,   10.0f, 0, glm::vec3(0.6f), false, glm::vec3(0.0f), 0.0f, 1.66e-7f},
+        {"Venus",   1.0f, 15.0f,  18.0f,  -20.0f, 0, glm::vec3(1.0f,0.8f,0.6f), true, glm::vec3(1.0f, 0.7f, 0.3f), 1.2f, 2.45e-6f},
+        {"Earth",   1.1f, 20.0f,  20.0f,    1.0f, 0, glm::vec3(0.4f,0.6f,1.0f), true, glm::vec3(0.3f, 0.5f, 1.0f), 1.5f, 3.0e-6f},
+        {"Mars",    0.8f, 26.0f,  30.0f,    1.03f, 0, glm::vec3(1.0f,0.5f,0.4f), true, glm::vec3(1.0f, 0.5f, 0.3f), 0.4f, 3.23e-7f},
+        {"Jupiter", 2.4f, 36.0f,  60.0f,    0.4f, 0, glm::vec3(1.0f,0.9f,0.7f), true, glm::vec3(0.9f, 0.8f, 0.6f), 0.8f, 9.55e-4f},
+        {"Saturn",  2.0f, 48.0f,  80.0f,    0.45f, 0, glm::vec3(1.0f,0.9f,0.8f), true, glm::vec3(1.0f, 0.9f, 0.7f), 0.6f, 2.86e-4f},
+        {"Uranus",  1.6f, 60.0f, 100.0f,    0.72f, 0, glm::vec3(0.6f,0.9f,1.0f), true, glm::vec3(0.5f, 0.8f, 1.0f), 1.0f, 4.37e-5f},
+        {"Neptune", 1.6f, 72.0f, 130.0f,    0.67f, 0, glm::vec3(0.4f,0.6f,1.0f), true, glm::vec3(0.4f, 0.5f, 1.0f), 1.2f, 5.15e-5f}
     };
+
+    jupiterMoons = {
+        {3.0f, 2.0f, 0.3f},
+        {4.0f, 4.0f, 0.25f},
+        {5.0f, 8.0f, 0.4f},
+        {6.0f, 16.0f, 0.35f}
+    };
+
+    // orbits opposite to Earth's own direction
+    float earthOrbitSign = (planets[3].orbitPeriod >= 0.0f) ? 1.0f : -1.0f;
+    earthMoon = {2.8f, -earthOrbitSign * 3.0f, 0.35f};
+
+    setupOrbitTable();
+}
+
+void Scene::setupOrbitTable() {
+    orbits.clear();
+    for (const Planet &p : planets) {
+        orbits.addBody({p.distance, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, p.orbitPeriod, -1});
+    }
+    earthMoonBody = orbits.addBody({earthMoon.distance, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, earthMoon.orbitPeriod, 3});
+    jupiterMoonBodies.clear();
+    for (const Moon &m : jupiterMoons) {
+        jupiterMoonBodies.push_back(orbits.addBody({m.distance, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, m.orbitPeriod, 5}));
+    }
+    orbits.propagate(0.0);
+    bodyPositions = orbits.allPositions();
 }
 
 void Scene::init() {
@@ -81,17 +140,55 @@ void Scene::init() {
 
     setupOrbits();
 
-    asteroidSystem = std::make_unique<AsteroidSystem>();
-    asteroidSystem->init();
-
-    dustSystem = std::make_unique<DustSystem>();
-    dustSystem->init();
+    asteroidSystem = std::make_unique<AsteroidSystem>(asteroidCount);
+    std::cout << "Population seed: " << seed << " (repeat with --seed " << seed << ")" << std::endl;
+    AsteroidBelt catalogBelt;
+    if(!catalogPath.empty()) {
+        MinorPlanetCatalog catalog;
+        if(catalog.load(catalogPath)) {
+            catalogToBelt(catalog, [this](double au) { return sceneDistance(au); },
+                          std::fabs(planets[3].orbitPeriod), seed, catalogBelt);
+            std::cout << "Asteroid belt: " << catalogBelt.size() << " bound orbits from " << catalogPath << std::endl;
+        }
+    }
+    if(!catalogBelt.empty()) asteroidSystem->init(std::move(catalogBelt));
+    else asteroidSystem->init(seed);
+
+    dustSystem = std::make_unique<DustSystem>(dustCount);
+    dustSystem->init(seed);
+
+    // Slow grey rubble that lingers, and a brief bright spray thrown back
+    // along the impactor's path.
+    particleEngine = std::make_unique<ParticleEngine>();
+    EmitterDef debris;
+    debris.capacity = 8192;
+    debris.lifeMin = 2.0f; debris.lifeMax = 5.0f;
+    debris.speedMin = 0.05f; debris.speedMax = 0.4f;
+    debris.drag = 0.3f;
+    debris.sizeStart = 0.04f; debris.sizeEnd = 0.02f;
+    debris.colorStart = glm::vec4(0.55f, 0.5f, 0.45f, 0.9f); debris.colorEnd = glm::vec4(0.4f, 0.37f, 0.33f, 0.0f);
+    debrisEmitter = particleEngine->addEmitter(debris);
+    EmitterDef flash;
+    flash.capacity = 2048;
+    flash.lifeMin = 0.2f; flash.lifeMax = 0.6f;
+    flash.speedMin = 0.5f; flash.speedMax = 2.0f;
+    flash.spread = 0.6f;
+    flash.drag = 2.0f;
+    flash.sizeStart = 0.15f; flash.sizeEnd = 0.05f;
+    flash.colorStart = glm::vec4(1.0f, 0.85f, 0.5f, 1.0f); flash.colorEnd = glm::vec4(1.0f, 0.35f, 0.1f, 0.0f);
+    flash.additive = true;
+    flashEmitter = particleEngine->addEmitter(flash);
+    particleEngine->init(seed);
 
     // Initialize lens flare system
     lensFlareSystem = std::make_unique<LensFlareSystem>();
     lensFlareSystem->init();
 
+    depthPyramid = std::make_unique<DepthPyramid>();
+    depthPyramid->init();
+
     saturnRing = createRing(2.5f, 4.0f, 64);
+    orbitRibbon = createRing(1.0f - RIBBON_HALF_WIDTH, 1.0f + RIBBON_HALF_WIDTH, 128);
     saturnRingTexture = loadTexture("utils/textures/saturn_ring.png");
     if (saturnRingTexture == 0) {
         const int TEX_SIZE = 256;
@@ -117,18 +214,41 @@ void Scene::init() {
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     }
 
-    jupiterMoons = {
-        {3.0f, 2.0f, 0.3f},
-        {4.0f, 4.0f, 0.25f},
-        {5.0f, 8.0f, 0.4f},
-        {6.0f, 16.0f, 0.35f}
-    };
-
     // Initialize atmosphere shader
     atmosphereShader = std::make_unique<Shader>(
         std::string("shader/atmosphere.vert"),
         std::string("shader/atmosphere.frag")
     );
+
+    ephemeris = std::make_unique<Ephemeris>();
+    std::ifstream ephemerisProbe(EPHEMERIS_FILE);
+    if(ephemerisProbe.good()) ephemeris->open(EPHEMERIS_FILE);
+
+    std::vector<double> bodyGM = getBodyGM();
+    simulation = std::make_unique<SimulationThread>(orbits);
+    simulation->setBodyMasses(bodyGM);
+    simulation->setBelt(asteroidSystem->getBelt());
+    simulation->setBodyRadii(getBodyRadii());
+    simulation->setBeltMass(bodyGM[0] * BELT_MASS, BELT_OPENING_ANGLE);
+    simulation->start();
+}
+
+std::vector<double> Scene::getBodyGM() const {
+    // The demo orbits don't follow Kepler's third law; scale gravity so
+    // Earth keeps its period when N-body mode starts.
+    const Planet &earth = planets[3];
+    double sunGM = 4.0 * M_PI * M_PI * pow(earth.distance, 3.0) / pow(earth.orbitPeriod, 2.0);
+    std::vector<double> bodyGM(orbits.size(), 0.0);
+    for(size_t i=0;i<planets.size();++i) bodyGM[i] = sunGM * planets[i].mass;
+    return bodyGM;
+}
+
+std::vector<float> Scene::getBodyRadii() const {
+    std::vector<float> bodyRadii(orbits.size(), 0.0f);
+    for(size_t i=0;i<planets.size();++i) bodyRadii[i] = planets[i].radius;
+    bodyRadii[earthMoonBody] = earthMoon.radius;
+    for(size_t i=0;i<jupiterMoonBodies.size();++i) bodyRadii[jupiterMoonBodies[i]] = jupiterMoons[i].radius;
+    return bodyRadii;
 }
 
 void Scene::setupOrbits() {
@@ -148,25 +268,158 @@ void Scene::setupOrbits() {
     glBindVertexArray(0);
 }
 
-glm::vec3 Scene::getPlanetPosition(int planetIndex, float simulationTime) {
-    if(planetIndex < 0 || planetIndex >= (int)planets.size()) return glm::vec3(0.0f);
+void Scene::update() {
+    double before = simulationTime;
+    if(simulation) simulation->sample(bodyPositions, beltPositions, simulationTime);
+    frameAdvance = simulationTime - before;
+    collisions.clear();
+    if(simulation) simulation->takeCollisions(collisions);
+    collisionTotal += collisions.size();
+    if(particleEngine) {
+        for(const CollisionEvent &event : collisions) {
+            glm::vec3 contact(event.contact), back(-event.relativeVelocity);
+            particleEngine->emit(debrisEmitter, contact, glm::vec3(0.0f), back, DEBRIS_PER_IMPACT);
+            particleEngine->emit(flashEmitter, contact, glm::vec3(0.0f), back, FLASH_PER_IMPACT);
+        }
+    }
+    if(useEphemeris) applyEphemeris();
+}
+
+// Heliocentric ephemeris positions, rotated from the equator to the ecliptic
+// and into the scene's y-up frame like OrbitPropagator, with each distance
+// remapped onto the demo layout. Dates outside the table keep the simulation.
+void Scene::applyEphemeris() {
+    static const int bodies[] = {Ephemeris::SUN, Ephemeris::MERCURY, Ephemeris::VENUS, Ephemeris::EARTH, Ephemeris::MARS,
+                                 Ephemeris::JUPITER, Ephemeris::SATURN, Ephemeris::URANUS, Ephemeris::NEPTUNE};
+    const size_t count = sizeof(bodies) / sizeof(bodies[0]);
+    double date = J2000 + simulationTime * DAYS_PER_YEAR / planets[3].orbitPeriod;
+    glm::dvec3 au[count];
+    if(planets.size() != count || !ephemeris->positions(date, bodies, count, au)) return;
+
+    std::vector<glm::dvec3> previous(bodyPositions.begin(), bodyPositions.begin() + count);
+    const double ce = cos(OBLIQUITY_J2000), se = sin(OBLIQUITY_J2000);
+    for(size_t i=0;i<count;++i){
+        glm::dvec3 eq = au[i] - au[0];
+        glm::dvec3 ecliptic(eq.x, ce * eq.y + se * eq.z, -se * eq.y + ce * eq.z);
+        glm::dvec3 world(ecliptic.x, ecliptic.z, ecliptic.y);
+        double r = glm::length(world);
+        bodyPositions[i] = r > 0.0 ? world * (sceneDistance(r) / r) : glm::dvec3(0.0);
+    }
+    bodyPositions[earthMoonBody] += bodyPositions[3] - previous[3];
+    for(int body : jupiterMoonBodies) bodyPositions[body] += bodyPositions[5] - previous[5];
+}
+
+// Piecewise-linear map from a real solar distance to the demo layout,
+// through the planets' semi-major axes; beyond Neptune it scales linearly.
+double Scene::sceneDistance(double au) const {
+    const size_t n = std::min(planets.size(), sizeof(PLANET_AU) / sizeof(PLANET_AU[0]));
+    for(size_t i=1;i<n;++i){
+        if(au <= PLANET_AU[i] || i == n - 1) {
+            if(au > PLANET_AU[i]) return planets[i].distance * au / PLANET_AU[i];
+            double t = (au - PLANET_AU[i-1]) / (PLANET_AU[i] - PLANET_AU[i-1]);
+            return planets[i-1].distance + t * (planets[i].distance - planets[i-1].distance);
+        }
+    }
+    return au;
+}
+
+void Scene::setTimeScale(float timeScale) {
+    if(simulation) simulation->setTimeScale(timeScale);
+}
 
-    Planet &p = planets[planetIndex];
+double Scene::getEffectiveTimeScale() const {
+    return simulation ? simulation->effectiveTimeScale() : 0.0;
+}
 
-    if(planetIndex == 0) return glm::vec3(0.0f); // Sun at origin
+bool Scene::aliases(float orbitPeriod) const {
+    return fabs(frameAdvance) * RIBBON_FRAMES_PER_ORBIT > fabs(orbitPeriod);
+}
 
-    if(p.orbitPeriod != 0.0f) {
-        float orbitT = simulationTime / p.orbitPeriod;
-        float angle = orbitT * 2.0f * (float)M_PI;
-        float x = p.distance * cos(angle);
-        float z = p.distance * sin(angle);
-        return glm::vec3(x, 0.0f, z);
+bool Scene::occludersSteady() const {
+    // orbital speed times the time a pyramid can lag behind
+    double lag = fabs(frameAdvance) * DepthPyramid::MAX_LATENCY;
+    auto steady = [lag](float distance, float orbitPeriod, float radius) {
+        return orbitPeriod == 0.0f || 2.0 * M_PI * distance / fabs(orbitPeriod) * lag <= OCCLUDER_DRIFT * radius;
+    };
+    for(const Planet &p : planets) {
+        if(!steady(p.distance, p.orbitPeriod, p.radius)) return false;
+    }
+    if(!steady(earthMoon.distance, earthMoon.orbitPeriod, earthMoon.radius)) return false;
+    for(const Moon &moon : jupiterMoons) {
+        if(!steady(moon.distance, moon.orbitPeriod, moon.radius)) return false;
     }
+    return true;
+}
+
+// Band along the body's current orbit about centre, in its own texture.
+void Scene::drawRibbon(Shader &planetShader, const glm::dvec3 &centre, const glm::dvec3 &body, const glm::dvec3 &camPos, GLuint texture) {
+    float radius = (float)glm::length(body - centre);
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, glm::vec3(centre - camPos));
+    model = glm::scale(model, glm::vec3(radius));
+    planetShader.setMat4("model", model);
+    planetShader.setInt("isSun", 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    planetShader.setInt("texture1", 0);
+    glBindVertexArray(orbitRibbon.vao);
+    glDrawElements(GL_TRIANGLES, orbitRibbon.indexCount, GL_UNSIGNED_INT, 0);
+}
+
+void Scene::setNBodyMode(bool enabled) {
+    if(simulation) simulation->setNBodyMode(enabled);
+}
+
+bool Scene::isNBodyMode() const {
+    return simulation && simulation->isNBodyMode();
+}
+
+double Scene::getEnergyDrift() const {
+    return simulation ? simulation->energyDrift() : 0.0;
+}
+
+void Scene::setBeltSelfGravity(bool enabled) {
+    if(simulation) simulation->setBeltSelfGravity(enabled);
+}
+
+bool Scene::isBeltSelfGravity() const {
+    return simulation && simulation->isBeltSelfGravity();
+}
+
+void Scene::setBlockTimesteps(bool enabled) {
+    if(simulation) simulation->setBlockTimesteps(enabled);
+}
 
-    return glm::vec3(0.0f);
+bool Scene::isBlockTimesteps() const {
+    return simulation && simulation->isBlockTimesteps();
 }
 
-void Scene::renderAtmospheres(const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &camPos, Mesh &sphere, float simulationTime) {
+size_t Scene::getForceEvaluations() const {
+    return simulation ? simulation->forceEvaluations() : 0;
+}
+
+void Scene::setCollisions(bool enabled) {
+    if(simulation) simulation->setCollisions(enabled);
+}
+
+bool Scene::isCollisions() const {
+    return simulation && simulation->isCollisions();
+}
+
+double Scene::getCollisionMilliseconds() const {
+    return simulation ? simulation->collisionMilliseconds() : 0.0;
+}
+
+double Scene::getCollisionCoverage() const {
+    return simulation ? simulation->collisionCoverage() : 1.0;
+}
+
+glm::dvec3 Scene::getPlanetPosition(int planetIndex) const {
+    if(planetIndex < 0 || planetIndex >= (int)planets.size()) return glm::dvec3(0.0);
+    return bodyPositions[planetIndex];
+}
+
+void Scene::renderAtmospheres(const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &camPos, Mesh &sphere, double simulationTime) {
     if(!atmosphereShader || !showAtmospheres) return;
 
     glDepthMask(GL_FALSE);
@@ -176,15 +429,15 @@ void Scene::renderAtmospheres(const glm::mat4 &view, const glm::mat4 &proj, cons
     atmosphereShader->use();
     atmosphereShader->setMat4("view", view);
     atmosphereShader->setMat4("projection", proj);
-    atmosphereShader->setVec3("viewPos", camPos);
+    atmosphereShader->setVec3("viewPos", glm::vec3(0.0f));
 
     glBindVertexArray(sphere.vao);
 
     for(size_t i=0; i<planets.size(); ++i) {
         Planet &p = planets[i];
-        if(!p.hasAtmosphere) continue;
+        if(!p.hasAtmosphere || aliases(p.orbitPeriod)) continue;
 
-        glm::vec3 planetPos = getPlanetPosition(i, simulationTime);
+        glm::vec3 planetPos = glm::vec3(getPlanetPosition(i) - camPos);
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, planetPos);
 
@@ -194,7 +447,7 @@ void Scene::renderAtmospheres(const glm::mat4 &view, const glm::mat4 &proj, cons
             if(i == 0 && planets.size() > 1) {
                 orbitSign = -((planets[1].orbitPeriod >= 0.0f) ? 1.0f : -1.0f);
             }
-            rotAngle = orbitSign * (simulationTime / fabs(p.rotationPeriod)) * 360.0f;
+            rotAngle = orbitSign * spinDegrees(simulationTime / fabs(p.rotationPeriod));
             model = glm::rotate(model, glm::radians(rotAngle), glm::vec3(0.0f, 1.0f, 0.0f));
         }
 
@@ -212,11 +465,21 @@ void Scene::renderAtmospheres(const glm::mat4 &view, const glm::mat4 &proj, cons
     glDepthMask(GL_TRUE);
 }
 
-void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &camPos, const glm::vec3 &camFront, const glm::vec3 &camUp, Mesh &sphere, float simulationTime, float deltaTime, int screenWidth, int screenHeight) {
+void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &camPos, const glm::vec3 &camFront, const glm::vec3 &camUp, Mesh &sphere, double simulationTime, float deltaTime, int screenWidth, int screenHeight) {
     planetShader.use();
     planetShader.setMat4("view", view);
     planetShader.setMat4("projection", proj);
-    planetShader.setVec3("viewPos", camPos);
+    planetShader.setVec3("viewPos", glm::vec3(0.0f));
+    // orbits are centred on the world origin
+    glm::vec3 worldOrigin = glm::vec3(-camPos);
+
+    // last frames' depth, for skipping what the planets hide
+    const DepthPyramid *occluders = nullptr;
+    if(depthPyramid && occlusionCulling) {
+        depthPyramid->collect();
+        if(depthPyramid->usable() && occludersSteady()) occluders = depthPyramid.get();
+    }
+    const glm::mat4 toOccluders = occluders ? occluders->reprojection(camPos) : glm::mat4(1.0f);
 
     // Draw orbits with dim color
     planetShader.use();
@@ -225,6 +488,7 @@ void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4
     for(size_t i=1;i<planets.size();++i){
         float r = planets[i].distance;
         glm::mat4 model = glm::mat4(1.0f);
+        model = glm::translate(model, worldOrigin);
         model = glm::scale(model, glm::vec3(r, 1.0f, r));
         planetShader.setMat4("model", model);
         glActiveTexture(GL_TEXTURE0);
@@ -237,7 +501,13 @@ void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4
     glBindVertexArray(sphere.vao);
     for(size_t i=0;i<planets.size();++i){
         Planet &p = planets[i];
-        glm::vec3 planetPos = getPlanetPosition(i, simulationTime);
+        if(i > 0 && aliases(p.orbitPeriod)) {
+            // its moons and rings blur into the same band
+            drawRibbon(planetShader, getPlanetPosition(0), getPlanetPosition(i), camPos, p.texture);
+            glBindVertexArray(sphere.vao);
+            continue;
+        }
+        glm::vec3 planetPos = glm::vec3(getPlanetPosition(i) - camPos);
 
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, planetPos);
@@ -248,15 +518,14 @@ void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4
             if(i == 0 && planets.size() > 1) {
                 orbitSign = -((planets[1].orbitPeriod >= 0.0f) ? 1.0f : -1.0f);
             }
-            rotAngle = orbitSign * (simulationTime / fabs(p.rotationPeriod)) * 360.0f;
+            rotAngle = orbitSign * spinDegrees(simulationTime / fabs(p.rotationPeriod));
             model = glm::rotate(model, glm::radians(rotAngle), glm::vec3(0.0f, 1.0f, 0.0f));
         }
 
         model = glm::scale(model, glm::vec3(p.radius));
         planetShader.setMat4("model", model);
 
-        glm::vec3 sunPos(0.0f);
-        planetShader.setVec3("lightPos", sunPos);
+        planetShader.setVec3("lightPos", worldOrigin);
         planetShader.setInt("isSun", (i==0) ? 1 : 0);
 
         glActiveTexture(GL_TEXTURE0);
@@ -266,23 +535,17 @@ void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4
         glDrawElements(GL_TRIANGLES, sphere.indexCount, GL_UNSIGNED_INT, 0);
 
         // Moon for Earth
-        if(i == 3) {
-            float moonDist = 2.8f;
-            float moonRadius = 0.35f;
-            float moonOrbitPeriod = 3.0f;
-
-            glm::vec3 earthPos = getPlanetPosition(3, simulationTime);
+        if(i == 3 && aliases(earthMoon.orbitPeriod)) {
+            drawRibbon(planetShader, bodyPositions[3], bodyPositions[earthMoonBody], camPos, moonTexture);
+            glBindVertexArray(sphere.vao);
+        } else if(i == 3 && !(occluders && occluders->occluded(toOccluders, glm::vec3(bodyPositions[earthMoonBody] - camPos), earthMoon.radius))) {
             float earthOrbitSign = (planets[3].orbitPeriod >= 0.0f) ? 1.0f : -1.0f;
-            float moonT = simulationTime / moonOrbitPeriod;
-            float moonAngle = -earthOrbitSign * moonT * 2.0f * (float)M_PI;
-            float mx = earthPos.x + moonDist * cos(moonAngle);
-            float mz = earthPos.z + moonDist * sin(moonAngle);
 
             glm::mat4 moonModel = glm::mat4(1.0f);
-            moonModel = glm::translate(moonModel, glm::vec3(mx, 0.0f, mz));
-            float moonRot = -earthOrbitSign * (simulationTime / 27.3f) * 360.0f;
+            moonModel = glm::translate(moonModel, glm::vec3(bodyPositions[earthMoonBody] - camPos));
+            float moonRot = -earthOrbitSign * spinDegrees(simulationTime / 27.3);
             moonModel = glm::rotate(moonModel, glm::radians(moonRot), glm::vec3(0.0f, 1.0f, 0.0f));
-            moonModel = glm::scale(moonModel, glm::vec3(moonRadius));
+            moonModel = glm::scale(moonModel, glm::vec3(earthMoon.radius));
 
             planetShader.setMat4("model", moonModel);
             planetShader.setInt("isSun", 0);
@@ -294,16 +557,17 @@ void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4
 
         // Jupiter moons
         if(i == 5 && !jupiterMoons.empty()) {
-            glm::vec3 jupiterPos = getPlanetPosition(5, simulationTime);
-            for (const auto &moon : jupiterMoons) {
-                float moonT = simulationTime / moon.orbitPeriod;
-                float moonAngle = moonT * 2.0f * (float)M_PI;
-                float mx = jupiterPos.x + moon.distance * cos(moonAngle);
-                float mz = jupiterPos.z + moon.distance * sin(moonAngle);
-
+            for (size_t m = 0; m < jupiterMoons.size(); ++m) {
+                const Moon &moon = jupiterMoons[m];
+                if(aliases(moon.orbitPeriod)) {
+                    drawRibbon(planetShader, bodyPositions[5], bodyPositions[jupiterMoonBodies[m]], camPos, moonTexture);
+                    glBindVertexArray(sphere.vao);
+                    continue;
+                }
+                if(occluders && occluders->occluded(toOccluders, glm::vec3(bodyPositions[jupiterMoonBodies[m]] - camPos), moon.radius)) continue;
                 glm::mat4 moonModel = glm::mat4(1.0f);
-                moonModel = glm::translate(moonModel, glm::vec3(mx, 0.0f, mz));
-                moonModel = glm::rotate(moonModel, glm::radians(simulationTime * 10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+                moonModel = glm::translate(moonModel, glm::vec3(bodyPositions[jupiterMoonBodies[m]] - camPos));
+                moonModel = glm::rotate(moonModel, glm::radians(spinDegrees(simulationTime / 36.0)), glm::vec3(0.0f, 1.0f, 0.0f));
                 moonModel = glm::scale(moonModel, glm::vec3(moon.radius));
                 planetShader.setMat4("model", moonModel);
                 planetShader.setInt("isSun", 0);
@@ -316,7 +580,7 @@ void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4
 
         // Saturn rings
         if(i == 6 && showRings) {
-            glm::vec3 saturnPos = getPlanetPosition(6, simulationTime);
+            glm::vec3 saturnPos = glm::vec3(getPlanetPosition(6) - camPos);
             glm::mat4 ringModel = glm::mat4(1.0f);
             ringModel = glm::translate(ringModel, saturnPos);
             ringModel = glm::rotate(ringModel, glm::radians(27.0f), glm::vec3(0.0f, 0.0f, 1.0f));
@@ -332,36 +596,50 @@ void Scene::render(Shader &planetShader, const glm::mat4 &view, const glm::mat4
     }
     glBindVertexArray(0);
 
+    // everything opaque that can hide the belt is in the depth buffer now
+    if(depthPyramid && occlusionCulling) depthPyramid->capture(view, proj, camPos, screenWidth, screenHeight);
+
     // Render atmospheric glow
     renderAtmospheres(view, proj, camPos, sphere, simulationTime);
 
     // Asteroid belt
     if (asteroidSystem && showAsteroids) {
-        asteroidSystem->render(simulationTime, sphere, planetShader);
+        asteroidSystem->render(simulationTime, view, proj, worldOrigin, camPos, screenHeight, beltPositions.empty() ? nullptr : &beltPositions, occluders,
+                               farFieldBelt);
     }
 
     // Space dust
     if (dustSystem && showDust) {
-        dustSystem->update(deltaTime);
-        dustSystem->render(view, proj, camFront, camUp);
+        dustSystem->update(deltaTime, camPos);
+        dustSystem->render(view, proj, camPos, screenHeight);
+    }
+
+    // Impact debris and flashes
+    if (particleEngine) {
+        particleEngine->update(deltaTime, camPos);
+        particleEngine->render(view, proj, screenHeight);
     }
 
     // LENS FLARE - Render LAST so it appears on top
     if (lensFlareSystem && showLensFlare) {
-        glm::vec3 sunPos = getPlanetPosition(0, simulationTime);
+        glm::vec3 sunPos = glm::vec3(getPlanetPosition(0) - camPos);
         lensFlareSystem->render(sunPos, view, proj, screenWidth, screenHeight);
     }
 }
 
 void Scene::cleanup() {
+    if (simulation) { simulation->stop(); simulation.reset(); }
     if(orbitVBO) glDeleteBuffers(1, &orbitVBO);
     if(orbitVAO) glDeleteVertexArrays(1, &orbitVAO);
     if (asteroidSystem) { asteroidSystem->cleanup(); asteroidSystem.reset(); }
     if (dustSystem) { dustSystem->cleanup(); dustSystem.reset(); }
+    if (particleEngine) { particleEngine->cleanup(); particleEngine.reset(); }
     if (lensFlareSystem) { lensFlareSystem->cleanup(); lensFlareSystem.reset(); }
+    if (depthPyramid) { depthPyramid->cleanup(); depthPyramid.reset(); }
     if (saturnRing.ebo) glDeleteBuffers(1, &saturnRing.ebo);
     if (saturnRing.vbo) glDeleteBuffers(1, &saturnRing.vbo);
     if (saturnRing.vao) glDeleteVertexArrays(1, &saturnRing.vao);
+    if (orbitRibbon.vao) orbitRibbon.destroy();
     if (saturnRingTexture) glDeleteTextures(1, &saturnRingTexture);
     atmosphereShader.reset();
 }
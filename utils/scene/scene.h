@@ -2,14 +2,21 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <cmath>
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 #include <glad/glad.h>
 #include "../mesh/mesh.h"
 #include "../../shader/shader.h"
 #include "../dust/dust.h"
+#include "../particles/particles.h"
 #include "../asteroids/asteroids.h"
 #include "../lensflare/lensflare.h"
+#include "../occlusion/occlusion.h"
+#include "../orbits/orbits.h"
+#include "../simulation/simulation.h"
+#include "../ephemeris/ephemeris.h"
+#include "../random/random.h"
 #include <memory>
 using namespace std;
 
@@ -24,6 +31,7 @@ struct Planet {
     bool hasAtmosphere;
     glm::vec3 atmosphereColor;
     float atmosphereIntensity;
+    float mass;             // in solar masses, used by the N-body mode
 };
 
 struct Moon {
@@ -42,12 +50,49 @@ private:
     GLuint orbitVAO, orbitVBO;
     void setupOrbits();
     std::unique_ptr<DustSystem> dustSystem;
+    // short-lived effects; collisions emit debris and a flash at each contact
+    std::unique_ptr<ParticleEngine> particleEngine;
+    int debrisEmitter = -1, flashEmitter = -1;
     std::unique_ptr<AsteroidSystem> asteroidSystem;
     std::unique_ptr<Shader> atmosphereShader;
     std::unique_ptr<LensFlareSystem> lensFlareSystem;
+    // depth of the planet pass, read back for culling the belt and moons
+    std::unique_ptr<DepthPyramid> depthPyramid;
     Mesh saturnRing;
+    Mesh orbitRibbon;
     GLuint saturnRingTexture;
     std::vector<Moon> jupiterMoons;
+    Moon earthMoon;
+
+    // Bodies in the orbit table: planets first (body index == planet index),
+    // then the moons.
+    OrbitPropagator orbits;
+    int earthMoonBody;
+    std::vector<int> jupiterMoonBodies;
+    void setupOrbitTable();
+
+    // Orbits are advanced on the simulation thread; the render thread reads
+    // positions interpolated between its last two steps.
+    std::unique_ptr<SimulationThread> simulation;
+    std::vector<glm::dvec3> bodyPositions;
+    std::vector<glm::dvec3> beltPositions;  // integrated belt, N-body mode only
+    double simulationTime = 0.0;
+    double frameAdvance = 0.0;  // simulation time covered by the last frame
+    std::vector<CollisionEvent> collisions;
+    size_t collisionTotal = 0;
+
+    // True when an orbit this short would pass in a few frames at the current warp.
+    bool aliases(float orbitPeriod) const;
+    // True when no planet or moon moves far enough across a pyramid's latency to make it stale.
+    bool occludersSteady() const;
+
+    // Optional real planet positions from a Chebyshev table. When enabled
+    // they replace the planets' simulated positions; moons keep their offset.
+    std::unique_ptr<Ephemeris> ephemeris;
+    bool useEphemeris = false;
+    void applyEphemeris();
+    double sceneDistance(double au) const;
+    void drawRibbon(Shader &planetShader, const glm::dvec3 &centre, const glm::dvec3 &body, const glm::dvec3 &camPos, GLuint texture);
 
 public:
     bool showAsteroids = true;
@@ -55,14 +100,59 @@ public:
     bool showRings = true;
     bool showAtmospheres = true;
     bool showLensFlare = true;
+    bool occlusionCulling = true;   // skip asteroids and moons hidden behind planets
+    bool farFieldBelt = true;       // large belts: distant rocks drawn as one density volume
+    int asteroidCount = 2000;   // read by init()
+    int dustCount = 5000;       // read by init()
+    uint64_t seed = randomSeed();   // read by init(); fixes the asteroid belt and dust
+    std::string catalogPath;    // read by init(); MPCORB-format file replacing the generated belt
 
     Scene();
     void init();
+    // Rendering uses a floating origin: view must have the camera at the
+    // origin, and world positions are offset by camPos in double precision
+    // before they reach the float model matrices.
     void render(Shader &planetShader, const glm::mat4 &view, const glm::mat4 &proj,
-                const glm::vec3 &camPos, const glm::vec3 &camFront, const glm::vec3 &camUp,
-                Mesh &sphere, float simulationTime, float deltaTime, int screenWidth, int screenHeight);
+                const glm::dvec3 &camPos, const glm::vec3 &camFront, const glm::vec3 &camUp,
+                Mesh &sphere, double simulationTime, float deltaTime, int screenWidth, int screenHeight);
     void cleanup();
 
-    glm::vec3 getPlanetPosition(int planetIndex, float simulationTime);
-    void renderAtmospheres(const glm::mat4 &view, const glm::mat4 &proj, const glm::vec3 &camPos, Mesh &sphere, float simulationTime);
+    // Samples the simulation thread once; all getPlanetPosition() calls in the frame read this snapshot.
+    void update();
+    void setTimeScale(float timeScale);
+    double getSimulationTime() const { return simulationTime; }
+    double getEffectiveTimeScale() const;
+    void setNBodyMode(bool enabled);
+    bool isNBodyMode() const;
+    double getEnergyDrift() const;
+    void setBeltSelfGravity(bool enabled);
+    bool isBeltSelfGravity() const;
+    void setBlockTimesteps(bool enabled);
+    bool isBlockTimesteps() const;
+    size_t getForceEvaluations() const;
+    // Contacts between planets, moons and asteroids, found by the simulation's
+    // collision worker. Orbit-table bodies come first (planet index == body index),
+    // then asteroid k as getCollisionBodyCount() + k.
+    void setCollisions(bool enabled);
+    bool isCollisions() const;
+    const std::vector<CollisionEvent> &getCollisions() const { return collisions; }    // since the last update()
+    size_t getCollisionTotal() const { return collisionTotal; }
+    size_t getCollisionBodyCount() const { return orbits.size(); }
+    double getCollisionMilliseconds() const;
+    double getCollisionCoverage() const;
+    // The orbit table with G*m and sphere radius per body; valid from
+    // construction, so batch tools can use them without init().
+    const OrbitPropagator &getOrbitTable() const { return orbits; }
+    std::vector<double> getBodyGM() const;
+    std::vector<float> getBodyRadii() const;
+    const std::string &getPlanetName(int planetIndex) const { return planets[planetIndex].name; }
+    size_t getPlanetCount() const { return planets.size(); }
+    size_t getOccludedAsteroids() const { return asteroidSystem ? asteroidSystem->occludedCount() : 0; }
+    // distance beyond which the belt was drawn as a volume last frame; infinite when it wasn't
+    float getFarFieldDistance() const { return asteroidSystem ? asteroidSystem->farFieldDistance() : INFINITY; }
+    bool hasEphemeris() const { return ephemeris && ephemeris->isOpen(); }
+    void setUseEphemeris(bool enabled) { useEphemeris = enabled && hasEphemeris(); }
+    bool isUsingEphemeris() const { return useEphemeris; }
+    glm::dvec3 getPlanetPosition(int planetIndex) const;
+    void renderAtmospheres(const glm::mat4 &view, const glm::mat4 &proj, const glm::dvec3 &camPos, Mesh &sphere, double simulationTime);
 };
@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+
+// Entry points of one instruction-set variant, defined by simd_<isa>.cpp
+// through kernels.inl and picked by the dispatcher in simd.cpp.
+#define SIMD_DECLARE_KERNELS(ISA)                                                                     \
+    namespace simd { namespace ISA {                                                                  \
+    void sinCosFloat(const float *x, float *s, float *c, size_t n);                                   \
+    void sinCosDouble(const double *x, double *s, double *c, size_t n);                               \
+    void atan2Float(const float *y, const float *x, float *out, size_t n);                            \
+    void atan2Double(const double *y, const double *x, double *out, size_t n);                        \
+    void keplerFloat(const float *meanAnomaly, const float *e, float *out, size_t n);                 \
+    void keplerDouble(const double *meanAnomaly, const double *e, double *out, size_t n);             \
+    } }
+
+SIMD_DECLARE_KERNELS(sse42)
+SIMD_DECLARE_KERNELS(avx2)
+SIMD_DECLARE_KERNELS(avx512)
+
+namespace simd {
+// Largest |x| the vector sine/cosine reduce accurately.
+const float SINCOS_MAX_FLOAT = 8192.0f;
+const double SINCOS_MAX_DOUBLE = 1.0e5;
+// Halley steps per Kepler solve. Near periapsis with e close to 1 the
+// starter is far off, and double needs the fifth step to reach round-off.
+template <typename T> constexpr int halleyIterations() { return sizeof(T) == sizeof(double) ? 5 : 4; }
+}
@@ -0,0 +1,195 @@
+// Kernel bodies shared by every instruction-set variant. Each simd_<isa>.cpp
+// defines SIMD_ISA (its namespace) and SIMD_BYTES (vector width), then
+// includes this file; its own -m flags decide which instructions the vector
+// extensions lower to. Keep standard-library code out of here: inline library
+// functions compiled with wider flags could be merged with scalar callers.
+//
+// sin/cos: Cody-Waite reduction by pi/2 and minimax polynomials on
+// [-pi/4, pi/4] (fdlibm for double, Cephes for float). atan2: reduction to
+// [0, 1], then Cephes' atan approximations.
+#include "kernels.h"
+
+namespace simd {
+namespace SIMD_ISA {
+namespace {
+
+typedef double vd __attribute__((vector_size(SIMD_BYTES)));
+typedef long long vl __attribute__((vector_size(SIMD_BYTES)));
+typedef unsigned long long vul __attribute__((vector_size(SIMD_BYTES)));
+typedef float vf __attribute__((vector_size(SIMD_BYTES)));
+typedef int vi __attribute__((vector_size(SIMD_BYTES)));
+typedef unsigned int vui __attribute__((vector_size(SIMD_BYTES)));
+
+template <typename V, typename T> inline V load(const T *p) { V v; __builtin_memcpy(&v, p, sizeof(V)); return v; }
+template <typename V, typename T> inline void store(T *p, V v) { __builtin_memcpy(p, &v, sizeof(V)); }
+// tails go through a zero-padded vector
+template <typename V, typename T> inline V loadPartial(const T *p, size_t count) { V v = {}; __builtin_memcpy(&v, p, count * sizeof(T)); return v; }
+template <typename V, typename T> inline void storePartial(T *p, V v, size_t count) { __builtin_memcpy(p, &v, count * sizeof(T)); }
+
+inline vd select(vl mask, vd a, vd b) { return (vd)((mask & (vl)a) | (~mask & (vl)b)); }
+inline vf select(vi mask, vf a, vf b) { return (vf)((mask & (vi)a) | (~mask & (vi)b)); }
+inline vd absolute(vd x) { return (vd)((vul)x & 0x7fffffffffffffffULL); }
+inline vf absolute(vf x) { return (vf)((vui)x & 0x7fffffffU); }
+inline vd copySign(vd magnitude, vd sign) { return (vd)(((vul)magnitude & 0x7fffffffffffffffULL) | ((vul)sign & 0x8000000000000000ULL)); }
+inline vf copySign(vf magnitude, vf sign) { return (vf)(((vui)magnitude & 0x7fffffffU) | ((vui)sign & 0x80000000U)); }
+inline vl signBit(vd x) { return (vl)x < 0; }
+inline vi signBit(vf x) { return (vi)x < 0; }
+
+inline void sinCos(vd x, vd &s, vd &c) {
+    const double TWO_OVER_PI = 6.36619772367581382433e-01;
+    const double PIO2_1 = 1.57079632673412561417e+00;   // first 33 bits of pi/2
+    const double PIO2_2 = 6.07710050630396597660e-11;   // next 33 bits
+    const double PIO2_3 = 2.02226624871116645580e-21;
+    const double ROUND = 6755399441055744.0;            // 1.5 * 2^52
+    const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03,
+                 S3 = -1.98412698298579493134e-04, S4 = 2.75573137070700676789e-06,
+                 S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+    const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03,
+                 C3 = 2.48015872894767294178e-05, C4 = -2.75573143513906633035e-07,
+                 C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+
+    // x = k pi/2 + r; adding 1.5 * 2^52 rounds k and leaves it in the low mantissa bits
+    vd t = x * TWO_OVER_PI + ROUND;
+    vul q = (vul)t;
+    vd k = t - ROUND;
+    vd r = ((x - k * PIO2_1) - k * PIO2_2) - k * PIO2_3;
+    vd r2 = r * r;
+    vd ps = r + r * r2 * (S1 + r2 * (S2 + r2 * (S3 + r2 * (S4 + r2 * (S5 + r2 * S6)))));
+    vd pc = 1.0 - 0.5 * r2 + r2 * r2 * (C1 + r2 * (C2 + r2 * (C3 + r2 * (C4 + r2 * (C5 + r2 * C6)))));
+
+    vl odd = (vl)(q & 1) != 0;
+    vd sv = select(odd, pc, ps);
+    vd cv = select(odd, ps, pc);
+    // sin is negated in quadrants 2 and 3, cos in 1 and 2
+    s = (vd)((vul)sv ^ ((q & 2) << 62));
+    c = (vd)((vul)cv ^ (((q + 1) & 2) << 62));
+}
+
+inline void sinCos(vf x, vf &s, vf &c) {
+    const float TWO_OVER_PI = 0.636619772367581343f;
+    const float PIO2_1 = 1.5703125f;
+    const float PIO2_2 = 4.837512969970703125e-4f;
+    const float PIO2_3 = 7.54978995489188216e-8f;
+    const float ROUND = 12582912.0f;                    // 1.5 * 2^23
+    const float S1 = -1.6666654611e-1f, S2 = 8.3321608736e-3f, S3 = -1.9515295891e-4f;
+    const float C1 = 4.166664568298827e-2f, C2 = -1.388731625493765e-3f, C3 = 2.443315711809948e-5f;
+
+    vf t = x * TWO_OVER_PI + ROUND;
+    vui q = (vui)t;
+    vf k = t - ROUND;
+    vf r = ((x - k * PIO2_1) - k * PIO2_2) - k * PIO2_3;
+    vf r2 = r * r;
+    vf ps = r + r * r2 * (S1 + r2 * (S2 + r2 * S3));
+    vf pc = 1.0f - 0.5f * r2 + r2 * r2 * (C1 + r2 * (C2 + r2 * C3));
+
+    vi odd = (vi)(q & 1) != 0;
+    vf sv = select(odd, pc, ps);
+    vf cv = select(odd, ps, pc);
+    s = (vf)((vui)sv ^ ((q & 2) << 30));
+    c = (vf)((vui)cv ^ (((q + 1) & 2) << 30));
+}
+
+inline vd arcTan2(vd y, vd x) {
+    const double PI = 3.14159265358979323846, PI_2 = 1.57079632679489661923, PI_4 = 0.78539816339744830962;
+    const double MOREBITS = 6.123233995736765886130e-17;    // pi/2 - PI_2
+    const double P0 = -8.750608600031904122785e-1, P1 = -1.615753718733365076637e1, P2 = -7.500855792314704667340e1,
+                 P3 = -1.228866684490136173410e2, P4 = -6.485021904942025371773e1;
+    const double Q0 = 2.485846490142306297962e1, Q1 = 1.650270098316988542046e2, Q2 = 4.328810604912902668951e2,
+                 Q3 = 4.853903996359136964868e2, Q4 = 1.945506571482613964425e2;
+    const vd zero = {};
+
+    vd ax = absolute(x), ay = absolute(y);
+    vl swap = ay > ax;
+    vd num = select(swap, ax, ay), den = select(swap, ay, ax);
+    vd a = num / select(den == 0.0, zero + 1.0, den);
+
+    // atan(a) for a in [0, 1], shifting the upper part by pi/4
+    vl upper = a > 0.66;
+    vd z = select(upper, (a - 1.0) / (a + 1.0), a);
+    vd z2 = z * z;
+    vd p = z2 * ((((P0 * z2 + P1) * z2 + P2) * z2 + P3) * z2 + P4) /
+           (((((z2 + Q0) * z2 + Q1) * z2 + Q2) * z2 + Q3) * z2 + Q4);
+    vd r = select(upper, zero + (PI_4 + 0.5 * MOREBITS), zero) + (z + z * p);
+
+    r = select(swap, (PI_2 - r) + MOREBITS, r);
+    r = select(signBit(x), (PI - r) + 2.0 * MOREBITS, r);
+    return copySign(r, y);
+}
+
+inline vf arcTan2(vf y, vf x) {
+    const float PI = 3.14159265358979f, PI_2 = 1.57079632679490f, PI_4 = 0.785398163397448f;
+    const float TAN_PI_8 = 0.4142135623730950f;
+    const vf zero = {};
+
+    vf ax = absolute(x), ay = absolute(y);
+    vi swap = ay > ax;
+    vf num = select(swap, ax, ay), den = select(swap, ay, ax);
+    vf a = num / select(den == 0.0f, zero + 1.0f, den);
+
+    vi upper = a > TAN_PI_8;
+    vf z = select(upper, (a - 1.0f) / (a + 1.0f), a);
+    vf z2 = z * z;
+    vf r = select(upper, zero + PI_4, zero) +
+           ((((8.05374449538e-2f * z2 - 1.38776856032e-1f) * z2 + 1.99777106478e-1f) * z2 - 3.33329491539e-1f) * z2 * z + z);
+
+    r = select(swap, PI_2 - r, r);
+    r = select(signBit(x), PI - r, r);
+    return copySign(r, y);
+}
+
+// Halley's method on f(E) = E - e sin E - M, started from E = M + 0.85 e sign(sin M).
+template <typename V, typename T> inline V kepler(V M, V e) {
+    V s, c;
+    sinCos(M, s, c);
+    V E = M + T(0.85) * copySign(e, s);
+    for (int k = 0; k < halleyIterations<T>(); ++k) {
+        sinCos(E, s, c);
+        V f = E - e * s - M;
+        V d1 = T(1) - e * c;
+        V d2 = e * s;
+        E -= f / (d1 - T(0.5) * f * d2 / d1);
+    }
+    return E;
+}
+
+template <typename V, typename T> void sinCosArrays(const T *x, T *s, T *c, size_t n) {
+    const size_t W = sizeof(V) / sizeof(T);
+    size_t i = 0;
+    V vs, vc;
+    for (; i + W <= n; i += W) {
+        sinCos(load<V>(x + i), vs, vc);
+        store(s + i, vs);
+        store(c + i, vc);
+    }
+    if (i < n) {
+        sinCos(loadPartial<V>(x + i, n - i), vs, vc);
+        storePartial(s + i, vs, n - i);
+        storePartial(c + i, vc, n - i);
+    }
+}
+
+template <typename V, typename T> void atan2Arrays(const T *y, const T *x, T *out, size_t n) {
+    const size_t W = sizeof(V) / sizeof(T);
+    size_t i = 0;
+    for (; i + W <= n; i += W) store(out + i, arcTan2(load<V>(y + i), load<V>(x + i)));
+    if (i < n) storePartial(out + i, arcTan2(loadPartial<V>(y + i, n - i), loadPartial<V>(x + i, n - i)), n - i);
+}
+
+template <typename V, typename T> void keplerArrays(const T *M, const T *e, T *out, size_t n) {
+    const size_t W = sizeof(V) / sizeof(T);
+    size_t i = 0;
+    for (; i + W <= n; i += W) store(out + i, kepler<V, T>(load<V>(M + i), load<V>(e + i)));
+    if (i < n) storePartial(out + i, kepler<V, T>(loadPartial<V>(M + i, n - i), loadPartial<V>(e + i, n - i)), n - i);
+}
+
+}
+
+void sinCosFloat(const float *x, float *s, float *c, size_t n) { sinCosArrays<vf>(x, s, c, n); }
+void sinCosDouble(const double *x, double *s, double *c, size_t n) { sinCosArrays<vd>(x, s, c, n); }
+void atan2Float(const float *y, const float *x, float *out, size_t n) { atan2Arrays<vf>(y, x, out, n); }
+void atan2Double(const double *y, const double *x, double *out, size_t n) { atan2Arrays<vd>(y, x, out, n); }
+void keplerFloat(const float *M, const float *e, float *out, size_t n) { keplerArrays<vf>(M, e, out, n); }
+void keplerDouble(const double *M, const double *e, double *out, size_t n) { keplerArrays<vd>(M, e, out, n); }
+
+}
+}
@@ -0,0 +1,109 @@
+#include "simd.h"
+#include "kernels.h"
+#include <cmath>
+
+namespace simd {
+namespace {
+
+void sinCosFloatScalar(const float *x, float *s, float *c, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        float v = x[i];
+        s[i] = std::sin(v);
+        c[i] = std::cos(v);
+    }
+}
+
+void sinCosDoubleScalar(const double *x, double *s, double *c, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        double v = x[i];
+        s[i] = std::sin(v);
+        c[i] = std::cos(v);
+    }
+}
+
+void atan2FloatScalar(const float *y, const float *x, float *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) out[i] = std::atan2(y[i], x[i]);
+}
+
+void atan2DoubleScalar(const double *y, const double *x, double *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) out[i] = std::atan2(y[i], x[i]);
+}
+
+template <typename T> void keplerScalar(const T *M, const T *e, T *out, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        T E = M[i] + T(0.85) * std::copysign(e[i], std::sin(M[i]));
+        for (int k = 0; k < halleyIterations<T>(); ++k) {
+            T s = std::sin(E), c = std::cos(E);
+            T f = E - e[i] * s - M[i];
+            T d1 = T(1) - e[i] * c;
+            E -= f / (d1 - T(0.5) * f * e[i] * s / d1);
+        }
+        out[i] = E;
+    }
+}
+
+struct Kernels {
+    const char *name;
+    void (*sinCosFloat)(const float *, float *, float *, size_t);
+    void (*sinCosDouble)(const double *, double *, double *, size_t);
+    void (*atan2Float)(const float *, const float *, float *, size_t);
+    void (*atan2Double)(const double *, const double *, double *, size_t);
+    void (*keplerFloat)(const float *, const float *, float *, size_t);
+    void (*keplerDouble)(const double *, const double *, double *, size_t);
+};
+
+#define SIMD_KERNELS(NAME, ISA) { NAME, ISA::sinCosFloat, ISA::sinCosDouble, ISA::atan2Float, ISA::atan2Double, ISA::keplerFloat, ISA::keplerDouble }
+
+Kernels select() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SIMD_KERNELS("avx512", avx512);
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_KERNELS("avx2", avx2);
+    if (__builtin_cpu_supports("sse4.2")) return SIMD_KERNELS("sse4.2", sse42);
+#endif
+    return { "scalar", sinCosFloatScalar, sinCosDoubleScalar, atan2FloatScalar, atan2DoubleScalar,
+             keplerScalar<float>, keplerScalar<double> };
+}
+
+const Kernels &kernels() {
+    static const Kernels chosen = select();
+    return chosen;
+}
+
+// The vector reduction loses accuracy past a few thousand periods; redo those lanes with libm.
+template <typename T> void fixLargeArguments(const T *x, T *s, T *c, size_t n, T limit) {
+    for (size_t i = 0; i < n; ++i) {
+        if (!(std::abs(x[i]) <= limit)) {
+            T v = x[i];
+            s[i] = std::sin(v);
+            c[i] = std::cos(v);
+        }
+    }
+}
+
+}
+
+void sincos(const float *x, float *sinOut, float *cosOut, size_t n) {
+    kernels().sinCosFloat(x, sinOut, cosOut, n);
+    fixLargeArguments(x, sinOut, cosOut, n, SINCOS_MAX_FLOAT);
+}
+
+void sincos(const double *x, double *sinOut, double *cosOut, size_t n) {
+    kernels().sinCosDouble(x, sinOut, cosOut, n);
+    fixLargeArguments(x, sinOut, cosOut, n, SINCOS_MAX_DOUBLE);
+}
+
+void atan2(const float *y, const float *x, float *out, size_t n) { kernels().atan2Float(y, x, out, n); }
+void atan2(const double *y, const double *x, double *out, size_t n) { kernels().atan2Double(y, x, out, n); }
+
+void solveKepler(const float *meanAnomaly, const float *eccentricity, float *eccentricAnomaly, size_t n) {
+    kernels().keplerFloat(meanAnomaly, eccentricity, eccentricAnomaly, n);
+}
+
+void solveKepler(const double *meanAnomaly, const double *eccentricity, double *eccentricAnomaly, size_t n) {
+    kernels().keplerDouble(meanAnomaly, eccentricity, eccentricAnomaly, n);
+}
+
+const char *isa() { return kernels().name; }
+
+}
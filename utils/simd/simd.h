@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Batched math kernels. Each call runs the widest variant the CPU supports
+// (AVX-512, AVX2+FMA or SSE4.2 on x86-64, chosen once via CPUID) and falls
+// back to libm elsewhere. Results agree with libm to a few ulp; outputs must
+// not overlap the inputs.
+namespace simd {
+
+// sin and cos of each x. Arguments beyond a few thousand radians (float) or
+// 1e5 radians (double) are passed to libm instead of the vector reduction.
+void sincos(const float *x, float *sinOut, float *cosOut, size_t n);
+void sincos(const double *x, double *sinOut, double *cosOut, size_t n);
+
+// atan2(y, x) for finite inputs; atan2(0, 0) is 0.
+void atan2(const float *y, const float *x, float *out, size_t n);
+void atan2(const double *y, const double *x, double *out, size_t n);
+
+// Eccentric anomaly E with M = E - e sin E, for elliptic orbits (0 <= e < 1)
+// and mean anomalies already reduced to about [-2pi, 2pi]. Fixed Halley
+// iterations from Danby's starter, so every lane does the same work.
+void solveKepler(const float *meanAnomaly, const float *eccentricity, float *eccentricAnomaly, size_t n);
+void solveKepler(const double *meanAnomaly, const double *eccentricity, double *eccentricAnomaly, size_t n);
+
+// Name of the variant in use: "avx512", "avx2", "sse4.2" or "scalar".
+const char *isa();
+
+// Allocator for columns streamed through the kernels: 64-byte aligned, so
+// no vector load straddles a cache line.
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    static const size_t ALIGNMENT = 64;
+    AlignedAllocator() = default;
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+    T *allocate(size_t n) { return static_cast<T *>(::operator new(n * sizeof(T), std::align_val_t(ALIGNMENT))); }
+    void deallocate(T *p, size_t) { ::operator delete(p, std::align_val_t(ALIGNMENT)); }
+    template <typename U> bool operator==(const AlignedAllocator<U> &) const { return true; }
+    template <typename U> bool operator!=(const AlignedAllocator<U> &) const { return false; }
+};
+template <typename T> using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+}
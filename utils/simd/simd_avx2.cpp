@@ -0,0 +1,6 @@
+// Built with the matching -m flags (see the Makefile); only called when the CPU supports them.
+#if defined(__x86_64__)
+#define SIMD_ISA avx2
+#define SIMD_BYTES 32
+#include "kernels.inl"
+#endif
@@ -0,0 +1,6 @@
+// Built with the matching -m flags (see the Makefile); only called when the CPU supports them.
+#if defined(__x86_64__)
+#define SIMD_ISA sse42
+#define SIMD_BYTES 16
+#include "kernels.inl"
+#endif
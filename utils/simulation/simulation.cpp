@@ -0,0 +1,353 @@
+#include "simulation.h"
+#include "../threadpool/threadpool.h"
+#include <algorithm>
+#include <cmath>
+
+using Clock = std::chrono::steady_clock;
+
+// Wall-clock time the simulation may fall behind before steps are dropped,
+// so a long stall (window drag, breakpoint) doesn't trigger a burst of catch-up steps.
+static const float MAX_CATCH_UP_SECONDS = 0.25f;
+// Share of each fixed step's wall time that N-body substeps may use. Past it
+// the simulation falls behind the requested warp rather than stalling rendering.
+static const double STEP_BUDGET_FRACTION = 0.75;
+// N-body substeps per orbit of the fastest integrated body.
+static const double SUBSTEPS_PER_ORBIT = 64.0;
+static const double TWO_PI = 6.28318530717958647692;
+
+SimulationThread::SimulationThread(const OrbitPropagator &orbitTable, float step)
+    : orbits(orbitTable), stepSeconds(step) {
+    updateBodyPositions();
+    previousPositions = bodyPositions;
+    publish(Clock::now());
+}
+
+SimulationThread::~SimulationThread() { stop(); }
+
+void SimulationThread::setBodyMasses(const std::vector<double> &gm) { bodyGM = gm; }
+
+void SimulationThread::setBelt(const AsteroidBelt &asteroids) { belt = asteroids; }
+
+void SimulationThread::setBeltMass(double gm, double openingAngle) {
+    beltGM = gm;
+    nbody.openingAngle = openingAngle;
+}
+
+void SimulationThread::start() {
+    if (running.exchange(true)) return;
+    worker = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+    running.store(false);
+    if (worker.joinable()) worker.join();
+    if (collisionWorker.joinable()) collisionWorker.join();
+}
+
+void SimulationThread::run() {
+    const Clock::duration stepDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(stepSeconds));
+    const Clock::duration maxCatchUp = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(MAX_CATCH_UP_SECONDS));
+    Clock::time_point previous = Clock::now();
+    Clock::duration accumulator = Clock::duration::zero();
+
+    while (running.load(std::memory_order_relaxed)) {
+        Clock::time_point now = Clock::now();
+        accumulator += now - previous;
+        previous = now;
+        if (accumulator > maxCatchUp) accumulator = maxCatchUp;
+
+        bool stepped = false;
+        while (accumulator >= stepDuration) {
+            step(stepSeconds);
+            accumulator -= stepDuration;
+            stepped = true;
+        }
+        if (stepped) publish(now - accumulator);
+
+        std::this_thread::sleep_until(now + (stepDuration - accumulator));
+    }
+}
+
+void SimulationThread::step(double dt) {
+    bool wantNBody = nbodyRequested.load(std::memory_order_relaxed);
+    bool wantSelfGravity = selfGravityRequested.load(std::memory_order_relaxed);
+    if (wantNBody && (!nbodyActive || wantSelfGravity != selfGravityActive)) {
+        enterNBodyMode();
+    } else if (!wantNBody && nbodyActive) {
+        // the belt jumps back to its closed-form orbits
+        collidersValid = false;
+        nbodyActive = false;
+        nbody.clear();
+        nbodyEnergyDrift.store(0.0, std::memory_order_relaxed);
+        nbodyForceEvaluations.store(0, std::memory_order_relaxed);
+    }
+
+    previousTime = simulationTime;
+    previousPositions = bodyPositions;
+    previousParticles = particles;
+    double h = dt * timeScale.load(std::memory_order_relaxed);
+    if (nbodyActive) {
+        nbody.stepping = blockRequested.load(std::memory_order_relaxed) ? NBodySystem::Stepping::Block : NBodySystem::Stepping::Global;
+        // block steps refine the moons themselves, so only the planets bound the substep
+        double period = nbody.stepping == NBodySystem::Stepping::Block ? shortestMajorPeriod : shortestPeriod;
+        int substeps = period > 0.0 ? std::max(1, (int)std::ceil(std::fabs(h) * SUBSTEPS_PER_ORBIT / period)) : 1;
+        double substep = h / substeps;
+        // collision passes run alongside and take their share out of the budget
+        Clock::time_point deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(dt * (STEP_BUDGET_FRACTION - collisionShare)));
+        size_t evaluations = 0;
+        int done = 0;
+        while (done < substeps) {
+            nbody.step(substep);
+            evaluations += nbody.forceEvaluations();
+            ++done;
+            if (Clock::now() >= deadline) break;
+        }
+        h = substep * done;
+        nbodyForceEvaluations.store(evaluations, std::memory_order_relaxed);
+    }
+    simulationTime += h;
+    achievedTimeScale.store(dt > 0.0 ? h / dt : 0.0, std::memory_order_relaxed);
+    updateBodyPositions();
+    scheduleCollisions();
+}
+
+// Seeds the integrator from the current Keplerian positions. The demo orbit
+// table does not follow Kepler's third law, so velocities are replaced by the
+// circular speed about each body's centre (parent, or the Sun) along the
+// current direction of motion.
+void SimulationThread::enterNBodyMode() {
+    if (bodyGM.size() != orbits.size() || bodyGM.empty() || bodyGM[0] <= 0.0) {
+        nbodyRequested.store(false);
+        return;
+    }
+    nbody.clear();
+    selfGravityActive = selfGravityRequested.load(std::memory_order_relaxed) && beltGM > 0.0 && !belt.empty();
+    nbody.solver = selfGravityActive ? NBodySystem::Solver::BarnesHut : NBodySystem::Solver::Direct;
+    nbodyIndex.assign(orbits.size(), -1);
+    const std::vector<glm::dvec3> &pos = orbits.allPositions();
+    const std::vector<glm::dvec3> &vel = orbits.allVelocities();
+    std::vector<glm::dvec3> velocity(orbits.size(), glm::dvec3(0.0));
+
+    auto circularVelocity = [&](int body, int centre) {
+        glm::dvec3 rel = pos[body] - pos[centre];
+        glm::dvec3 dir = vel[body] - vel[centre];
+        double r = glm::length(rel);
+        if (r <= 0.0 || glm::length(dir) <= 0.0) return velocity[centre];
+        return velocity[centre] + glm::normalize(dir) * std::sqrt(bodyGM[centre] / r);
+    };
+    auto orbitPeriod = [&](int body, int centre) {
+        double speed = glm::length(velocity[body] - velocity[centre]);
+        return speed > 0.0 ? TWO_PI * glm::length(pos[body] - pos[centre]) / speed : HUGE_VAL;
+    };
+    shortestPeriod = HUGE_VAL;
+
+    // massive bodies first; the Sun (body 0) takes up the total momentum
+    glm::dvec3 momentum(0.0);
+    for (size_t i = 1; i < orbits.size(); ++i) {
+        if (bodyGM[i] <= 0.0) continue;
+        int centre = orbits.parentOf((int)i) >= 0 ? orbits.parentOf((int)i) : 0;
+        velocity[i] = circularVelocity((int)i, centre);
+        momentum += bodyGM[i] * velocity[i];
+    }
+    velocity[0] = -momentum / bodyGM[0];
+    for (size_t i = 0; i < orbits.size(); ++i) {
+        if (bodyGM[i] <= 0.0) continue;
+        nbodyIndex[i] = nbody.addMassive(pos[i], velocity[i], bodyGM[i]);
+        int centre = orbits.parentOf((int)i) >= 0 ? orbits.parentOf((int)i) : 0;
+        if (i > 0) shortestPeriod = std::min(shortestPeriod, orbitPeriod((int)i, centre));
+    }
+    shortestMajorPeriod = shortestPeriod;
+
+    // a self-gravitating belt joins the minor bodies, which precede test particles
+    if (selfGravityActive) addBelt(velocity[0]);
+
+    // massless moons are integrated only inside their parent's Hill sphere;
+    // outside it they would not stay bound, so they keep their Keplerian
+    // offset from the (integrated) parent instead
+    for (size_t i = 0; i < orbits.size(); ++i) {
+        int parent = orbits.parentOf((int)i);
+        if (bodyGM[i] > 0.0 || parent < 0 || bodyGM[parent] <= 0.0) continue;
+        double hill = glm::length(pos[parent] - pos[0]) * std::cbrt(bodyGM[parent] / (3.0 * bodyGM[0]));
+        if (glm::length(pos[i] - pos[parent]) >= hill) continue;
+        velocity[i] = circularVelocity((int)i, parent);
+        nbodyIndex[i] = nbody.addTestParticle(pos[i], velocity[i]);
+        shortestPeriod = std::min(shortestPeriod, orbitPeriod((int)i, parent));
+    }
+    if (!(shortestPeriod < HUGE_VAL)) shortestPeriod = shortestMajorPeriod = 0.0;
+
+    if (!selfGravityActive) addBelt(velocity[0]);
+    nbodyActive = true;
+}
+
+// Belt particles on their closed-form orbits, as minor bodies or test particles,
+// moving with the Sun.
+void SimulationThread::addBelt(const glm::dvec3 &sunVelocity) {
+    firstBeltParticle = nbody.size();
+    const double particleGM = beltGM / (double)belt.size();
+    for (size_t i = 0; i < belt.size(); ++i) {
+        glm::dvec3 p = asteroidPosition(belt, i, simulationTime);
+        glm::dvec3 v = sunVelocity + asteroidVelocity(belt, i, simulationTime);
+        if (selfGravityActive) nbody.addMinor(p, v, particleGM);
+        else nbody.addTestParticle(p, v);
+    }
+}
+
+void SimulationThread::updateBodyPositions() {
+    orbits.propagate(simulationTime);
+    bodyPositions = orbits.allPositions();
+    bodyVelocities = orbits.allVelocities();
+    if (!nbodyActive) {
+        particles.clear();
+        return;
+    }
+
+    for (size_t i = 0; i < bodyPositions.size(); ++i) {
+        int parent = orbits.parentOf((int)i);
+        if (nbodyIndex[i] >= 0) {
+            bodyPositions[i] = nbody.position(nbodyIndex[i]);
+            bodyVelocities[i] = nbody.velocity(nbodyIndex[i]);
+        } else if (parent >= 0) {
+            // parents precede children, so the parent's state is already final
+            bodyPositions[i] = bodyPositions[parent] + (orbits.position((int)i) - orbits.position(parent));
+            bodyVelocities[i] = bodyVelocities[parent] + (orbits.velocity((int)i) - orbits.velocity(parent));
+        }
+    }
+    particles.resize(belt.size());
+    for (size_t k = 0; k < belt.size(); ++k) {
+        particles[k] = nbody.position(firstBeltParticle + k);
+    }
+}
+
+// After every step: collects a finished pass and, once the budget allows,
+// hands the latest step to the next one. It never waits for a pass.
+void SimulationThread::scheduleCollisions() {
+    ++stepsSincePass;
+    if (collidersValid) {
+        // the time since the last pass was handed out counts as not swept yet
+        double elapsed = elapsedTime + std::fabs(simulationTime - passTo);
+        collisionCoverageShare.store(elapsed > 0.0 ? sweptTime / elapsed : 1.0, std::memory_order_relaxed);
+    }
+    Clock::time_point now = Clock::now();
+    if (collisionWorker.joinable()) {
+        if (!collisionDone.load(std::memory_order_acquire)) return;
+        collisionWorker.join();
+        // the next pass starts once this one is the budgeted share of the time between them
+        nextPass = passStart + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(passSeconds / COLLISION_BUDGET_FRACTION));
+    }
+    if (!collisionsRequested.load(std::memory_order_relaxed)) {
+        collidersValid = false;
+        collisionShare = 0.0;
+        sweptTime = elapsedTime = 0.0;
+        return;
+    }
+    if (now < nextPass) return;
+
+    if (collidersValid) {
+        double cycle = std::chrono::duration<double>(now - passStart).count();
+        collisionShare = cycle > 0.0 ? std::min(COLLISION_BUDGET_FRACTION, passSeconds / cycle) : COLLISION_BUDGET_FRACTION;
+    }
+    // carry on from the last pass, or restart from the previous step when
+    // that would leave too much for one pass
+    passRestart = !collidersValid || stepsSincePass > MAX_COLLISION_STEPS;
+    elapsedTime += std::fabs(simulationTime - (collidersValid ? passTo : previousTime));
+    if (passRestart) {
+        passFrom = previousTime;
+        passBodiesFrom = previousPositions;
+        passParticlesFrom = previousParticles;
+    } else {
+        passFrom = passTo;
+    }
+    passTo = simulationTime;
+    passBodies = bodyPositions;
+    passParticles = particles;
+    sweptTime += std::fabs(passTo - passFrom);
+    collidersValid = true;
+    stepsSincePass = 0;
+    passStart = now;
+    collisionDone.store(false, std::memory_order_relaxed);
+    collisionWorker = std::thread(&SimulationThread::detectCollisions, this);
+}
+
+// One pass, on collisionWorker: sweeps every body and asteroid from passFrom
+// to passTo. Outside N-body mode the belt follows its closed-form orbits,
+// evaluated here.
+void SimulationThread::detectCollisions() {
+    Clock::time_point start = Clock::now();
+    const size_t bodies = passBodies.size(), count = bodies + belt.size();
+    auto fill = [&](std::vector<glm::dvec3> &out, const std::vector<glm::dvec3> &bodyState,
+                    const std::vector<glm::dvec3> &beltState, double time) {
+        out.resize(count);
+        std::copy(bodyState.begin(), bodyState.end(), out.begin());
+        if (beltState.size() == belt.size()) {
+            std::copy(beltState.begin(), beltState.end(), out.begin() + bodies);
+            return;
+        }
+        collisionPool.parallelFor(belt.size(), 4096, [&](size_t begin, size_t end) {
+            asteroidPositions(belt, time, begin, end, &out[bodies + begin]);
+        });
+    };
+    colliderPrevious.swap(colliderCurrent);
+    if (passRestart || colliderPrevious.size() != count) fill(colliderPrevious, passBodiesFrom, passParticlesFrom, passFrom);
+    fill(colliderCurrent, passBodies, passParticles, passTo);
+    if (colliderRadii.size() != count) {
+        colliderRadii.assign(count, 0.0f);
+        std::copy_n(bodyRadii.begin(), std::min(bodyRadii.size(), bodies), colliderRadii.begin());
+        std::copy(belt.radius.begin(), belt.radius.end(), colliderRadii.begin() + bodies);
+    }
+
+    passCollisions.clear();
+    collisions.detect(colliderPrevious.data(), colliderCurrent.data(), colliderRadii.data(), count, passFrom,
+                      passTo - passFrom, passCollisions);
+    if (!passCollisions.empty()) {
+        std::lock_guard<std::mutex> lock(collisionMutex);
+        size_t room = MAX_PENDING_COLLISIONS - std::min(MAX_PENDING_COLLISIONS, pendingCollisions.size());
+        pendingCollisions.insert(pendingCollisions.end(), passCollisions.begin(), passCollisions.begin() + std::min(room, passCollisions.size()));
+    }
+    passSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    collisionTime.store(1000.0 * passSeconds, std::memory_order_relaxed);
+    collisionDone.store(true, std::memory_order_release);
+}
+
+void SimulationThread::takeCollisions(std::vector<CollisionEvent> &events) {
+    std::lock_guard<std::mutex> lock(collisionMutex);
+    events.insert(events.end(), pendingCollisions.begin(), pendingCollisions.end());
+    pendingCollisions.clear();
+}
+
+void SimulationThread::publish(Clock::time_point stepTime) {
+    SimulationFrame &frame = frames.writeBuffer();
+    frame.previousTime = previousTime;
+    frame.time = simulationTime;
+    frame.previousPositions = previousPositions;
+    frame.positions = bodyPositions;
+    frame.velocities = bodyVelocities;
+    // right after a mode switch the previous step has no particles to blend from
+    frame.previousParticles = previousParticles.size() == particles.size() ? previousParticles : particles;
+    frame.particles = particles;
+    frame.stepTime = stepTime;
+    frames.publish();
+
+    // energy needs a full potential pass, so it is only refreshed about once a second
+    if (nbodyActive && ++publishesSinceEnergy * stepSeconds >= 1.0f) {
+        nbodyEnergyDrift.store(nbody.energyDrift(), std::memory_order_relaxed);
+        publishesSinceEnergy = 0;
+    }
+}
+
+void SimulationThread::sample(std::vector<glm::dvec3> &positions, std::vector<glm::dvec3> &particlesOut, double &time) {
+    frames.update();
+    const SimulationFrame &frame = frames.readBuffer();
+
+    double alpha = std::chrono::duration<double>(Clock::now() - frame.stepTime).count() / stepSeconds;
+    alpha = std::clamp(alpha, 0.0, 1.0);
+
+    time = frame.previousTime + (frame.time - frame.previousTime) * alpha;
+    positions.resize(frame.positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        positions[i] = glm::mix(frame.previousPositions[i], frame.positions[i], alpha);
+    }
+    particlesOut.resize(frame.particles.size());
+    for (size_t i = 0; i < particlesOut.size(); ++i) {
+        particlesOut[i] = glm::mix(frame.previousParticles[i], frame.particles[i], alpha);
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "triplebuffer.h"
+#include "../orbits/orbits.h"
+#include "../nbody/nbody.h"
+#include "../asteroids/asteroids.h"
+#include "../collision/collision.h"
+#include "../threadpool/threadpool.h"
+
+// State published after each batch of fixed steps. It carries the previous
+// step as well so the render thread can interpolate without keeping history.
+struct SimulationFrame {
+    double previousTime = 0.0;
+    double time = 0.0;
+    std::vector<glm::dvec3> previousPositions;
+    std::vector<glm::dvec3> positions;
+    std::vector<glm::dvec3> velocities;
+    // belt particles, only filled while N-body mode is active
+    std::vector<glm::dvec3> previousParticles;
+    std::vector<glm::dvec3> particles;
+    // wall-clock instant that `time` corresponds to
+    std::chrono::steady_clock::time_point stepTime;
+};
+
+// Advances the simulation on its own thread at a fixed rate, independent of
+// the render loop's frame time.
+class SimulationThread {
+public:
+    SimulationThread(const OrbitPropagator &orbits, float stepSeconds = 1.0f / 120.0f);
+    ~SimulationThread();
+
+    // N-body set-up, must be called before start(). bodyGM holds G*m per
+    // orbit-table body (0 for massless moons); the belt becomes test particles.
+    void setBodyMasses(const std::vector<double> &bodyGM);
+    void setBelt(const AsteroidBelt &belt);
+    // Sphere radius of each orbit-table body, for collision detection.
+    void setBodyRadii(const std::vector<float> &radii) { bodyRadii = radii; }
+
+    void start();
+    void stop();
+
+    void setTimeScale(float scale) { timeScale.store(scale, std::memory_order_relaxed); }
+    // Warp actually achieved over the last step. N-body substeps are capped
+    // by a wall-clock budget, so at extreme warps this can trail the request.
+    double effectiveTimeScale() const { return achievedTimeScale.load(std::memory_order_relaxed); }
+    // Switching is picked up at the next step; entering N-body mode seeds it
+    // from the current Keplerian state.
+    void setNBodyMode(bool enabled) { nbodyRequested.store(enabled, std::memory_order_relaxed); }
+    bool isNBodyMode() const { return nbodyRequested.load(std::memory_order_relaxed); }
+    double energyDrift() const { return nbodyEnergyDrift.load(std::memory_order_relaxed); }
+    // Makes belt particles pull on each other through the Barnes-Hut solver,
+    // sharing beltGM equally. Changing it while N-body mode runs re-seeds the mode.
+    void setBeltSelfGravity(bool enabled) { selfGravityRequested.store(enabled, std::memory_order_relaxed); }
+    bool isBeltSelfGravity() const { return selfGravityRequested.load(std::memory_order_relaxed); }
+    void setBeltMass(double beltGM, double openingAngle);
+    // Per-body power-of-two block steps instead of one global step; switches
+    // without re-seeding. forceEvaluations() is the body-force count of the
+    // last fixed step, summed over its substeps, to compare the two.
+    void setBlockTimesteps(bool enabled) { blockRequested.store(enabled, std::memory_order_relaxed); }
+    bool isBlockTimesteps() const { return blockRequested.load(std::memory_order_relaxed); }
+    size_t forceEvaluations() const { return nbodyForceEvaluations.load(std::memory_order_relaxed); }
+
+    // Contact detection between the orbit-table bodies and the belt, on a
+    // worker of its own so that no step waits for it. Each pass sweeps from
+    // where the last one ended to the latest step, and passes are spaced so
+    // that detection takes at most COLLISION_BUDGET_FRACTION of the wall
+    // time; the N-body substeps get that much less. A pass that would have to
+    // cover more than MAX_COLLISION_STEPS sweeps only the latest step, and
+    // the time before it goes unchecked. Events number orbit-table body i as
+    // i and belt asteroid k as bodyCount + k. The queue holds at most
+    // MAX_PENDING_COLLISIONS events between takeCollisions() calls; later
+    // ones are dropped.
+    static const size_t MAX_PENDING_COLLISIONS = 1 << 16;
+    static constexpr double COLLISION_BUDGET_FRACTION = 0.25;
+    static const int MAX_COLLISION_STEPS = 60;
+    void setCollisions(bool enabled) { collisionsRequested.store(enabled, std::memory_order_relaxed); }
+    bool isCollisions() const { return collisionsRequested.load(std::memory_order_relaxed); }
+    // Moves the events found since the last call into events (any thread).
+    void takeCollisions(std::vector<CollisionEvent> &events);
+    // wall time of the last detection pass
+    double collisionMilliseconds() const { return collisionTime.load(std::memory_order_relaxed); }
+    // share of the simulated time swept since detection was switched on
+    double collisionCoverage() const { return collisionCoverageShare.load(std::memory_order_relaxed); }
+
+    // Render thread only. Fills `positions` (and `particles`, empty outside
+    // N-body mode) with the state interpolated between the last two steps for
+    // the current wall-clock time.
+    void sample(std::vector<glm::dvec3> &positions, std::vector<glm::dvec3> &particles, double &time);
+
+private:
+    void run();
+    void step(double dt);
+    void publish(std::chrono::steady_clock::time_point stepTime);
+    void enterNBodyMode();
+    void addBelt(const glm::dvec3 &sunVelocity);
+    void updateBodyPositions();
+    void scheduleCollisions();
+    void detectCollisions();
+
+    OrbitPropagator orbits;     // owned by the simulation thread once started
+    const float stepSeconds;
+    double simulationTime = 0.0;
+    double previousTime = 0.0;
+    std::vector<glm::dvec3> bodyPositions, bodyVelocities, previousPositions;
+    std::vector<glm::dvec3> particles, previousParticles;
+
+    // N-body mode
+    NBodySystem nbody;
+    std::vector<double> bodyGM;
+    AsteroidBelt belt;
+    std::vector<int> nbodyIndex;    // per orbit-table body, -1 = Keplerian about its parent
+    size_t firstBeltParticle = 0;
+    bool nbodyActive = false;
+    bool selfGravityActive = false;
+    double beltGM = 0.0;
+    int publishesSinceEnergy = 0;
+    // fastest orbits among integrated bodies; they bound the substep length
+    double shortestPeriod = 0.0, shortestMajorPeriod = 0.0;
+
+    // collision detection: every body and asteroid at the start and end of
+    // a pass. The pass fields below belong to collisionWorker while a pass
+    // runs and to this thread otherwise.
+    std::vector<float> bodyRadii, colliderRadii;
+    std::vector<glm::dvec3> colliderPrevious, colliderCurrent;
+    bool collidersValid = false;    // the next pass can start where the last one ended
+    ThreadPool collisionPool{std::max(1u, std::thread::hardware_concurrency() / 4)};
+    CollisionDetector collisions{collisionPool};
+    double passFrom = 0.0, passTo = 0.0;
+    bool passRestart = false;       // colliders at passFrom come from the pass*From state
+    std::vector<glm::dvec3> passBodiesFrom, passParticlesFrom, passBodies, passParticles;
+    std::vector<CollisionEvent> passCollisions;
+    double passSeconds = 0.0;
+    std::thread collisionWorker;
+    std::atomic<bool> collisionDone{false};
+    std::chrono::steady_clock::time_point passStart, nextPass;
+    int stepsSincePass = 0;
+    double collisionShare = 0.0;    // of the wall time, taken from the N-body budget
+    double sweptTime = 0.0, elapsedTime = 0.0;
+    std::mutex collisionMutex;
+    std::vector<CollisionEvent> pendingCollisions;
+
+    TripleBuffer<SimulationFrame> frames;
+    std::thread worker;
+    std::atomic<bool> running{false};
+    std::atomic<float> timeScale{1.0f};
+    std::atomic<double> achievedTimeScale{1.0};
+    std::atomic<bool> nbodyRequested{false};
+    std::atomic<double> nbodyEnergyDrift{0.0};
+    std::atomic<bool> selfGravityRequested{false};
+    std::atomic<bool> blockRequested{false};
+    std::atomic<size_t> nbodyForceEvaluations{0};
+    std::atomic<bool> collisionsRequested{false};
+    std::atomic<double> collisionTime{0.0};
+    std::atomic<double> collisionCoverageShare{1.0};
+};
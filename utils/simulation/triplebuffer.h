@@ -0,0 +1,34 @@
+#pragma once
+#include <atomic>
+
+// Lock-free single-producer/single-consumer triple buffer. The writer fills
+// writeBuffer() and publish()es it; the reader calls update() and then reads
+// readBuffer(), which stays untouched until the reader's next update(). Neither
+// side ever waits for the other.
+template <typename T>
+class TripleBuffer {
+public:
+    T &writeBuffer() { return buffers[writeIndex]; }
+
+    void publish() {
+        writeIndex = shared.exchange(writeIndex | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Returns true if a newer buffer was published since the last call.
+    bool update() {
+        if (!(shared.load(std::memory_order_relaxed) & FRESH_BIT)) return false;
+        readIndex = shared.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const T &readBuffer() const { return buffers[readIndex]; }
+
+private:
+    static const int INDEX_MASK = 3;
+    static const int FRESH_BIT = 4;
+
+    T buffers[3];
+    int writeIndex = 0;
+    int readIndex = 1;
+    std::atomic<int> shared{2};
+};
@@ -0,0 +1,77 @@
+#include "threadpool.h"
+#include <algorithm>
+
+static thread_local bool insideJob = false;
+
+ThreadPool::ThreadPool(unsigned workers) {
+    if (workers == 0) {
+        unsigned hw = std::thread::hardware_concurrency();
+        workers = hw > 1 ? hw - 1 : 0;
+    }
+    for (unsigned i = 0; i < workers; ++i) threads.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &t : threads) t.join();
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallelFor(size_t count, size_t minChunk, const std::function<void(size_t, size_t)> &fn) {
+    if (count == 0) return;
+    // ~4 chunks per lane keeps the load balanced without much scheduling overhead
+    size_t chunk = std::max<size_t>(std::max<size_t>(minChunk, 1), (count + lanes() * 4 - 1) / (lanes() * 4));
+    if (threads.empty() || insideJob || chunk >= count) {
+        fn(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        jobCount = count;
+        jobChunk = chunk;
+        nextItem.store(0);
+        pending = (unsigned)threads.size();
+        ++generation;
+    }
+    wake.notify_all();
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::runChunks() {
+    insideJob = true;
+    for (;;) {
+        size_t begin = nextItem.fetch_add(jobChunk);
+        if (begin >= jobCount) break;
+        (*job)(begin, std::min(begin + jobChunk, jobCount));
+    }
+    insideJob = false;
+}
+
+void ThreadPool::workerLoop() {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+        lock.unlock();
+        runChunks();
+        lock.lock();
+        if (--pending == 0) done.notify_one();
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
+
+// Fixed set of worker threads for data-parallel loops. The calling thread
+// takes part in the work, so a pool of N workers runs N + 1 lanes.
+class ThreadPool {
+public:
+    // workers == 0 picks hardware_concurrency() - 1
+    explicit ThreadPool(unsigned workers = 0);
+    ~ThreadPool();
+
+    unsigned lanes() const { return (unsigned)threads.size() + 1; }
+
+    // Runs fn(begin, end) over [0, count) in chunks of at least minChunk items
+    // and returns once every chunk has finished. Calls from inside a running
+    // job execute serially instead of deadlocking.
+    void parallelFor(size_t count, size_t minChunk, const std::function<void(size_t, size_t)> &fn);
+
+    // Process-wide pool shared by the simulation and render-side builders.
+    static ThreadPool &shared();
+
+private:
+    void workerLoop();
+    void runChunks();
+
+    std::vector<std::thread> threads;
+    std::mutex submitMutex;     // one job at a time
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(size_t, size_t)> *job = nullptr;
+    size_t jobCount = 0, jobChunk = 1;
+    std::atomic<size_t> nextItem{0};
+    unsigned pending = 0;
+    uint64_t generation = 0;
+    bool stopping = false;
+};